@@ -10,15 +10,24 @@ int main(int argc, char* argv[])
     uint32_t concurrency = std::stoi(argv[2]);
     uint32_t seconds = std::stoi(argv[3]);
     const char* port = argv[4];
+    // 可选参数：为1时全部协程复用同一条MultiplexTCPConnection，为2时全部协程共享一个ConnectionPool，否则每个协程独占一条连接
+    int connection_mode = argc > 5 ? std::stoi(argv[5]) : 0;
+    bool shared = connection_mode == 1 || connection_mode == 2;
 
     BenchmarkRecorder recorder;
     io_context ioc;
     boost::asio::thread_pool thread_pool(thread_num);
 
     std::atomic<bool> need_stop = false;
+    std::shared_ptr<TCPConnectionBase> shared_connection_ptr;
+    if (connection_mode == 1) {
+        shared_connection_ptr = std::make_shared<MultiplexTCPConnection>("127.0.0.1", port, ioc);
+    } else if (connection_mode == 2) {
+        shared_connection_ptr = std::make_shared<ConnectionPool>("127.0.0.1", port, ioc);
+    }
     for (uint32_t i = 0; i < concurrency; ++i) {
         co_spawn(ioc, [&]() -> awaitable<void> {
-            std::unique_ptr<TCPConnectionBase> async_connection_ptr = std::make_unique<AsyncTCPConnection>("127.0.0.1", port, ioc);
+            std::shared_ptr<TCPConnectionBase> async_connection_ptr = shared ? shared_connection_ptr : std::make_shared<AsyncTCPConnection>("127.0.0.1", port, ioc);
             while (!need_stop.load(std::memory_order_acquire)) {
                 TimerRaii timer([&](double milliseconds)
                             { recorder.add(milliseconds); });
@@ -36,6 +45,6 @@ int main(int argc, char* argv[])
     std::this_thread::sleep_for(std::chrono::seconds(seconds));
     need_stop.store(true, std::memory_order_release);
 
-    LOG("total requested {}, avg timecost {}", recorder.total_requests.load(), (recorder.total_timecost.load() + 0.0) / recorder.total_requests.load());
+    LOG("{}", recorder.report());
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,313 @@
+// 压测程序的标准输出只用于结果，框架日志只保留WARN及以上级别
+#define STRUCT_RPC_LOG_LEVEL STRUCT_RPC_LOG_LEVEL_WARN
+#include "functions.hpp"
+#include <cstdlib>
+#include <format>
+#include <iostream>
+#include <map>
+#include <new>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+/**
+ * 序列化微基准：不建立连接，在单线程内直接调用编解码路径，分别测量一次RPC调用的三个阶段：
+ *   encode: 客户端构造参数tuple并编码请求包（TCPConnectionBase::build_tcp_request）
+ *   handle: server解析请求头、解码参数、执行函数并编码返回值（CommonFuncTemplate<Func>）
+ *   decode: 客户端解析响应头并解码返回值及引用参数（TCPConnectionBase::decode_rpc_result）
+ * 每个阶段输出ns/op以及allocs/op（每次调用的堆内存分配次数，通过替换全局operator new统计），e.g.:
+ *   ./benchmark_serialization [--filter=string] [--min-time-ms=200] [--format=text|csv]
+*/
+
+namespace
+{
+std::atomic<uint64_t> allocation_count = 0;
+}
+
+void* operator new(std::size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+namespace rpc_serialization
+{
+    // 与example中的CombinedStruct布局相同的简单结构体
+    struct Item
+    {
+        std::string name;
+        uint32_t id;
+    };
+
+    // 包含嵌套结构体、数组和map的复合结构体
+    struct Record
+    {
+        Item owner;
+        std::vector<Item> items;
+        std::map<std::string, int64_t> attributes;
+    };
+
+    inline int32_t add_ints(int32_t a, int32_t b) {
+        return a + b;
+    }
+
+    // 视图类型参数在server端直接指向接收缓冲区
+    inline uint32_t view_size(std::string_view data) {
+        return static_cast<uint32_t>(data.size());
+    }
+
+    inline Item echo_item(Item item) {
+        return item;
+    }
+
+    inline Record echo_record(Record record) {
+        return record;
+    }
+
+    inline std::vector<int64_t> echo_vector(std::vector<int64_t> values) {
+        return values;
+    }
+
+    inline std::map<std::string, std::string> echo_map(std::map<std::string, std::string> values) {
+        return values;
+    }
+}
+
+namespace
+{
+using clock_type = std::chrono::steady_clock;
+
+struct Options
+{
+    std::string filter;
+    uint32_t min_time_ms = 200;
+    std::string format = "text";
+};
+
+struct PhaseResult
+{
+    double ns_per_op = 0;
+    double allocs_per_op = 0;
+};
+
+struct CaseResult
+{
+    std::string name;
+    size_t request_bytes = 0;
+    size_t response_bytes = 0;
+    PhaseResult encode;
+    PhaseResult handle;
+    PhaseResult decode;
+};
+
+/**
+ * @brief: 直接调用TCPConnectionBase编解码接口的客户端，不建立连接
+*/
+class CodecConnection : public TCPConnectionBase
+{
+public:
+    CodecConnection() : TCPConnectionBase("", "") {}
+
+    using TCPConnectionBase::build_tcp_request;
+    using TCPConnectionBase::decode_rpc_result;
+
+    void release_request(util::SegmentedBuffer&& request)
+    {
+        request_buffers->release(std::move(request));
+    }
+};
+
+/**
+ * @brief: 阻止编译器把结果未被使用的调用优化掉
+*/
+template <typename T>
+inline void keep_alive(const T& value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r"(&value) : "memory");
+#else
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+/**
+ * @brief: 重复执行op直到累计耗时超过min_time_ms，返回平均每次的耗时和内存分配次数
+ * @note: 正式计时前先执行若干次，使缓冲池进入稳定状态，与长连接上的实际请求一致
+*/
+template <typename Op>
+PhaseResult measure(Op&& op, const Options& options)
+{
+    for (int i = 0; i < 16; ++i) {
+        op();
+    }
+    uint64_t iterations = 0;
+    uint64_t batch = 1;
+    auto min_time = std::chrono::milliseconds(options.min_time_ms);
+    uint64_t allocations_before = allocation_count.load(std::memory_order_relaxed);
+    auto begin = clock_type::now();
+    clock_type::duration elapsed {};
+    do {
+        for (uint64_t i = 0; i < batch; ++i) {
+            op();
+        }
+        iterations += batch;
+        batch = std::min<uint64_t>(batch * 2, 1 << 16);
+        elapsed = clock_type::now() - begin;
+    } while (elapsed < min_time);
+    uint64_t allocations = allocation_count.load(std::memory_order_relaxed) - allocations_before;
+    return PhaseResult {std::chrono::duration<double, std::nano>(elapsed).count() / iterations, static_cast<double>(allocations) / iterations};
+}
+
+/**
+ * @brief: 测量一次RPC调用Func(args...)的编码、处理和解码耗时
+*/
+template <auto Func, typename... Args>
+void run_case(std::string name, const Options& options, std::vector<CaseResult>& results, Args... args)
+{
+    if (!options.filter.empty() && name.find(options.filter) == std::string::npos) {
+        return;
+    }
+    using param_tuple_type = typename trait_helper::function_traits<decltype(Func)>::decayed_arguments_tuple;
+    CodecConnection codec;
+    std::tuple<Args...> call_args(std::move(args)...);
+
+    // 预先生成一份完整的请求包和响应包，作为handle和decode阶段的输入
+    std::string request_str = std::apply([&](auto&... call_arg) {
+        param_tuple_type param_tuple(call_arg...);
+        return codec.build_tcp_request<Func>(1, param_tuple).to_string();
+    }, call_args);
+    util::BufferPool<util::SegmentedBuffer> response_buffers;
+    auto handle_request = [&]() {
+        common_define::TCPRequestView view = common_define::ParseRequestView(request_str);
+        util::SegmentedBuffer response = response_buffers.acquire();
+        common_define::ReserveHeader<common_define::ResponseHeader>(response);
+        common_define::CommonFuncTemplate<Func>(view.params, response);
+        common_define::FinishResponse(response, view.request_id, static_cast<int32_t>(common_define::RetCode::RET_SUCC));
+        return response;
+    };
+    util::SegmentedBuffer first_response = handle_request();
+    std::string response_str = first_response.to_string();
+    response_buffers.release(std::move(first_response));
+
+    CaseResult result {name, request_str.size(), response_str.size()};
+    uint64_t request_id = 0;
+    result.encode = measure([&] {
+        std::apply([&](auto&... call_arg) {
+            param_tuple_type param_tuple(call_arg...);
+            util::SegmentedBuffer request = codec.build_tcp_request<Func>(++request_id, param_tuple);
+            keep_alive(request);
+            codec.release_request(std::move(request));
+        }, call_args);
+    }, options);
+    result.handle = measure([&] {
+        util::SegmentedBuffer response = handle_request();
+        keep_alive(response);
+        response_buffers.release(std::move(response));
+    }, options);
+    // 引用参数的解码结果写回call_args，与调用方传入左值参数时相同
+    param_tuple_type decode_tuple = std::apply([](auto&... call_arg) { return param_tuple_type(call_arg...); }, call_args);
+    result.decode = measure([&] {
+        std::apply([&](auto&... call_arg) {
+            common_define::TCPResponseView view = common_define::ParseResponseView(response_str);
+            if constexpr (std::is_void_v<typename trait_helper::rpc_return_type_getter<decltype(Func)>::type>) {
+                codec.decode_rpc_result<Func>(view, decode_tuple, call_arg...);
+            } else {
+                auto value = codec.decode_rpc_result<Func>(view, decode_tuple, call_arg...);
+                keep_alive(value);
+            }
+        }, call_args);
+    }, options);
+    results.push_back(std::move(result));
+}
+
+rpc_serialization::Record make_record(size_t item_num)
+{
+    rpc_serialization::Record record {{"owner", 0}};
+    for (size_t i = 0; i < item_num; ++i) {
+        record.items.push_back(rpc_serialization::Item {std::format("item_{}", i), static_cast<uint32_t>(i)});
+        record.attributes.emplace(std::format("attribute_{}", i), static_cast<int64_t>(i));
+    }
+    return record;
+}
+
+std::map<std::string, std::string> make_map(size_t entry_num)
+{
+    std::map<std::string, std::string> values;
+    for (size_t i = 0; i < entry_num; ++i) {
+        values.emplace(std::format("key_{}", i), std::format("value_{}", i));
+    }
+    return values;
+}
+
+void write_text(std::ostream& out, const std::vector<CaseResult>& results)
+{
+    out << std::format("{:<24}{:>10}{:>10}{:>14}{:>9}{:>14}{:>9}{:>14}{:>9}\n",
+        "case", "req_B", "resp_B", "encode_ns", "allocs", "handle_ns", "allocs", "decode_ns", "allocs");
+    for (const CaseResult& r : results) {
+        out << std::format("{:<24}{:>10}{:>10}{:>14.1f}{:>9.2f}{:>14.1f}{:>9.2f}{:>14.1f}{:>9.2f}\n",
+            r.name, r.request_bytes, r.response_bytes, r.encode.ns_per_op, r.encode.allocs_per_op,
+            r.handle.ns_per_op, r.handle.allocs_per_op, r.decode.ns_per_op, r.decode.allocs_per_op);
+    }
+}
+
+void write_csv(std::ostream& out, const std::vector<CaseResult>& results)
+{
+    out << "case,request_bytes,response_bytes,encode_ns_per_op,encode_allocs_per_op,handle_ns_per_op,handle_allocs_per_op,decode_ns_per_op,decode_allocs_per_op\n";
+    for (const CaseResult& r : results) {
+        out << std::format("{},{},{},{:.1f},{:.2f},{:.1f},{:.2f},{:.1f},{:.2f}\n",
+            r.name, r.request_bytes, r.response_bytes, r.encode.ns_per_op, r.encode.allocs_per_op,
+            r.handle.ns_per_op, r.handle.allocs_per_op, r.decode.ns_per_op, r.decode.allocs_per_op);
+    }
+}
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg.starts_with("--filter=")) {
+            options.filter = arg.substr(9);
+        } else if (arg.starts_with("--min-time-ms=")) {
+            options.min_time_ms = std::stoul(std::string(arg.substr(14)));
+        } else if (arg.starts_with("--format=")) {
+            options.format = arg.substr(9);
+        } else {
+            std::cerr << std::format("unknown argument {}", arg) << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<CaseResult> results;
+    run_case<&rpc_serialization::add_ints>("int32_add", options, results, int32_t(1), int32_t(2));
+    for (size_t size : {100, 1024, 64 * 1024, 1024 * 1024}) {
+        run_case<&rpc_benchmark::echo>(std::format("string_echo_{}", size), options, results, std::string(size, 'x'));
+    }
+    run_case<&rpc_serialization::view_size>("string_view_1048576", options, results, std::string(1024 * 1024, 'x'));
+    run_case<&rpc_benchmark::echo_ref>("string_ref_1024", options, results, std::string(1024, 'x'));
+    run_case<&rpc_serialization::echo_item>("struct_item", options, results, rpc_serialization::Item {"hello world", 42});
+    run_case<&rpc_serialization::echo_record>("struct_nested_16", options, results, make_record(16));
+    run_case<&rpc_serialization::echo_vector>("vector_int64_1000", options, results, std::vector<int64_t>(1000, 42));
+    run_case<&rpc_serialization::echo_map>("map_string_100", options, results, make_map(100));
+
+    if (options.format == "csv") {
+        write_csv(std::cout, results);
+    } else {
+        write_text(std::cout, results);
+    }
+    return 0;
+}
@@ -5,13 +5,16 @@
 #include <vector>
 
 
-int main()
+int main(int argc, char* argv[])
 {
-    uint32_t thread_num = std::stoi(argv[1]);
-    uint32_t port = std::stoi(argv[2]);
+    uint32_t thread_num = argc > 1 ? std::stoi(argv[1]) : 4;
+    uint32_t port = argc > 2 ? std::stoi(argv[2]) : 8080;
 
     TCPServer server(/* thread_num */ thread_num, /* listen_port */ port);
-    server.RegisterServerFunctions<&rpc_benchmark::echo>();
+    server.RegisterServerFunctions<&rpc_benchmark::echo,
+        &rpc_benchmark::echo_coro,
+        &rpc_benchmark::echo_blocking,
+        &rpc_benchmark::echo_ref>();
     server.Start();
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,411 @@
+// 压测程序的标准输出只用于结果，框架日志只保留WARN及以上级别
+#define STRUCT_RPC_LOG_LEVEL STRUCT_RPC_LOG_LEVEL_WARN
+#include "functions.hpp"
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+/**
+ * 压测矩阵：默认在同一进程内启动server，经回环地址依次压测每一组参数组合，输出QPS和延迟分位数，e.g.:
+ *   ./benchmark_suite --payloads=16,1024,65536 --concurrency=1,16,64 --server-threads=1,4 \
+ *                     --clients=sync,async,multiplex --handlers=func,coro,blocking,ref --format=json --output=result.json
+ * 可选参数：
+ *   --duration-ms / --warmup-ms: 每组参数的计时时长及计时前的预热时长
+ *   --client-threads: 异步客户端运行io_context的线程数
+ *   --port: 进程内server监听的端口
+ *   --connect=host:port: 不启动进程内server，压测已经运行的benchmark_server，此时忽略--server-threads
+ * 客户端类型：sync为每个调用方一条SyncTCPConnection的线程；async为每个调用方一条AsyncTCPConnection的协程；
+ *           multiplex为全部调用方协程共用一条MultiplexTCPConnection。concurrency为同时发起调用的调用方数量
+*/
+
+namespace
+{
+using clock_type = std::chrono::steady_clock;
+
+struct Options
+{
+    std::vector<size_t> payloads {16, 1024, 65536};
+    std::vector<uint32_t> concurrency {1, 16, 64};
+    std::vector<uint32_t> server_threads {1, 4};
+    std::vector<std::string> clients {"sync", "async", "multiplex"};
+    std::vector<std::string> handlers {"func", "coro", "blocking", "ref"};
+    uint32_t duration_ms = 2000;
+    uint32_t warmup_ms = 200;
+    uint32_t client_threads = 2;
+    uint32_t port = 18080;
+    std::string host = "127.0.0.1";
+    bool external_server = false;
+    std::string format = "csv";
+    std::string output;
+};
+
+struct BenchmarkCase
+{
+    uint32_t server_threads = 0;
+    std::string client;
+    std::string handler;
+    size_t payload = 0;
+    uint32_t concurrency = 0;
+};
+
+struct CaseResult
+{
+    BenchmarkCase benchmark_case;
+    uint64_t errors = 0;
+    double seconds = 0;
+    util::HistogramSnapshot latency;
+};
+
+/**
+ * @brief: 压测一组参数时全部调用方共享的状态，只统计计时区间内完成的请求
+*/
+struct RunState
+{
+    util::LatencyHistogram latency;
+    std::atomic<uint64_t> errors = 0;
+    std::atomic<bool> recording = false;
+    std::atomic<bool> stopped = false;
+
+    void record(clock_type::time_point start)
+    {
+        if (recording.load(std::memory_order_relaxed)) {
+            latency.record(std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - start).count());
+        }
+    }
+
+    void record_error()
+    {
+        if (recording.load(std::memory_order_relaxed)) {
+            errors.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+};
+
+template <typename T>
+std::vector<T> parse_list(std::string_view text)
+{
+    std::vector<T> result;
+    while (!text.empty()) {
+        size_t pos = text.find(',');
+        std::string item(text.substr(0, pos));
+        if constexpr (std::is_same_v<T, std::string>) {
+            result.push_back(item);
+        } else {
+            result.push_back(static_cast<T>(std::stoull(item)));
+        }
+        text = pos == std::string_view::npos ? std::string_view() : text.substr(pos + 1);
+    }
+    return result;
+}
+
+Options parse_options(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        size_t pos = arg.find('=');
+        if (!arg.starts_with("--") || pos == std::string_view::npos) {
+            throw std::invalid_argument(std::format("invalid argument {}", arg));
+        }
+        std::string_view key = arg.substr(2, pos - 2);
+        std::string_view value = arg.substr(pos + 1);
+        if (key == "payloads") {
+            options.payloads = parse_list<size_t>(value);
+        } else if (key == "concurrency") {
+            options.concurrency = parse_list<uint32_t>(value);
+        } else if (key == "server-threads") {
+            options.server_threads = parse_list<uint32_t>(value);
+        } else if (key == "clients") {
+            options.clients = parse_list<std::string>(value);
+        } else if (key == "handlers") {
+            options.handlers = parse_list<std::string>(value);
+        } else if (key == "duration-ms") {
+            options.duration_ms = std::stoul(std::string(value));
+        } else if (key == "warmup-ms") {
+            options.warmup_ms = std::stoul(std::string(value));
+        } else if (key == "client-threads") {
+            options.client_threads = std::max(1ul, std::stoul(std::string(value)));
+        } else if (key == "port") {
+            options.port = std::stoul(std::string(value));
+        } else if (key == "connect") {
+            size_t colon = value.rfind(':');
+            options.host = std::string(value.substr(0, colon));
+            options.port = std::stoul(std::string(value.substr(colon + 1)));
+            options.external_server = true;
+            options.server_threads = {0};
+        } else if (key == "format") {
+            options.format = value;
+        } else if (key == "output") {
+            options.output = value;
+        } else {
+            throw std::invalid_argument(std::format("unknown option {}", key));
+        }
+    }
+    for (const std::string& client : options.clients) {
+        if (client != "sync" && client != "async" && client != "multiplex") {
+            throw std::invalid_argument(std::format("unknown client {}", client));
+        }
+    }
+    for (const std::string& handler : options.handlers) {
+        if (handler != "func" && handler != "coro" && handler != "blocking" && handler != "ref") {
+            throw std::invalid_argument(std::format("unknown handler {}", handler));
+        }
+    }
+    return options;
+}
+
+/**
+ * @brief: 在后台线程中运行的进程内server，析构时停止
+*/
+class InProcessServer
+{
+public:
+    InProcessServer(uint32_t thread_num, uint32_t port) : server(thread_num, port)
+    {
+        server.RegisterServerFunctions<&rpc_benchmark::echo,
+            &rpc_benchmark::echo_coro,
+            &rpc_benchmark::echo_blocking,
+            &rpc_benchmark::echo_ref>();
+        runner = std::thread([this] { server.Start(); });
+        wait_until_listening(port);
+    }
+
+    ~InProcessServer()
+    {
+        server.Stop();
+        runner.join();
+    }
+
+private:
+    static void wait_until_listening(uint32_t port)
+    {
+        for (int i = 0; i < 500; ++i) {
+            try
+            {
+                io_context ioc;
+                tcp::socket socket(ioc);
+                socket.connect(tcp::endpoint(ip::make_address("127.0.0.1"), static_cast<unsigned short>(port)));
+                return;
+            }
+            catch (const std::exception&)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+        throw std::runtime_error(std::format("in-process server did not listen on port {}", port));
+    }
+
+    TCPServer server;
+    std::thread runner;
+};
+
+/**
+ * @brief: 预热后开始计时，计时结束后通知调用方停止，返回实际计时的秒数
+*/
+double measure(RunState& state, const Options& options)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(options.warmup_ms));
+    auto begin = clock_type::now();
+    state.recording.store(true, std::memory_order_relaxed);
+    std::this_thread::sleep_for(std::chrono::milliseconds(options.duration_ms));
+    state.recording.store(false, std::memory_order_relaxed);
+    double seconds = std::chrono::duration<double>(clock_type::now() - begin).count();
+    state.stopped.store(true, std::memory_order_relaxed);
+    return seconds;
+}
+
+/**
+ * @brief: 每个调用方一个线程，各自通过独占的SyncTCPConnection循环发起同步调用
+ * @note: 调用方传入左值payload，按值传参的函数拷贝一份发出，按引用传参的函数把server写回的结果赋值回payload
+*/
+template <auto Func>
+double run_sync_clients(const BenchmarkCase& benchmark_case, const Options& options, RunState& state)
+{
+    std::vector<std::jthread> callers;
+    for (uint32_t i = 0; i < benchmark_case.concurrency; ++i) {
+        callers.emplace_back([&] {
+            try
+            {
+                SyncTCPConnection conn(options.host, std::to_string(options.port));
+                std::string payload(benchmark_case.payload, 'x');
+                while (!state.stopped.load(std::memory_order_relaxed)) {
+                    auto start = clock_type::now();
+                    try
+                    {
+                        conn.sync_struct_rpc_request<Func>(payload);
+                        state.record(start);
+                    }
+                    catch (const std::exception&)
+                    {
+                        state.record_error();
+                    }
+                }
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << std::format("sync caller failed to connect: {}\n", e.what());
+            }
+        });
+    }
+    return measure(state, options);
+}
+
+/**
+ * @brief: 每个调用方一个协程，运行在client_threads个线程驱动的io_context上
+*/
+template <auto Func>
+double run_async_clients(const BenchmarkCase& benchmark_case, const Options& options, RunState& state)
+{
+    io_context ioc;
+    std::string port = std::to_string(options.port);
+    std::shared_ptr<TCPConnectionBase> shared_connection;
+    if (benchmark_case.client == "multiplex") {
+        shared_connection = std::make_shared<MultiplexTCPConnection>(options.host, port, ioc);
+    }
+    std::atomic<uint32_t> active_callers = benchmark_case.concurrency;
+    for (uint32_t i = 0; i < benchmark_case.concurrency; ++i) {
+        co_spawn(ioc, [&]() -> awaitable<void> {
+            std::shared_ptr<TCPConnectionBase> conn = shared_connection ? shared_connection : std::make_shared<AsyncTCPConnection>(options.host, port, ioc);
+            std::string payload(benchmark_case.payload, 'x');
+            while (!state.stopped.load(std::memory_order_relaxed)) {
+                auto start = clock_type::now();
+                try
+                {
+                    co_await conn->async_struct_rpc_request<Func>(payload);
+                    state.record(start);
+                }
+                catch (const std::exception&)
+                {
+                    state.record_error();
+                }
+            }
+            active_callers.fetch_sub(1, std::memory_order_release);
+        }, detached);
+    }
+
+    std::vector<std::jthread> threads;
+    for (uint32_t i = 0; i < options.client_threads; ++i) {
+        threads.emplace_back([&ioc] { ioc.run(); });
+    }
+    double seconds = measure(state, options);
+    // 等待各调用方完成手头的请求后再停止io_context，复用连接的读协程不会自行退出
+    while (active_callers.load(std::memory_order_acquire) > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    shared_connection.reset();
+    ioc.stop();
+    threads.clear();
+    return seconds;
+}
+
+template <auto Func>
+double run_clients(const BenchmarkCase& benchmark_case, const Options& options, RunState& state)
+{
+    if (benchmark_case.client == "sync") {
+        return run_sync_clients<Func>(benchmark_case, options, state);
+    }
+    return run_async_clients<Func>(benchmark_case, options, state);
+}
+
+CaseResult run_case(const BenchmarkCase& benchmark_case, const Options& options)
+{
+    RunState state;
+    double seconds = 0;
+    if (benchmark_case.handler == "func") {
+        seconds = run_clients<&rpc_benchmark::echo>(benchmark_case, options, state);
+    } else if (benchmark_case.handler == "coro") {
+        seconds = run_clients<&rpc_benchmark::echo_coro>(benchmark_case, options, state);
+    } else if (benchmark_case.handler == "blocking") {
+        seconds = run_clients<&rpc_benchmark::echo_blocking>(benchmark_case, options, state);
+    } else {
+        seconds = run_clients<&rpc_benchmark::echo_ref>(benchmark_case, options, state);
+    }
+    CaseResult result {benchmark_case, state.errors.load(), seconds};
+    result.latency.merge(state.latency);
+    return result;
+}
+
+double to_us(uint64_t ns)
+{
+    return ns / 1000.0;
+}
+
+void write_csv(std::ostream& out, const std::vector<CaseResult>& results)
+{
+    out << "server_threads,client,handler,payload_bytes,concurrency,requests,errors,qps,mean_us,p50_us,p99_us,p999_us,max_us\n";
+    for (const CaseResult& result : results) {
+        const BenchmarkCase& c = result.benchmark_case;
+        const util::HistogramSnapshot& latency = result.latency;
+        out << std::format("{},{},{},{},{},{},{},{:.1f},{:.1f},{:.1f},{:.1f},{:.1f},{:.1f}\n",
+            c.server_threads, c.client, c.handler, c.payload, c.concurrency, latency.count, result.errors, latency.count / result.seconds,
+            to_us(latency.mean()), to_us(latency.percentile(0.5)), to_us(latency.percentile(0.99)), to_us(latency.percentile(0.999)), to_us(latency.max));
+    }
+}
+
+void write_json(std::ostream& out, const std::vector<CaseResult>& results)
+{
+    out << "[\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchmarkCase& c = results[i].benchmark_case;
+        const util::HistogramSnapshot& latency = results[i].latency;
+        out << std::format("  {{\"server_threads\": {}, \"client\": \"{}\", \"handler\": \"{}\", \"payload_bytes\": {}, \"concurrency\": {}, "
+            "\"requests\": {}, \"errors\": {}, \"qps\": {:.1f}, \"mean_us\": {:.1f}, \"p50_us\": {:.1f}, \"p99_us\": {:.1f}, \"p999_us\": {:.1f}, \"max_us\": {:.1f}}}{}\n",
+            c.server_threads, c.client, c.handler, c.payload, c.concurrency, latency.count, results[i].errors, latency.count / results[i].seconds,
+            to_us(latency.mean()), to_us(latency.percentile(0.5)), to_us(latency.percentile(0.99)), to_us(latency.percentile(0.999)), to_us(latency.max),
+            i + 1 < results.size() ? "," : "");
+    }
+    out << "]\n";
+}
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    try
+    {
+        options = parse_options(argc, argv);
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    std::vector<CaseResult> results;
+    for (uint32_t server_threads : options.server_threads) {
+        std::unique_ptr<InProcessServer> server;
+        if (!options.external_server) {
+            server = std::make_unique<InProcessServer>(server_threads, options.port);
+        }
+        for (const std::string& client : options.clients) {
+            for (const std::string& handler : options.handlers) {
+                for (size_t payload : options.payloads) {
+                    for (uint32_t concurrency : options.concurrency) {
+                        BenchmarkCase benchmark_case {server_threads, client, handler, payload, concurrency};
+                        results.push_back(run_case(benchmark_case, options));
+                        const util::HistogramSnapshot& latency = results.back().latency;
+                        std::cerr << std::format("server_threads={} client={} handler={} payload={} concurrency={}: qps {:.0f}, p99 {:.1f}us\n",
+                            server_threads, client, handler, payload, concurrency, latency.count / results.back().seconds, to_us(latency.percentile(0.99)));
+                    }
+                }
+            }
+        }
+    }
+
+    std::ofstream file;
+    if (!options.output.empty()) {
+        file.open(options.output);
+    }
+    std::ostream& out = options.output.empty() ? std::cout : file;
+    if (options.format == "json") {
+        write_json(out, results);
+    } else {
+        write_csv(out, results);
+    }
+    return 0;
+}
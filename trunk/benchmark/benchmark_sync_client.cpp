@@ -3,6 +3,8 @@
 #include <memory>
 #include <atomic>
 #include <thread>
+#include <vector>
+#include <future>
 #include "../utils/timer.hpp"
 
 /**
@@ -16,15 +18,31 @@ int main(int argc, char* argv[])
     uint32_t thread_num = std::stoi(argv[1]);
     uint32_t seconds = std::stoi(argv[2]);
     const char* port = argv[3];
+    // 可选参数：流水线深度，大于1时每个线程每轮连续发出该数量的请求后再统一读取响应
+    uint32_t pipeline_depth = argc > 4 ? std::stoi(argv[4]) : 1;
     std::vector<std::jthread> client_threads;
 
     for (uint32_t i = 0; i < thread_num; ++i) {
         client_threads.emplace_back([&](std::stop_token stop_token){
-            std::unique_ptr<TCPConnectionBase> sync_connection_ptr = std::make_unique<SyncTCPConnection>("127.0.0.1", port);
+            std::unique_ptr<SyncTCPConnection> sync_connection_ptr = std::make_unique<SyncTCPConnection>("127.0.0.1", port);
             while (!stop_token.stop_requested()) {
+                if (pipeline_depth <= 1) {
+                    TimerRaii timer([&](double milliseconds)
+                                { recorder.add(milliseconds); });
+                    sync_connection_ptr->sync_struct_rpc_request<&rpc_benchmark::echo>("testbenchmarkstring");
+                    continue;
+                }
+                // 流水线模式下每个请求的耗时记为整轮耗时
                 TimerRaii timer([&](double milliseconds)
-                            { recorder.add(milliseconds); });
-                sync_connection_ptr->sync_struct_rpc_request<&rpc_benchmark::echo>("testbenchmarkstring");
+                            { for (uint32_t j = 0; j < pipeline_depth; ++j) { recorder.add(milliseconds); } });
+                std::vector<std::future<std::string>> futures;
+                for (uint32_t j = 0; j < pipeline_depth; ++j) {
+                    futures.push_back(sync_connection_ptr->pipeline_struct_rpc_request<&rpc_benchmark::echo>("testbenchmarkstring"));
+                }
+                sync_connection_ptr->flush_pipeline();
+                for (auto& future : futures) {
+                    future.get();
+                }
             }
         });
     }
@@ -33,6 +51,6 @@ int main(int argc, char* argv[])
     for (auto& thread : client_threads) {
         thread.request_stop();
     }
-    LOG("total requested {}, avg timecost {}", recorder.total_requests.load(), (recorder.total_timecost.load() + 0.0) / recorder.total_requests.load());
+    LOG("{}", recorder.report());
     return 0;
 }
\ No newline at end of file
@@ -1,7 +1,9 @@
 #pragma once
 #include <string>
 #include <atomic>
+#include <format>
 #include "../struct_rpc.hpp"
+#include "../utils/histogram.hpp"
 
 using namespace struct_rpc;
 
@@ -11,15 +13,46 @@ namespace rpc_benchmark
     inline std::string echo(std::string input) {
         return input;
     }
+
+    // 协程版本的回显函数
+    inline awaitable<std::string> echo_coro(std::string input) {
+        co_return input;
+    }
+
+    // 在阻塞线程池中执行的回显函数
+    inline std::string echo_blocking(std::string input) {
+        return input;
+    }
+
+    // 按引用传参的函数，参数调用后原样写回给调用方
+    inline uint32_t echo_ref(std::string& data) {
+        return static_cast<uint32_t>(data.size());
+    }
 }
 
+template <>
+inline constexpr bool struct_rpc::rpc_blocking<rpc_benchmark::echo_blocking> = true;
+
 
+/**
+ * @brief: 记录每次请求的耗时分布，可以被多个线程并发调用
+*/
 struct BenchmarkRecorder
 {
-    std::atomic<uint32_t> total_requests;
-    std::atomic<uint32_t> total_timecost;
-    void add(uint32_t timecost_ms) {
-        total_requests.fetch_add(1, std::memory_order_relaxed);
-        total_timecost.fetch_add(timecost_ms, std::memory_order_relaxed);
+    struct_rpc::util::LatencyHistogram histogram;
+
+    void add(double timecost_ms) {
+        histogram.record(static_cast<uint64_t>(timecost_ms * 1000000));
+    }
+
+    /**
+     * @brief: 请求数、平均耗时及分位数，耗时单位为微秒
+    */
+    std::string report() const {
+        struct_rpc::util::HistogramSnapshot snapshot;
+        snapshot.merge(histogram);
+        return std::format("total requested {}, avg {}us, p50 {}us, p99 {}us, p999 {}us, max {}us",
+            snapshot.count, snapshot.mean() / 1000.0, snapshot.percentile(0.5) / 1000.0,
+            snapshot.percentile(0.99) / 1000.0, snapshot.percentile(0.999) / 1000.0, snapshot.max / 1000.0);
     }
 };
@@ -0,0 +1,427 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <random>
+#include <boost/asio.hpp>
+#include <boost/asio/experimental/awaitable_operators.hpp>
+#include "tcp_connection.hpp"
+
+namespace struct_rpc{
+
+/**
+ * @brief: Channel中的一个server地址
+*/
+struct ChannelEndpoint
+{
+    std::string host;
+    std::string port;
+};
+
+/**
+ * @brief: Channel的配置项
+ * @member unhealthy_cooldown: 连接失败的endpoint在该时长内不参与选择，之后由后台协程尝试重连
+ * @member maintenance_interval: 后台重连的检查周期
+ * @member connect_timeout: 单个endpoint建立连接（包括压缩协商）的超时时间，超时视为连接失败
+*/
+struct ChannelOptions
+{
+    std::chrono::milliseconds unhealthy_cooldown {1000};
+    std::chrono::milliseconds maintenance_interval {500};
+    std::chrono::milliseconds connect_timeout {1000};
+};
+
+/**
+ * @brief: 单个endpoint的负载统计，见Channel::endpoint_stats
+*/
+struct ChannelEndpointStats
+{
+    std::string host;
+    std::string port;
+    bool healthy = false;
+    size_t inflight = 0;
+    int64_t ewma_latency_us = 0;
+};
+
+/**
+ * @class Channel: 面向多个server的客户端负载均衡，对外提供与单条连接相同的async_struct_rpc_request接口，e.g.:
+ *        struct_rpc::Channel channel({{"127.0.0.1", "8080"}, {"127.0.0.1", "8081"}}, io_context);
+ *        co_await channel.async_struct_rpc_request<add>(1, 2);
+ * @note: 每个endpoint使用一条MultiplexTCPConnection。每次请求随机选取两个可用的endpoint（power of two choices），
+ *        取 EWMA延迟 * (在途请求数 + 1) 较小的一个。连接失败的endpoint被标记为不可用，冷却后由后台协程重连；
+ *        请求失败时基类的重试经async_connect换到其他可用的endpoint。各endpoint分别与server协商压缩算法
+*/
+class Channel : public TCPConnectionBase
+{
+public:
+    using Options = ChannelOptions;
+
+private:
+    struct Endpoint
+    {
+        std::shared_ptr<MultiplexTCPConnection> conn;
+        std::atomic<size_t> inflight {0};
+        std::atomic<int64_t> ewma_latency_ns {0};  // 0表示尚无样本
+        std::atomic<int64_t> unhealthy_until {0};  // steady_clock时间，单位ms，之前不参与选择
+        std::atomic<bool> connecting {false};
+
+        bool available(int64_t now) const
+        {
+            return unhealthy_until.load(std::memory_order_relaxed) <= now && conn->is_connected();
+        }
+
+        /**
+         * @brief: 按1/8的权重把本次延迟计入EWMA
+        */
+        void record_latency(int64_t latency_ns)
+        {
+            int64_t old = ewma_latency_ns.load(std::memory_order_relaxed);
+            ewma_latency_ns.store(old == 0 ? latency_ns : old + (latency_ns - old) / 8, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief: 选择时的负载估计，没有延迟样本的endpoint按最低延迟计算，使其尽快得到样本
+        */
+        double load() const
+        {
+            return static_cast<double>(ewma_latency_ns.load(std::memory_order_relaxed) + 1) * static_cast<double>(inflight.load(std::memory_order_relaxed) + 1);
+        }
+    };
+
+    /**
+     * @brief: 占用某个endpoint的流式调用响应包来源，销毁时归还在途请求数
+    */
+    struct EndpointFrameSource : public ResponseFrameSource
+    {
+        explicit EndpointFrameSource(std::shared_ptr<Endpoint> endpoint) : endpoint(std::move(endpoint)) {}
+
+        ~EndpointFrameSource()
+        {
+            source.reset();
+            endpoint->inflight.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        awaitable<std::string> next_frame() override
+        {
+            co_return co_await source->next_frame();
+        }
+
+        std::shared_ptr<Endpoint> endpoint;
+        std::unique_ptr<ResponseFrameSource> source;
+    };
+
+    /**
+     * @brief: Channel状态，由Channel对象和后台维护协程共享
+    */
+    struct State
+    {
+        std::vector<std::shared_ptr<Endpoint>> endpoints;   // 构造后不再增删，只读访问不需要加锁
+        std::atomic<bool> stopped {false};
+    };
+
+public:
+    /**
+     * @param compression: 各endpoint连接的压缩配置，在构造时复制给各连接，协商结果由各endpoint分别保存
+    */
+    Channel(std::vector<ChannelEndpoint> endpoints, boost::asio::io_context& ioc, Options options = Options(), CompressionOptions compression = {})
+        : TCPConnectionBase("channel", ""), io_context(ioc), options(options), state(std::make_shared<State>())
+    {
+        this->compression = std::move(compression);
+        if (endpoints.empty()) {
+            throw std::invalid_argument("channel requires at least one endpoint");
+        }
+        for (const ChannelEndpoint& address : endpoints) {
+            auto endpoint = std::make_shared<Endpoint>();
+            endpoint->conn = std::make_shared<MultiplexTCPConnection>(address.host, address.port, io_context);
+            share_buffer_pools(*endpoint->conn);
+            share_compression(*endpoint->conn);
+            state->endpoints.push_back(std::move(endpoint));
+        }
+        co_spawn(io_context, maintain(state, this->options), detached);
+    }
+
+    ~Channel()
+    {
+        state->stopped = true;
+    }
+
+    /**
+     * @brief: 保证至少有一个可用的endpoint。从随机位置开始依次尝试连接，连接失败的endpoint被标记为不可用，全部失败时抛出最后一个错误
+    */
+    awaitable<void> async_connect() override
+    {
+        auto& endpoints = state->endpoints;
+        int64_t now = now_ms();
+        for (auto& endpoint : endpoints) {
+            if (endpoint->available(now)) {
+                co_return;
+            }
+        }
+        std::exception_ptr error;
+        size_t start = random_index(endpoints.size());
+        for (size_t i = 0; i < endpoints.size(); ++i) {
+            auto& endpoint = endpoints[(start + i) % endpoints.size()];
+            if (endpoint->unhealthy_until.load(std::memory_order_relaxed) > now) {
+                continue;
+            }
+            try
+            {
+                co_await connect_endpoint(endpoint, options);
+                co_return;
+            }
+            catch (std::exception& e)
+            {
+                error = std::current_exception();
+                mark_unhealthy(*endpoint, options);
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        throw std::runtime_error("no available endpoint in channel");
+    }
+
+    awaitable<std::string> make_async_tcp_request(uint64_t request_id, util::SegmentedBuffer tcp_request) override
+    {
+        co_return co_await route_request(request_id, std::move(tcp_request), nullptr, nullptr);
+    }
+
+    awaitable<std::unique_ptr<ResponseFrameSource>> make_async_tcp_stream(uint64_t request_id, util::SegmentedBuffer tcp_request) override
+    {
+        co_return co_await route_stream(request_id, std::move(tcp_request), nullptr, nullptr);
+    }
+
+    /**
+     * @brief: 各endpoint当前的可用状态、在途请求数及EWMA延迟
+    */
+    std::vector<ChannelEndpointStats> endpoint_stats() const
+    {
+        std::vector<ChannelEndpointStats> result;
+        int64_t now = now_ms();
+        for (const auto& endpoint : state->endpoints) {
+            result.push_back(ChannelEndpointStats {endpoint->conn->host, endpoint->conn->port, endpoint->available(now),
+                endpoint->inflight.load(std::memory_order_relaxed), endpoint->ewma_latency_ns.load(std::memory_order_relaxed) / 1000});
+        }
+        return result;
+    }
+
+    /**
+     * @class Route: 经Channel发起调用并记录所选endpoint的连接视图。以另一个Route构造时避开其选中的endpoint，
+     *        使同一调用的两次请求落到不同实例上，见HedgingClient
+     * @note: 只保存选择约束，连接、缓冲池和压缩配置都使用Channel的，需要在Channel之前销毁
+    */
+    class Route : public TCPConnectionBase
+    {
+    public:
+        explicit Route(Channel& channel, const Route* avoid = nullptr)
+            : TCPConnectionBase(channel.host, channel.port), channel(channel), exclude(avoid ? avoid->endpoint.load(std::memory_order_relaxed) : nullptr)
+        {
+            path_encoding = channel.path_encoding;
+            channel.share_buffer_pools(*this);
+            channel.share_compression(*this);
+        }
+
+        /**
+         * @brief: 除了被避开的endpoint之外是否还有可用的endpoint
+        */
+        bool has_available_endpoint() const
+        {
+            int64_t now = now_ms();
+            for (const auto& candidate : channel.state->endpoints) {
+                if (candidate.get() != exclude && candidate->available(now)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        awaitable<void> async_connect() override
+        {
+            co_await channel.async_connect();
+        }
+
+        awaitable<std::string> make_async_tcp_request(uint64_t request_id, util::SegmentedBuffer tcp_request) override
+        {
+            co_return co_await channel.route_request(request_id, std::move(tcp_request), exclude, &endpoint);
+        }
+
+        awaitable<std::unique_ptr<ResponseFrameSource>> make_async_tcp_stream(uint64_t request_id, util::SegmentedBuffer tcp_request) override
+        {
+            co_return co_await channel.route_stream(request_id, std::move(tcp_request), exclude, &endpoint);
+        }
+
+    private:
+        Channel& channel;
+        const Endpoint* exclude = nullptr;
+        std::atomic<const Endpoint*> endpoint {nullptr};    // 最近一次请求选中的endpoint，可能被另一个协程中的Route读取
+    };
+
+private:
+    /**
+     * @brief: 选择endpoint并发出请求
+     * @param exclude: 不参与选择的endpoint，可以为空
+     * @param used: 非空时写入选中的endpoint
+    */
+    awaitable<std::string> route_request(uint64_t request_id, util::SegmentedBuffer tcp_request, const Endpoint* exclude, std::atomic<const Endpoint*>* used)
+    {
+        std::shared_ptr<Endpoint> endpoint = pick(exclude);
+        if (!endpoint) {
+            throw std::runtime_error("no available endpoint in channel");
+        }
+        struct InflightGuard
+        {
+            Endpoint& endpoint;
+            ~InflightGuard() { endpoint.inflight.fetch_sub(1, std::memory_order_relaxed); }
+        } inflight_guard {*endpoint};
+        if (used) {
+            used->store(endpoint.get(), std::memory_order_relaxed);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        try
+        {
+            std::string response_str = co_await endpoint->conn->make_async_tcp_request(request_id, std::move(tcp_request));
+            endpoint->record_latency(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+            co_return response_str;
+        }
+        catch (std::exception& e)
+        {
+            // 连接已断开时在冷却期内不再选择该endpoint，本次失败由调用方经async_connect换到其他endpoint重试
+            if (!endpoint->conn->is_connected()) {
+                mark_unhealthy(*endpoint, options);
+            }
+            throw;
+        }
+    }
+
+    awaitable<std::unique_ptr<ResponseFrameSource>> route_stream(uint64_t request_id, util::SegmentedBuffer tcp_request, const Endpoint* exclude, std::atomic<const Endpoint*>* used)
+    {
+        std::shared_ptr<Endpoint> endpoint = pick(exclude);
+        if (!endpoint) {
+            throw std::runtime_error("no available endpoint in channel");
+        }
+        if (used) {
+            used->store(endpoint.get(), std::memory_order_relaxed);
+        }
+        auto source = std::make_unique<EndpointFrameSource>(endpoint);
+        try
+        {
+            source->source = co_await endpoint->conn->make_async_tcp_stream(request_id, std::move(tcp_request));
+        }
+        catch (std::exception& e)
+        {
+            if (!endpoint->conn->is_connected()) {
+                mark_unhealthy(*endpoint, options);
+            }
+            throw;
+        }
+        co_return source;
+    }
+
+    static int64_t now_ms()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    static size_t random_index(size_t size)
+    {
+        thread_local std::minstd_rand generator(std::random_device {}());
+        return std::uniform_int_distribution<size_t>(0, size - 1)(generator);
+    }
+
+    static void mark_unhealthy(Endpoint& endpoint, const Options& options)
+    {
+        endpoint.unhealthy_until.store(now_ms() + options.unhealthy_cooldown.count(), std::memory_order_relaxed);
+        LOG_WARN("channel endpoint {}:{} is unhealthy", endpoint.conn->host, endpoint.conn->port);
+    }
+
+    /**
+     * @brief: power of two choices：在exclude以外的可用endpoint中随机取两个，选择负载较小的一个并占用它
+     * @return: 没有可用的endpoint时返回nullptr
+    */
+    std::shared_ptr<Endpoint> pick(const Endpoint* exclude = nullptr)
+    {
+        int64_t now = now_ms();
+        std::vector<std::shared_ptr<Endpoint>> candidates;
+        for (auto& endpoint : state->endpoints) {
+            if (endpoint.get() != exclude && endpoint->available(now)) {
+                candidates.push_back(endpoint);
+            }
+        }
+        if (candidates.empty()) {
+            return nullptr;
+        }
+        size_t first = random_index(candidates.size());
+        size_t chosen = first;
+        if (candidates.size() > 1) {
+            size_t second = (first + 1 + random_index(candidates.size() - 1)) % candidates.size();
+            chosen = candidates[second]->load() < candidates[first]->load() ? second : first;
+        }
+        candidates[chosen]->inflight.fetch_add(1, std::memory_order_relaxed);
+        return candidates[chosen];
+    }
+
+    /**
+     * @brief: 连接单个endpoint，超过connect_timeout时取消连接并抛出异常，避免无响应的地址长时间阻塞调用方
+    */
+    static awaitable<void> connect_endpoint(std::shared_ptr<Endpoint> endpoint, Options options)
+    {
+        using namespace boost::asio::experimental::awaitable_operators;
+        steady_timer timer(co_await this_coro::executor);
+        timer.expires_after(options.connect_timeout);
+        auto result = co_await (endpoint->conn->async_connect() || timer.async_wait(use_awaitable));
+        if (result.index() == 1) {
+            throw std::runtime_error("connect timeout");
+        }
+    }
+
+    /**
+     * @brief: 在后台重连单个endpoint，同一endpoint同时只会有一个重连协程
+    */
+    static awaitable<void> reconnect(std::shared_ptr<Endpoint> endpoint, Options options)
+    {
+        if (endpoint->connecting.exchange(true)) {
+            co_return;
+        }
+        try
+        {
+            co_await connect_endpoint(endpoint, options);
+            endpoint->unhealthy_until.store(0, std::memory_order_relaxed);
+        }
+        catch (std::exception& e)
+        {
+            LOG_WARN("channel failed to connect {}:{} with {}", endpoint->conn->host, endpoint->conn->port, e.what());
+            mark_unhealthy(*endpoint, options);
+        }
+        endpoint->connecting = false;
+    }
+
+    /**
+     * @brief: 后台维护协程，周期性地重连冷却期已过且未连接的endpoint，Channel析构后退出
+     * @note: 各endpoint的重连在独立的协程中进行，无响应的地址不会拖慢其他endpoint的恢复
+    */
+    static awaitable<void> maintain(std::shared_ptr<State> state, Options options)
+    {
+        auto executor = co_await this_coro::executor;
+        steady_timer timer(executor);
+        while (!state->stopped)
+        {
+            int64_t now = now_ms();
+            for (auto& endpoint : state->endpoints) {
+                if (endpoint->unhealthy_until.load(std::memory_order_relaxed) <= now && !endpoint->connecting && !endpoint->conn->is_connected()) {
+                    co_spawn(executor, reconnect(endpoint, options), detached);
+                }
+            }
+            timer.expires_after(options.maintenance_interval);
+            co_await timer.async_wait(use_awaitable);
+        }
+    }
+
+    boost::asio::io_context& io_context;
+    Options options;
+    std::shared_ptr<State> state;
+};
+}
@@ -0,0 +1,303 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <any>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <variant>
+#include <unordered_map>
+#include <boost/asio.hpp>
+#include <boost/asio/experimental/concurrent_channel.hpp>
+#include <boost/asio/experimental/awaitable_operators.hpp>
+#include "tcp_connection.hpp"
+
+namespace struct_rpc{
+
+/**
+ * @brief: CoalescingClient的配置项
+ * @member cache_ttl: 幂等函数结果的缓存有效期，为0时不缓存，只合并同时在途的相同调用
+ * @member max_cache_entries: 缓存项数上限，达到上限时先清除过期项，仍然已满则不再缓存新的结果
+*/
+struct CoalescingClientOptions
+{
+    std::chrono::milliseconds cache_ttl {0};
+    size_t max_cache_entries = 10000;
+};
+
+/**
+ * @brief: CoalescingClient的统计
+ * @member requests: 经过合并/缓存处理的幂等调用数
+ * @member coalesced: 等待其他协程的相同调用而没有发出请求的调用数
+ * @member cache_hits: 直接使用缓存结果的调用数
+*/
+struct CoalescingClientStats
+{
+    uint64_t requests = 0;
+    uint64_t coalesced = 0;
+    uint64_t cache_hits = 0;
+};
+
+/**
+ * @class CoalescingClient: 合并相同调用的客户端包装。多个协程同时以相同参数调用同一个幂等函数时只发出一个请求，
+ *        结果分发给全部等待者；可选地在有效期内缓存结果，e.g.:
+ *        struct_rpc::CoalescingClient client(conn, {.cache_ttl = std::chrono::milliseconds(100)});
+ *        auto user = co_await client.async_struct_rpc_request<lookup_user>(uid);
+ * @note: 只有rpc_idempotent或rpc_cacheable的函数会被合并和缓存，其他函数直接转发给底层连接。调用是否相同按函数路径哈希和编码后的参数判断。
+ *        发出请求的协程失败或被取消时，等待同一结果的协程收到相同的异常。不支持引用参数。
+ *        截止时间：请求按发出请求的协程的截止时间发送。只有在途调用的截止时间不早于自己的截止时间时才会合并，
+ *        否则单独发出请求，因此不会因为其他调用方更紧的截止时间而失败；等待者到达自己的截止时间时放弃等待并抛出DeadlineExceededError
+*/
+class CoalescingClient
+{
+public:
+    using Options = CoalescingClientOptions;
+
+    explicit CoalescingClient(TCPConnectionBase& conn, Options options = Options()) : conn(conn), options(options) {}
+
+    /**
+     * @brief: 进行一次异步RPC调用，接口与TCPConnectionBase::async_struct_rpc_request相同
+    */
+    template <auto Func, typename... Args>
+    auto async_struct_rpc_request(Args&&... args)
+        -> awaitable<typename trait_helper::rpc_return_type_getter<decltype(Func)>::type>
+    {
+        return async_struct_rpc_request<Func>(Deadline {}, std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief: 进行一次附带截止时间的异步RPC调用，合并时截止时间的处理见类的说明
+    */
+    template <auto Func, typename... Args>
+    auto async_struct_rpc_request(Deadline deadline, Args&&... args)
+        -> awaitable<typename trait_helper::rpc_return_type_getter<decltype(Func)>::type>
+    {
+        using ReturnType = typename trait_helper::rpc_return_type_getter<decltype(Func)>::type;
+        if constexpr (!is_rpc_idempotent<Func>) {
+            co_return co_await conn.template async_struct_rpc_request<Func>(deadline, std::forward<Args>(args)...);
+        } else {
+            static_assert(!trait_helper::is_func_containes_reference_param<decltype(Func)>(), "coalesced call does not support reference params");
+            using value_type = std::conditional_t<std::is_void_v<ReturnType>, std::monostate, ReturnType>;
+            using param_tuple_type = typename trait_helper::function_traits<decltype(Func)>::decayed_arguments_tuple;
+            param_tuple_type param_tuple(std::forward<Args>(args)...);
+            std::string key = make_key<Func>(param_tuple);
+            requests.fetch_add(1, std::memory_order_relaxed);
+
+            // step 1. 查找缓存及在途的相同调用，都没有时由当前协程发出请求；在途调用的截止时间更早时不合并，单独发出请求
+            std::shared_ptr<Flight<value_type>> flight;
+            std::shared_ptr<WaitChannel> wait_channel;
+            std::optional<value_type> cached;
+            bool standalone = false;
+            auto executor = co_await this_coro::executor;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (auto iter = cache.find(key); iter != cache.end()) {
+                    if (iter->second.expire_time > std::chrono::steady_clock::now()) {
+                        cached = std::any_cast<const value_type&>(iter->second.value);
+                    } else {
+                        cache.erase(iter);
+                    }
+                }
+                if (!cached) {
+                    if (auto iter = flights.find(key); iter == flights.end()) {
+                        flight = std::make_shared<Flight<value_type>>();
+                        flight->deadline = deadline;
+                        flights.emplace(key, flight);
+                    } else if (iter->second->deadline.time_point >= deadline.time_point) {
+                        flight = std::static_pointer_cast<Flight<value_type>>(iter->second);
+                        wait_channel = std::make_shared<WaitChannel>(executor, 1);
+                        flight->waiters.push_back(wait_channel);
+                    } else {
+                        standalone = true;
+                    }
+                }
+            }
+            if (cached) {
+                cache_hits.fetch_add(1, std::memory_order_relaxed);
+                co_return return_value<ReturnType>(std::move(*cached));
+            }
+            if (standalone) {
+                co_return co_await std::apply([this, deadline](auto&... params) { return conn.template async_struct_rpc_request<Func>(deadline, params...); }, param_tuple);
+            }
+
+            // step 2. 其他协程已经发出了相同的请求，等待其结果，最多等到自己的截止时间
+            if (wait_channel) {
+                coalesced.fetch_add(1, std::memory_order_relaxed);
+                if (deadline.is_set()) {
+                    using namespace boost::asio::experimental::awaitable_operators;
+                    steady_timer timer(executor);
+                    timer.expires_at(deadline.time_point);
+                    auto result = co_await (wait_channel->async_receive(use_awaitable) || timer.async_wait(use_awaitable));
+                    if (result.index() == 1) {
+                        throw DeadlineExceededError("deadline exceeded");
+                    }
+                } else {
+                    co_await wait_channel->async_receive(use_awaitable);
+                }
+                if (flight->error) {
+                    std::rethrow_exception(flight->error);
+                }
+                co_return return_value<ReturnType>(value_type(*flight->value));
+            }
+
+            // step 3. 发出请求，完成后把结果交给全部等待者。请求失败时等待者收到同样的异常，当前协程被销毁时由guard唤醒等待者
+            FlightGuard<value_type> guard {*this, key, flight};
+            try
+            {
+                auto request = std::apply([this, deadline](auto&... params) { return conn.template async_struct_rpc_request<Func>(deadline, params...); }, param_tuple);
+                if constexpr (std::is_void_v<ReturnType>) {
+                    co_await std::move(request);
+                    guard.complete(std::monostate {});
+                } else {
+                    guard.complete(co_await std::move(request));
+                }
+            }
+            catch (...)
+            {
+                guard.fail(std::current_exception());
+                throw;
+            }
+            co_return return_value<ReturnType>(value_type(*flight->value));
+        }
+    }
+
+    /**
+     * @brief: 清空缓存的结果，不影响在途的调用
+    */
+    void clear_cache()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        cache.clear();
+    }
+
+    CoalescingClientStats stats() const
+    {
+        return CoalescingClientStats {requests.load(std::memory_order_relaxed), coalesced.load(std::memory_order_relaxed), cache_hits.load(std::memory_order_relaxed)};
+    }
+
+private:
+    using WaitChannel = asio::experimental::concurrent_channel<void(boost::system::error_code)>;
+
+    struct FlightBase
+    {
+        virtual ~FlightBase() = default;
+        std::vector<std::shared_ptr<WaitChannel>> waiters;
+        std::exception_ptr error;
+        Deadline deadline;      // 发出请求的协程的截止时间
+    };
+
+    /**
+     * @brief: 一次在途的调用，value或error在唤醒等待者之前写入
+    */
+    template <typename T>
+    struct Flight : public FlightBase
+    {
+        std::optional<T> value;
+    };
+
+    struct CacheEntry
+    {
+        std::any value;
+        std::chrono::steady_clock::time_point expire_time;
+    };
+
+    /**
+     * @brief: 结束一次在途调用：从在途表中移除、按需写入缓存，并唤醒全部等待者
+    */
+    template <typename T>
+    struct FlightGuard
+    {
+        CoalescingClient& client;
+        const std::string& key;
+        std::shared_ptr<Flight<T>> flight;
+        bool done = false;
+
+        void complete(T value)
+        {
+            flight->value = std::move(value);
+            finish(true);
+        }
+
+        void fail(std::exception_ptr error)
+        {
+            if (done) {
+                return;
+            }
+            flight->error = std::move(error);
+            finish(false);
+        }
+
+        ~FlightGuard()
+        {
+            if (!done) {
+                fail(std::make_exception_ptr(std::runtime_error("coalesced call was cancelled")));
+            }
+        }
+
+        void finish(bool succ)
+        {
+            done = true;
+            std::vector<std::shared_ptr<WaitChannel>> waiters;
+            {
+                std::lock_guard<std::mutex> lock(client.mtx);
+                client.flights.erase(key);
+                waiters.swap(flight->waiters);
+                if (succ && client.options.cache_ttl.count() > 0) {
+                    client.insert_cache(key, *flight->value);
+                }
+            }
+            for (auto& waiter : waiters) {
+                waiter->try_send(boost::system::error_code{});
+            }
+        }
+    };
+
+    /**
+     * @brief: 调用的键：函数路径哈希 + 按EncodeParams编码后的参数，与server看到的请求参数一致
+    */
+    template <auto Func, typename ParamTuple>
+    static std::string make_key(const ParamTuple& param_tuple)
+    {
+        uint64_t path_hash = trait_helper::struct_rpc_func_hash<Func>();
+        util::SegmentedBuffer encoded;
+        encoded.append(std::string_view(reinterpret_cast<const char*>(&path_hash), sizeof(path_hash)));
+        common_define::EncodeParams(param_tuple, encoded);
+        return encoded.to_string();
+    }
+
+    template <typename ReturnType, typename T>
+    static ReturnType return_value(T&& value)
+    {
+        if constexpr (!std::is_void_v<ReturnType>) {
+            return std::forward<T>(value);
+        }
+    }
+
+    /**
+     * @note: 调用方需持有mtx
+    */
+    template <typename T>
+    void insert_cache(const std::string& key, const T& value)
+    {
+        auto now = std::chrono::steady_clock::now();
+        if (cache.size() >= options.max_cache_entries) {
+            std::erase_if(cache, [now](const auto& item) { return item.second.expire_time <= now; });
+            if (cache.size() >= options.max_cache_entries) {
+                return;
+            }
+        }
+        cache[key] = CacheEntry {value, now + options.cache_ttl};
+    }
+
+    TCPConnectionBase& conn;
+    Options options;
+    std::mutex mtx;
+    std::unordered_map<std::string, std::shared_ptr<FlightBase>> flights;
+    std::unordered_map<std::string, CacheEntry> cache;
+    std::atomic<uint64_t> requests = 0;
+    std::atomic<uint64_t> coalesced = 0;
+    std::atomic<uint64_t> cache_hits = 0;
+};
+}
@@ -2,14 +2,84 @@
 #include "StructBuffer/struct_buffer.hpp"
 #include "utils/trait_helper/trait_helper.hpp"
 #include "utils/util.hpp"
+#include "utils/io_buffer.hpp"
+#include "utils/shm_stream.hpp"
+#include "utils/compression.hpp"
+#include "rpc_traits.hpp"
 #include <tuple>
 #include <string_view>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <optional>
+#include <chrono>
+#include <span>
 #include <boost/asio.hpp>
 
 namespace struct_rpc
 {
     using namespace boost::asio;
     namespace asio = boost::asio;
+
+    /**
+     * @brief: 连接使用的socket。TCP和Unix domain socket连接统一使用generic::stream_protocol，共用同一套读写代码
+    */
+    using stream_socket = asio::generic::stream_protocol::socket;
+
+    /**
+     * @brief: 从字节流中读取恰好buffer.size()字节。socket和共享内存流（util::ShmStream）提供相同的调用形式，server和客户端的读写代码据此复用
+    */
+    inline auto async_read_exact(stream_socket& stream, asio::mutable_buffer buffer)
+    {
+        return asio::async_read(stream, buffer, use_awaitable);
+    }
+
+    /**
+     * @brief: 读取至少1字节、至多buffer.size()字节，返回读取的字节数。被取消时不消耗任何数据，可以在超时后从断点继续读取
+    */
+    inline auto async_read_some(stream_socket& stream, asio::mutable_buffer buffer)
+    {
+        return stream.async_read_some(buffer, use_awaitable);
+    }
+
+    /**
+     * @brief: 把全部缓冲区写入字节流
+    */
+    inline auto async_write_all(stream_socket& stream, std::span<const asio::const_buffer> buffers)
+    {
+        return asio::async_write(stream, buffers, use_awaitable);
+    }
+
+    /**
+     * @brief: 关闭字节流，忽略错误
+    */
+    inline void close_stream(stream_socket& stream)
+    {
+        boost::system::error_code ec;
+        stream.close(ec);
+    }
+
+#ifdef __linux__
+    inline auto async_read_exact(util::ShmStream& stream, asio::mutable_buffer buffer)
+    {
+        return stream.async_read(buffer);
+    }
+
+    inline auto async_read_some(util::ShmStream& stream, asio::mutable_buffer buffer)
+    {
+        return stream.async_read_some(buffer);
+    }
+
+    inline auto async_write_all(util::ShmStream& stream, std::span<const asio::const_buffer> buffers)
+    {
+        return stream.async_write(buffers);
+    }
+
+    inline void close_stream(util::ShmStream& stream)
+    {
+        stream.close();
+    }
+#endif
     namespace common_define
     {
         /**
@@ -30,104 +100,708 @@ namespace struct_rpc
             RET_SUCC = 0,
             RET_NOT_FOUND = 1,
             RET_SERVER_EXCEPTION = 2,
+            RET_SERVER_OVERLOADED = 3,  // server过载，请求未被执行而直接拒绝，可以稍后重试
+            RET_DEADLINE_EXCEEDED = 4,  // 请求已超过调用方设置的截止时间，server跳过或中止了处理
+        };
+
+        /**
+         * @brief: 请求中RPC函数路径的编码方式
+         * @enum HASH: 只发送路径的编译期64位哈希，path字段为空
+         * @enum FULL_PATH: 同时发送完整路径字符串，用于调试或兼容
+        */
+        enum class PathEncoding
+        {
+            HASH = 0,
+            FULL_PATH = 1,
+        };
+
+        /**
+         * @brief: 请求头/响应头中flags字段的标记位
+         * @enum FLAG_BATCH: 批量请求/响应，消息体为依次排列的多个完整子请求/子响应包
+         * @enum FLAG_BATCH_PARALLEL: 批量请求中的子请求可以并发执行，否则按顺序依次执行
+         * @enum FLAG_STREAM: 流式调用的响应包，同一request_id可以有多个
+         * @enum FLAG_STREAM_END: 流式调用的最后一个响应包，与FLAG_STREAM同时出现，携带整个调用的返回码，不含数据
+         * @enum FLAG_COMPRESSED: 包头之后为CompressedHeader及压缩后的消息体，见CompressFrame
+         * @enum FLAG_NEGOTIATE: 连接建立后协商压缩算法的请求/响应，不调用RPC函数，见MakeNegotiateRequest
+        */
+        enum FrameFlag : uint32_t
+        {
+            FLAG_NONE = 0,
+            FLAG_BATCH = 1u << 0,
+            FLAG_BATCH_PARALLEL = 1u << 1,
+            FLAG_STREAM = 1u << 2,
+            FLAG_STREAM_END = 1u << 3,
+            FLAG_COMPRESSED = 1u << 4,
+            FLAG_NEGOTIATE = 1u << 5,
+        };
+
+        /**
+         * @brief: TCP请求头，以固定布局直接写入请求包开头，其后依次为path_size字节的路径和请求参数
+         * @member total_size: 除本字段外整个请求包的长度，server先读取该字段再读取剩余部分
+         * @member request_id: 请求ID，由客户端分配，server原样写回响应，用于在同一条连接上复用多个并发请求
+         * @member path_hash: RPC函数路径的编译期哈希，server据此查找处理函数
+         * @member path_size: 路径字符串长度，只发送路径哈希时为0
+         * @member flags: 请求标记位，见FrameFlag
+         * @member timeout_us: 发出请求时距调用方截止时间的剩余微秒数，0表示不限时。传递相对时长而非绝对时间，不受两端时钟偏差影响
+        */
+        struct RequestHeader
+        {
+            size_t total_size = 0;
+            uint64_t request_id = 0;
+            uint64_t path_hash = 0;
+            uint32_t path_size = 0;
+            uint32_t flags = 0;
+            uint64_t timeout_us = 0;
         };
+        static_assert(std::is_trivially_copyable_v<RequestHeader> && sizeof(RequestHeader) == 40);
 
         /**
-         * @brief: TCP请求封装类
-         * @member path: 请求的RPC函数路径，为通过function_name_getter自动提取的函数名
-         * @member data: 请求参数列表按顺序组织成一个std::tuple后序列化成的字符串
+         * @brief: TCP请求的视图，path和params直接指向接收缓冲区，不拷贝请求数据
+         * @member path: 请求的RPC函数路径，为通过function_name_getter自动提取的函数名。非空时server优先按该字段查找
+         * @member params: 按EncodeParams编码的请求参数；批量请求时为依次排列的子请求包
+         * @member flags: 请求标记位
+         * @member timeout_us: 调用方剩余的超时时间（微秒），0表示不限时
         */
-        struct TCPRequest
+        struct TCPRequestView
         {
-            std::string path;
-            std::string params;
+            uint64_t request_id = 0;
+            uint64_t path_hash = 0;
+            std::string_view path;
+            std::string_view params;
+            uint32_t flags = 0;
+            uint64_t timeout_us = 0;
         };
 
         /**
-         * @brief: TCP响应封装类
+         * @brief: 只校验并读取完整请求包的固定请求头，不检查path_size
+         * @note: 压缩的请求包中path和参数一起被压缩，path_size是解压后的长度，需要解压后再用ParseRequestView完整解析
+        */
+        inline RequestHeader ParseRequestHeader(std::string_view request_str)
+        {
+            RequestHeader header;
+            if (request_str.size() < sizeof(RequestHeader)) {
+                throw std::runtime_error("request is shorter than its header");
+            }
+            std::memcpy(&header, request_str.data(), sizeof(RequestHeader));
+            if (header.total_size + sizeof(size_t) != request_str.size()) {
+                throw std::runtime_error("request size mismatch");
+            }
+            return header;
+        }
+
+        /**
+         * @brief: 从完整的请求包（包含开头的total_size）中解析出请求视图，返回的视图依赖request_str的生命周期
+        */
+        inline TCPRequestView ParseRequestView(std::string_view request_str)
+        {
+            RequestHeader header;
+            if (request_str.size() < sizeof(RequestHeader)) {
+                throw std::runtime_error("request is shorter than its header");
+            }
+            std::memcpy(&header, request_str.data(), sizeof(RequestHeader));
+            if (header.total_size + sizeof(size_t) != request_str.size() || header.path_size > request_str.size() - sizeof(RequestHeader)) {
+                throw std::runtime_error("request size mismatch");
+            }
+            std::string_view body = request_str.substr(sizeof(RequestHeader));
+            return TCPRequestView {header.request_id, header.path_hash, body.substr(0, header.path_size), body.substr(header.path_size), header.flags, header.timeout_us};
+        }
+
+        /**
+         * @brief: 把依次排列的多个完整请求/响应包（各自以total_size开头）切分为单个包的视图
+        */
+        inline std::vector<std::string_view> SplitFrames(std::string_view body)
+        {
+            std::vector<std::string_view> frames;
+            while (!body.empty()) {
+                size_t total_size;
+                if (body.size() < sizeof(size_t)) {
+                    throw std::runtime_error("truncated batch frame");
+                }
+                std::memcpy(&total_size, body.data(), sizeof(size_t));
+                if (body.size() - sizeof(size_t) < total_size) {
+                    throw std::runtime_error("truncated batch frame");
+                }
+                frames.push_back(body.substr(0, total_size + sizeof(size_t)));
+                body.remove_prefix(total_size + sizeof(size_t));
+            }
+            return frames;
+        }
+
+        /**
+         * @brief: 编码单个RPC参数，格式为[size_t 长度][数据]。视图类型参数的数据为原始字节，其他类型为StructBuffer序列化结果
+        */
+        template <typename T>
+        inline void EncodeParam(const T& param, util::SegmentedBuffer& out)
+        {
+            if constexpr (trait_helper::is_view_param_v<T>) {
+                size_t size = param.size();
+                out.append(std::string_view(reinterpret_cast<const char*>(&size), sizeof(size_t)));
+                out.append(std::string_view(reinterpret_cast<const char*>(param.data()), size));
+            } else {
+                // 序列化结果整段移入输出缓冲区，写出时作为独立分段发送，不再拷贝
+                std::string data = structbuf::serializer::SaveToString(param);
+                size_t size = data.size();
+                out.append(std::string_view(reinterpret_cast<const char*>(&size), sizeof(size_t)));
+                out.append_owned(std::move(data));
+            }
+        }
+
+        /**
+         * @brief: 从输入中解码单个RPC参数并消耗对应的字节。视图类型参数直接指向输入数据
+        */
+        template <typename T>
+        inline void DecodeParam(T& param, std::string_view& input)
+        {
+            size_t size;
+            if (input.size() < sizeof(size_t)) {
+                throw std::runtime_error("truncated rpc params");
+            }
+            std::memcpy(&size, input.data(), sizeof(size_t));
+            input.remove_prefix(sizeof(size_t));
+            if (input.size() < size) {
+                throw std::runtime_error("truncated rpc params");
+            }
+            std::string_view data = input.substr(0, size);
+            input.remove_prefix(size);
+
+            if constexpr (std::is_same_v<T, std::string_view>) {
+                param = data;
+            } else if constexpr (trait_helper::is_view_param_v<T>) {
+                param = T(reinterpret_cast<typename T::pointer>(data.data()), size);
+            } else {
+                structbuf::deserializer::ParseFromSV(param, data);
+            }
+        }
+
+        /**
+         * @brief: 把参数tuple编码追加到out之后，各参数依次按EncodeParam编码
+        */
+        template <typename... Args>
+        inline void EncodeParams(const std::tuple<Args...>& params, util::SegmentedBuffer& out)
+        {
+            std::apply([&out](const auto&... param) { (EncodeParam(param, out), ...); }, params);
+        }
+
+        /**
+         * @brief: 单次遍历把编码后的参数直接解析到参数tuple中
+        */
+        template <typename... Args>
+        inline void DecodeParams(std::tuple<Args...>& params, std::string_view input)
+        {
+            std::apply([&input](auto&... param) { (DecodeParam(param, input), ...); }, params);
+        }
+
+        /**
+         * @brief: TCP响应头，以固定布局直接写入响应包开头，其后为处理函数写入的响应体
+         * @member total_size: 除本字段外整个响应包的长度
+         * @member request_id: 对应请求的request_id
          * @member retcode: 返回码
-         * @member data: RPC返回结果序列化成的字符串
+         * @member flags: 响应标记位，见FrameFlag
+         * @note: 响应体依次为按EncodeParam编码的返回值（void返回类型时省略）以及按EncodeParams编码的调用后参数（仅函数包含引用参数时存在）
         */
-        struct TCPResponse
+        struct ResponseHeader
         {
+            size_t total_size = 0;
+            uint64_t request_id = 0;
             int32_t retcode = 0;
-            struct RespnseData
-            {
-                std::string params;
-                std::string ret;
-            };
-            std::string data;   // serialized RespnseData
+            uint32_t flags = 0;
+        };
+        static_assert(std::is_trivially_copyable_v<ResponseHeader> && sizeof(ResponseHeader) == 24);
+
+        /**
+         * @brief: TCP响应的视图，data指向响应包中的响应体
+        */
+        struct TCPResponseView
+        {
+            uint64_t request_id = 0;
+            int32_t retcode = 0;
+            std::string_view data;
+            uint32_t flags = 0;
         };
 
+        /**
+         * @brief: 根据响应头的flags判断是否为该请求的最后一个响应包。普通调用只有一个响应包，流式调用以带FLAG_STREAM_END的响应包结束
+        */
+        inline bool IsFinalResponse(uint32_t flags)
+        {
+            return !(flags & FLAG_STREAM) || (flags & FLAG_STREAM_END);
+        }
+
+        /**
+         * @brief: 从完整的响应包（包含开头的total_size）中解析出响应视图，返回的视图依赖response_str的生命周期
+        */
+        inline TCPResponseView ParseResponseView(std::string_view response_str)
+        {
+            ResponseHeader header;
+            if (response_str.size() < sizeof(ResponseHeader)) {
+                throw std::runtime_error("response is shorter than its header");
+            }
+            std::memcpy(&header, response_str.data(), sizeof(ResponseHeader));
+            if (header.total_size + sizeof(size_t) != response_str.size()) {
+                throw std::runtime_error("response size mismatch");
+            }
+            return TCPResponseView {header.request_id, header.retcode, response_str.substr(sizeof(ResponseHeader)), header.flags};
+        }
+
+        /**
+         * @brief: 在输出缓冲区开头预留响应头/请求头的空间，写完后由FinishResponse等函数回填
+        */
+        template <typename Header>
+        inline void ReserveHeader(util::SegmentedBuffer& output)
+        {
+            Header header;
+            output.append(std::string_view(reinterpret_cast<const char*>(&header), sizeof(Header)));
+        }
+
+        /**
+         * @brief: 在预留了响应头空间、已写入响应体的缓冲区开头填写响应头
+        */
+        inline void FinishResponse(util::SegmentedBuffer& response, uint64_t request_id, int32_t retcode, uint32_t flags = FLAG_NONE)
+        {
+            ResponseHeader header;
+            header.total_size = response.size() - sizeof(size_t);
+            header.request_id = request_id;
+            header.retcode = retcode;
+            header.flags = flags;
+            response.overwrite(0, &header, sizeof(ResponseHeader));
+        }
+
+        /**
+         * @brief: 在预留了请求头空间、已写入路径和参数的缓冲区开头填写请求头
+        */
+        inline void FinishRequest(util::SegmentedBuffer& request, uint64_t request_id, uint64_t path_hash, uint32_t path_size, uint32_t flags = FLAG_NONE, uint64_t timeout_us = 0)
+        {
+            RequestHeader header;
+            header.total_size = request.size() - sizeof(size_t);
+            header.request_id = request_id;
+            header.path_hash = path_hash;
+            header.path_size = path_size;
+            header.flags = flags;
+            header.timeout_us = timeout_us;
+            request.overwrite(0, &header, sizeof(RequestHeader));
+        }
+
+        /**
+         * @brief: 压缩包的头部，紧跟在请求头/响应头之后，其后为压缩后的消息体
+         * @member raw_size: 消息体（请求头/响应头之后的全部数据）压缩前的长度
+         * @member codec_id: 压缩算法编号，接收方据此在CodecRegistry中查找，不依赖协商结果
+        */
+        struct CompressedHeader
+        {
+            uint64_t raw_size = 0;
+            uint32_t codec_id = 0;
+            uint32_t reserved = 0;
+        };
+        static_assert(std::is_trivially_copyable_v<CompressedHeader> && sizeof(CompressedHeader) == 16);
+
+        // 消息体超过compress_probe_min_size时先压缩开头compress_probe_size字节的样本，判断是否值得压缩整个消息体
+        inline constexpr size_t compress_probe_size = 4096;
+        inline constexpr size_t compress_probe_min_size = 64 * 1024;
+
+        /**
+         * @brief: 压缩完整的请求包/响应包，包头保持不压缩以便接收方按request_id分发
+         * @param Header: RequestHeader或ResponseHeader
+         * @return: 是否压缩。包长度小于min_size、已经压缩过，或压缩后节省不到1/8（例如消息体本身是已压缩的数据）时原样保留
+         * @note: 批量请求只压缩外层包，子请求/子响应不单独压缩。消息体位于单个分段中时直接压缩，否则只把消息体拷贝到线程内复用的缓冲区；
+         *        较大的消息体先用样本探测，样本节省不到1/8时不拷贝也不压缩整个消息体
+        */
+        template <typename Header>
+        inline bool CompressFrame(util::SegmentedBuffer& frame, const util::Codec& codec, size_t min_size)
+        {
+            if (frame.size() < std::max(min_size, sizeof(Header))) {
+                return false;
+            }
+            Header header;
+            frame.read(0, &header, sizeof(Header));
+            if (header.flags & FLAG_COMPRESSED) {
+                return false;
+            }
+            auto worth_compressing = [](size_t compressed_size, size_t raw_size) {
+                return compressed_size + sizeof(CompressedHeader) <= raw_size - raw_size / 8;
+            };
+            thread_local std::string scratch;
+            size_t body_size = frame.size() - sizeof(Header);
+            std::string compressed;
+
+            // step 1. 样本探测，已压缩的图片、视频等数据在这里直接放弃
+            if (body_size >= compress_probe_min_size) {
+                scratch.resize(compress_probe_size);
+                frame.read(sizeof(Header), scratch.data(), compress_probe_size);
+                codec.compress(scratch, compressed);
+                if (!worth_compressing(compressed.size(), compress_probe_size)) {
+                    return false;
+                }
+            }
+
+            // step 2. 压缩整个消息体
+            std::optional<std::string_view> body = frame.contiguous_view(sizeof(Header));
+            if (!body) {
+                scratch.resize(body_size);
+                frame.read(sizeof(Header), scratch.data(), body_size);
+                body = scratch;
+            }
+            codec.compress(*body, compressed);
+            if (scratch.capacity() > (1 << 20)) {
+                std::string().swap(scratch);    // 偶发的大包不长期占用线程内缓冲区
+            }
+            if (!worth_compressing(compressed.size(), body_size)) {
+                return false;
+            }
+
+            CompressedHeader compressed_header {body_size, codec.id(), 0};
+            header.flags |= FLAG_COMPRESSED;
+            header.total_size = sizeof(Header) - sizeof(size_t) + sizeof(CompressedHeader) + compressed.size();
+            frame.clear();
+            frame.append(std::string_view(reinterpret_cast<const char*>(&header), sizeof(Header)));
+            frame.append(std::string_view(reinterpret_cast<const char*>(&compressed_header), sizeof(CompressedHeader)));
+            frame.append_owned(std::move(compressed));
+            return true;
+        }
+
+        /**
+         * @brief: 解压带FLAG_COMPRESSED的完整请求包/响应包，原地替换为未压缩的包，其余包不做处理
+         * @param max_raw_size: 解压后消息体的长度上限，防止很小的包解压出超大的数据
+         * @return: 是否发生了解压
+        */
+        template <typename Header>
+        inline bool DecompressFrame(std::string& frame, size_t max_raw_size)
+        {
+            Header header;
+            if (frame.size() < sizeof(Header)) {
+                throw std::runtime_error("frame is shorter than its header");
+            }
+            std::memcpy(&header, frame.data(), sizeof(Header));
+            if (!(header.flags & FLAG_COMPRESSED)) {
+                return false;
+            }
+            CompressedHeader compressed_header;
+            if (frame.size() < sizeof(Header) + sizeof(CompressedHeader)) {
+                throw std::runtime_error("truncated compressed frame");
+            }
+            std::memcpy(&compressed_header, frame.data() + sizeof(Header), sizeof(CompressedHeader));
+            if (compressed_header.raw_size > max_raw_size) {
+                throw std::runtime_error("decompressed frame exceeds size limit");
+            }
+            const util::Codec* codec = util::CodecRegistry::getInstance().find(compressed_header.codec_id);
+            if (codec == nullptr) {
+                throw std::runtime_error("unknown compression codec " + std::to_string(compressed_header.codec_id));
+            }
+
+            std::string raw(sizeof(Header) + compressed_header.raw_size, '\0');
+            codec->decompress(std::string_view(frame).substr(sizeof(Header) + sizeof(CompressedHeader)), raw.data() + sizeof(Header), compressed_header.raw_size);
+            header.flags &= ~FLAG_COMPRESSED;
+            header.total_size = raw.size() - sizeof(size_t);
+            std::memcpy(raw.data(), &header, sizeof(Header));
+            frame.swap(raw);
+            return true;
+        }
+
+        /**
+         * @brief: 构造协商压缩算法的请求包，消息体为按优先顺序排列的uint32_t codec编号
+         * @note: 不支持协商的旧版本server按未注册的函数返回RET_NOT_FOUND，客户端视为不压缩
+        */
+        inline void MakeNegotiateRequest(util::SegmentedBuffer& request, const std::vector<uint32_t>& codec_ids)
+        {
+            ReserveHeader<RequestHeader>(request);
+            request.append(std::string_view(reinterpret_cast<const char*>(codec_ids.data()), codec_ids.size() * sizeof(uint32_t)));
+            FinishRequest(request, 0, 0, 0, FLAG_NEGOTIATE);
+        }
+
+        /**
+         * @brief: 从协商响应中取出server选定的codec编号，server不支持压缩或不支持协商时返回CODEC_NONE
+        */
+        inline uint32_t ParseNegotiateResponse(std::string_view response_str)
+        {
+            TCPResponseView response = ParseResponseView(response_str);
+            uint32_t codec_id = util::CODEC_NONE;
+            if (response.retcode == static_cast<int32_t>(RetCode::RET_SUCC) && (response.flags & FLAG_NEGOTIATE) && response.data.size() == sizeof(uint32_t)) {
+                std::memcpy(&codec_id, response.data.data(), sizeof(uint32_t));
+            }
+            return codec_id;
+        }
+
+        /**
+         * @brief: 清空缓冲区并写入只有响应头的错误响应
+        */
+        inline void MakeErrorResponse(util::SegmentedBuffer& response, uint64_t request_id, RetCode retcode)
+        {
+            response.clear();
+            ReserveHeader<ResponseHeader>(response);
+            FinishResponse(response, request_id, static_cast<int32_t>(retcode));
+        }
+
     
         /**
-         * @brief: 将所有协程类型的RPC处理函数类型擦除成function<awaitable<string>(string)>的形式
+         * @brief: 将所有协程类型的RPC处理函数类型擦除成awaitable<void>(string_view, SegmentedBuffer&)的形式
          * @param Func: 非类型模板参数，传入处理函数指针，针对每个函数会生成一份模板函数实例
-         * @param input: 远程调用的请求参数列表按顺序组织成一个std::tuple后序列化成的字符串
-         * @return: RPC调用结果序列化的字符串
+         * @param input: 远程调用的请求参数列表按EncodeParams编码后的数据，指向接收缓冲区
+         * @param output: 分段响应缓冲区，返回值和引用参数依次直接追加到其末尾，调用方需保证其在协程结束前有效
         */
         template <auto Func>
-        inline auto CommonCoroutineTemplate(std::string_view input) -> boost::asio::awaitable<std::string>
+        inline auto CommonCoroutineTemplate(std::string_view input, util::SegmentedBuffer& output) -> boost::asio::awaitable<void>
         {
-            typename trait_helper::function_traits<decltype(Func)>::arguments_tuple input_struct;
-            structbuf::deserializer::ParseFromSV(input_struct, input);
-            using ReturnType = typename trait_helper::function_traits<decltype(Func)>::return_type;
-            TCPResponse::RespnseData rsp_data;
+            typename trait_helper::function_traits<decltype(Func)>::decayed_arguments_tuple input_struct;
+            DecodeParams(input_struct, input);
+            using ReturnType = typename trait_helper::function_traits<decltype(Func)>::return_type::value_type;
 
             if constexpr (trait_helper::is_member_function<decltype(Func)>) {
                 using class_type = typename trait_helper::function_traits<decltype(Func)>::class_type;
-                static_assert(!std::is_base_of_v<util::ThreadLocalSingleton<class_type>, class_type>, "you cannot use coroutine with ThreadLocalSingleton");
                 if constexpr (std::is_same_v<ReturnType, void>) {
                     co_await std::apply(std::bind_front(Func, &class_type::getInstance()), input_struct);
                 } else {
-                    rsp_data.ret = structbuf::serializer::SaveToString(co_await std::apply(std::bind_front(Func, &class_type::getInstance()), input_struct));
+                    EncodeParam(co_await std::apply(std::bind_front(Func, &class_type::getInstance()), input_struct), output);
                 }
             } else {
                 if constexpr (std::is_same_v<ReturnType, void>) {
                     co_await std::apply(Func, input_struct);
                 } else {
-                    rsp_data.ret = structbuf::serializer::SaveToString(co_await std::apply(Func, input_struct));
+                    EncodeParam(co_await std::apply(Func, input_struct), output);
                 }
             }
-            rsp_data.params = structbuf::serializer::SaveToString(input_struct);
-            co_return structbuf::serializer::SaveToString(rsp_data);
+            // 只有包含引用参数的函数才需要把调用后的参数写回给调用方
+            if constexpr (trait_helper::is_func_containes_reference_param<decltype(Func)>()) {
+                EncodeParams(input_struct, output);
+            }
         }
 
         /**
-         * @brief: 将所有普通RPC处理函数类型擦除成function<string(string)>的形式
+         * @brief: 将所有普通RPC处理函数类型擦除成void(string_view, SegmentedBuffer&)的形式
          * @param Func: 非类型模板参数，传入处理函数指针，针对每个函数会生成一份模板函数实例
-         * @param input: 远程调用的请求参数列表按顺序组织成一个std::tuple后序列化成的字符串
-         * @return: RPC调用结果序列化的字符串
+         * @param input: 远程调用的请求参数列表按EncodeParams编码后的数据，指向接收缓冲区
+         * @param output: 分段响应缓冲区，返回值和引用参数依次直接追加到其末尾
         */
         template <auto Func>
-        inline auto CommonFuncTemplate(std::string_view input) -> std::string
+        inline void CommonFuncTemplate(std::string_view input, util::SegmentedBuffer& output)
         {
-            // step 1. 提取函数的输入参数类型对应的tuple，并按照对应类型解析输入参数
+            // step 1. 提取函数的输入参数类型对应的tuple，并按照对应类型直接从接收缓冲区解析输入参数，视图类型参数不发生拷贝
             typename trait_helper::function_traits<decltype(Func)>::decayed_arguments_tuple input_struct;
-            structbuf::deserializer::ParseFromSV(input_struct, input);
+            DecodeParams(input_struct, input);
             using ReturnType = typename trait_helper::function_traits<decltype(Func)>::return_type;
 
-            TCPResponse::RespnseData rsp_data;
-            // step 2. 使用std::apply将上面得到的tuple展开并传递给处理函数，返回序列化后的返回结果
+            // step 2. 使用std::apply将上面得到的tuple展开并传递给处理函数，返回结果直接编码到响应缓冲区
             if constexpr (trait_helper::is_member_function<decltype(Func)>) {
                 // note: 如果是成员函数，需要首先将对应的类对象绑定到第一个参数
                 using class_type = typename trait_helper::function_traits<decltype(Func)>::class_type;
                 if constexpr (std::is_same_v<ReturnType, void>) {
                     std::apply(std::bind_front(Func, &class_type::getInstance()), input_struct);
                 } else {
-                    rsp_data.ret = structbuf::serializer::SaveToString(std::apply(std::bind_front(Func, &class_type::getInstance()), input_struct));
+                    EncodeParam(std::apply(std::bind_front(Func, &class_type::getInstance()), input_struct), output);
                 }
                 
             } else {
                 if constexpr (std::is_same_v<ReturnType, void>) {
                     std::apply(Func, input_struct);
                 } else {
-                    rsp_data.ret = structbuf::serializer::SaveToString(std::apply(Func, input_struct));
+                    EncodeParam(std::apply(Func, input_struct), output);
                 }
             }
 
-            rsp_data.params = structbuf::serializer::SaveToString(input_struct);
-            return structbuf::serializer::SaveToString(rsp_data);
+            // step 3. 只有包含引用参数的函数才需要把调用后的参数写回给调用方
+            if constexpr (trait_helper::is_func_containes_reference_param<decltype(Func)>()) {
+                EncodeParams(input_struct, output);
+            }
+        }
+
+    }
+
+    /**
+     * @brief: RPC调用的截止时间，默认不限时。客户端据此放弃等待，并把剩余时长写入请求头；server据此跳过或中止已过期的请求，e.g.:
+     *        conn.sync_struct_rpc_request<add>(Deadline::after(100ms), 1, 2);
+    */
+    struct Deadline
+    {
+        using clock = std::chrono::steady_clock;
+        clock::time_point time_point = clock::time_point::max();
+
+        static Deadline after(clock::duration timeout)
+        {
+            return Deadline {clock::now() + timeout};
+        }
+
+        /**
+         * @brief: 由请求头中的剩余微秒数还原截止时间，0表示不限时
+        */
+        static Deadline from_timeout_us(uint64_t timeout_us)
+        {
+            return timeout_us == 0 ? Deadline {} : after(std::chrono::microseconds(timeout_us));
+        }
+
+        bool is_set() const { return time_point != clock::time_point::max(); }
+
+        bool expired() const { return is_set() && clock::now() >= time_point; }
+
+        /**
+         * @brief: 距截止时间的剩余微秒数，用于写入请求头。不限时返回0，已过期时返回1，保证server仍能识别出设置了截止时间
+        */
+        uint64_t remaining_us() const
+        {
+            if (!is_set()) {
+                return 0;
+            }
+            auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(time_point - clock::now()).count();
+            return remaining > 0 ? static_cast<uint64_t>(remaining) : 1;
+        }
+    };
+
+    /**
+     * @brief: 连接的压缩配置。客户端在连接建立时把codecs发给server，server选出双方都支持的第一个，之后两端各自压缩不小于min_size的包
+     * @member codecs: 按优先顺序排列的codec编号，为空时不压缩，e.g. {util::CODEC_LZ}
+     * @member min_size: 小于该长度的请求包/响应包不压缩
+     * @member max_decompressed_size: 客户端解压响应时的长度上限，server端使用Limits::max_frame_size
+    */
+    struct CompressionOptions
+    {
+        std::vector<uint32_t> codecs;
+        size_t min_size = 4096;
+        size_t max_decompressed_size = 64 << 20;
+    };
+
+    /**
+     * @brief: 调用在截止时间前未完成时抛出的异常，包括客户端等待超时和server返回RET_DEADLINE_EXCEEDED两种情况
+    */
+    class DeadlineExceededError : public std::runtime_error
+    {
+    public:
+        using std::runtime_error::runtime_error;
+    };
+
+    /**
+     * @brief: 流式调用的输出端，由server为每个流式请求实现，负责给数据包填写响应头并投递到连接的写队列
+    */
+    class StreamSink
+    {
+    public:
+        virtual ~StreamSink() = default;
+        /**
+         * @brief: 取出一个空的输出缓冲区
+        */
+        virtual util::SegmentedBuffer acquire_frame() = 0;
+        /**
+         * @brief: 填写响应头后写出一个预留了响应头空间的数据包。写队列已满时挂起等待，连接已断开时抛出异常
+        */
+        virtual boost::asio::awaitable<void> send_frame(util::SegmentedBuffer frame) = 0;
+    };
+
+    /**
+     * @brief: 流式RPC函数的最后一个参数，函数通过它逐个写出T类型的结果，每个结果作为独立的响应包发送
+     * @note: write在连接写队列已满时挂起，因此server端同时缓存的结果数量有上限；客户端断开后write抛出异常，函数随之结束
+    */
+    template <typename T>
+    class StreamWriter
+    {
+        static_assert(!trait_helper::is_view_param_v<T>, "stream item of view type is not supported");
+
+    public:
+        using item_type = T;
+
+        StreamWriter() = default;
+        explicit StreamWriter(StreamSink& sink) : sink(&sink) {}
+
+        boost::asio::awaitable<void> write(const T& item)
+        {
+            util::SegmentedBuffer frame = sink->acquire_frame();
+            common_define::ReserveHeader<common_define::ResponseHeader>(frame);
+            common_define::EncodeParam(item, frame);
+            co_await sink->send_frame(std::move(frame));
+        }
+
+    private:
+        StreamSink* sink = nullptr;
+    };
+
+    namespace common_define
+    {
+        /**
+         * @brief: 将所有流式RPC函数类型擦除成awaitable<void>(string_view, StreamSink&)的形式
+         * @param input: 除StreamWriter外的请求参数按EncodeParams编码后的数据，指向接收缓冲区
+         * @param sink: 流式结果的输出端
+        */
+        template <auto Func>
+        inline auto CommonStreamTemplate(std::string_view input, StreamSink& sink) -> boost::asio::awaitable<void>
+        {
+            typename trait_helper::stream_function_traits<decltype(Func)>::stream_params_tuple input_struct;
+            DecodeParams(input_struct, input);
+            using item_type = typename trait_helper::stream_function_traits<decltype(Func)>::item_type;
+            auto params = std::tuple_cat(std::move(input_struct), std::tuple<StreamWriter<item_type>>(StreamWriter<item_type>(sink)));
+            if constexpr (trait_helper::is_member_function<decltype(Func)>) {
+                using class_type = typename trait_helper::function_traits<decltype(Func)>::class_type;
+                co_await std::apply(std::bind_front(Func, &class_type::getInstance()), params);
+            } else {
+                co_await std::apply(Func, params);
+            }
+        }
+
+        /**
+         * @brief: 处理函数的类型标记，协程、普通函数和流式函数的调用方式不同
+        */
+        enum class HandlerType : uint8_t
+        {
+            FUNCTION = 0,
+            COROUTINE = 1,
+            STREAM = 2,
+        };
+
+        /**
+         * @brief: 服务端处理函数表的表项，在编译期由RPC函数指针生成，使用普通函数指针而非std::function避免额外的间接调用
+         * @member path_hash: struct_rpc_func_path的编译期哈希，处理函数表按该字段排序
+         * @member path: RPC函数路径，用于校验哈希命中以及打印日志
+         * @member type: 标记下面三个函数指针中哪一个有效
+         * @member blocking: 为true时普通函数在独立的阻塞线程池中执行，见rpc_blocking
+         * @member cacheable: 为true时server缓存该函数的响应，见rpc_cacheable
+         * @member thread_local_coroutine: 为true时是ThreadLocalSingleton的协程成员函数，见IsThreadLocalCoroutine
+        */
+        struct HandlerEntry
+        {
+            uint64_t path_hash = 0;
+            std::string_view path;
+            HandlerType type = HandlerType::FUNCTION;
+            bool blocking = false;
+            bool cacheable = false;
+            bool thread_local_coroutine = false;
+            void (*func)(std::string_view, util::SegmentedBuffer&) = nullptr;
+            boost::asio::awaitable<void> (*coroutine)(std::string_view, util::SegmentedBuffer&) = nullptr;
+            boost::asio::awaitable<void> (*stream)(std::string_view, StreamSink&) = nullptr;
+        };
+
+        /**
+         * @brief: Func是否为ThreadLocalSingleton类的协程成员函数。协程在暂停点前后可能被不同线程执行，
+         *        只有运行在固定于单个线程的io_context上时才能安全使用线程局部的单例对象
+        */
+        template <auto Func>
+        constexpr bool IsThreadLocalCoroutine()
+        {
+            if constexpr (trait_helper::is_asio_coroutine<decltype(Func)> && trait_helper::is_member_function<decltype(Func)>) {
+                using class_type = typename trait_helper::function_traits<decltype(Func)>::class_type;
+                return std::is_base_of_v<util::ThreadLocalSingleton<class_type>, class_type>;
+            } else {
+                return false;
+            }
+        }
+
+        /**
+         * @brief: 编译期为RPC函数生成处理函数表项
+        */
+        template <auto Func>
+        constexpr HandlerEntry MakeHandlerEntry()
+        {
+            HandlerEntry entry;
+            entry.path_hash = trait_helper::struct_rpc_func_hash<Func>();
+            entry.path = trait_helper::struct_rpc_func_path<Func>();
+            entry.cacheable = rpc_cacheable<Func>;
+            entry.thread_local_coroutine = IsThreadLocalCoroutine<Func>();
+            if constexpr (trait_helper::is_stream_function<decltype(Func)>) {
+                static_assert(!rpc_cacheable<Func>, "stream rpc can not be cacheable");
+                entry.type = HandlerType::STREAM;
+                entry.stream = &CommonStreamTemplate<Func>;
+            } else if constexpr (trait_helper::is_asio_coroutine<decltype(Func)>) {
+                entry.type = HandlerType::COROUTINE;
+                entry.coroutine = &CommonCoroutineTemplate<Func>;
+            } else {
+                entry.type = HandlerType::FUNCTION;
+                entry.blocking = rpc_blocking<Func>;
+                entry.func = &CommonFuncTemplate<Func>;
+            }
+            return entry;
         }
     }
 }
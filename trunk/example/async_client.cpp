@@ -27,11 +27,34 @@ awaitable<void> rpc_coro_2(std::unique_ptr<TCPConnectionBase> async_connection_p
     cout << coro_ret << endl;
 }
 
+awaitable<void> rpc_coro_3(std::unique_ptr<TCPConnectionBase> async_connection_ptr)
+{
+    // 批量调用：三次调用编码进同一个请求包，一次往返得到按添加顺序排列的全部结果
+    auto [sum, str, len] = co_await async_connection_ptr->batch()
+        .add<add>(1, 2)
+        .add<echo>("batch")
+        .add<count_char>("hello world", 'l')
+        .async_request();
+    cout << format("{} {} {}\n", sum, str, len);
+}
+
+awaitable<void> rpc_coro_4(std::unique_ptr<TCPConnectionBase> async_connection_ptr)
+{
+    // 流式调用：server每写出一个结果，客户端即可通过next()取得，不必等待全部结果序列化完成
+    auto stream = co_await async_connection_ptr->async_struct_rpc_stream<count_up>(10, 3);
+    while (auto item = co_await stream.next()) {
+        cout << *item << " ";   // 10 11 12
+    }
+    cout << endl;
+}
+
 int main()
 {
     io_context ioc;
     co_spawn(ioc, rpc_coro_1(std::move(std::make_unique<AsyncTCPConnection>("127.0.0.1", "8080", ioc))), detached); // 启动一个异步请求协程
     co_spawn(ioc, rpc_coro_2(std::move(std::make_unique<AsyncTCPConnection>("127.0.0.1", "8080", ioc))), detached); // 启动一个异步请求协程
+    co_spawn(ioc, rpc_coro_3(std::move(std::make_unique<AsyncTCPConnection>("127.0.0.1", "8080", ioc))), detached); // 启动一个批量请求协程
+    co_spawn(ioc, rpc_coro_4(std::move(std::make_unique<AsyncTCPConnection>("127.0.0.1", "8080", ioc))), detached); // 启动一个流式请求协程
     
     ioc.run();
 }
\ No newline at end of file
@@ -14,14 +14,25 @@ int main()
         generic_add_various_params<int, int, double>, // 注册可变参数模板函数
         generic_add_various_params<int, int>,
         wait3s_and_echo,  // 注册coroutine
+        count_up,  // 注册流式返回结果的coroutine
         ExampleRPCNamespace::add,   // 命名空间下的函数
         free_add_combined , // 注册自定义类型作为参数和返回值的函数
+        count_char, // 注册接收视图类型参数的函数
+        fibonacci, // 注册标记为rpc_blocking的函数，在阻塞线程池中执行
         &ExampleRPCClass::add,  // 注册类的成员函数，注意取成员函数指针时必须显式加&
         &ExampleRPCClass::static_add,  // 注册静态成员函数
         // addo // 函数名拼写错误，可以在编译期检查并报错
-        add_ref // 注册按引用传参并返回void的函数
+        add_ref, // 注册按引用传参并返回void的函数
+        struct_rpc::rpc_stats // 注册内置的统计函数，返回各函数的请求数和耗时分位数
         >();
     
+    // 阻塞线程池的线程数及排队上限，排队已满时新请求返回RET_SERVER_OVERLOADED
+    server.SetBlockingExecutor(/* thread_num */ 2, /* max_queue */ 128);
+    // 流量控制：超出在途请求数限制的请求返回RET_SERVER_OVERLOADED，超过max_frame_size的请求包直接断开连接
+    TCPServer::Limits limits;
+    limits.max_inflight_per_connection = 256;
+    limits.max_frame_size = 16 << 20;
+    server.SetLimits(limits);
     // 启动server循环，会阻塞当前线程，并在内部开启多线程异步处理请求。
     server.Start();
     return 0;
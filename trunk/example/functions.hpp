@@ -1,5 +1,6 @@
 #pragma once
 #include <string>
+#include <algorithm>
 #include "../struct_rpc.hpp"
 
 using namespace struct_rpc;
@@ -54,6 +55,15 @@ awaitable<int> wait3s_and_echo(int i) {
     co_return i;
 }
 
+/**
+ * 支持流式返回结果的协程：最后一个参数为StreamWriter<T>，每次write的结果作为独立的响应包立即发送给调用方
+*/
+awaitable<void> count_up(int from, int count, StreamWriter<int> writer) {
+    for (int i = 0; i < count; ++i) {
+        co_await writer.write(from + i);
+    }
+}
+
 /**
  * 函数参数和返回值支持自定义结构体
 */
@@ -65,6 +75,21 @@ inline CombinedStruct free_add_combined(CombinedStruct a, CombinedStruct b) {
     return CombinedStruct{a.str_member + b.str_member, a.int_member + b.int_member};
 }
 
+/**
+ * 支持std::string_view和单字节元素的std::span<const T>参数，server端参数直接指向接收缓冲区，不发生拷贝
+*/
+inline uint32_t count_char(std::string_view input, char c) {
+    return static_cast<uint32_t>(std::count(input.begin(), input.end(), c));
+}
+
+/**
+ * 计算密集型函数可以标记为rpc_blocking，server会在独立的阻塞线程池中执行，不影响同一线程上其他连接的请求
+*/
+inline uint64_t fibonacci(uint32_t n) {
+    return n < 2 ? n : fibonacci(n - 1) + fibonacci(n - 2);
+}
+template <> inline constexpr bool struct_rpc::rpc_blocking<fibonacci> = true;
+
 /** 支持函数重载，但是注册和调用时需要使用特殊语法，本处不做展示
 * int32_t echo(int32_t input) {
 *     return input;
@@ -83,7 +108,7 @@ namespace ExampleRPCNamespace {
 /**
  * 支持注册类的成员函数，但是目前要求对应的类必须是单例类，即派生自以下基类之一：
  * * util::Singleton<T> 全局单例，所有server线程共享同一个实例，需要注意线程同步问题
- * * util::ThreadLocalSingleton<T> 线程局部单例，每个server线程维护一个实例
+ * * util::ThreadLocalSingleton<T> 线程局部单例，每个server线程维护一个实例（协程仅在IO_CONTEXT_PER_THREAD线程模型下可用）
  * * 或者需要实现一个静态方法getInstance用于获取对象实例。
 */
 class ExampleRPCClass : public util::Singleton<ExampleRPCClass>
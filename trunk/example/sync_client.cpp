@@ -1,6 +1,8 @@
 #include "functions.hpp"
 #include <format>
 #include <memory>
+#include <vector>
+#include <future>
 using std::cout;
 using std::endl;
 using std::format;
@@ -19,10 +21,42 @@ int main()
         CombinedStruct{"hello ", 1}, 
         CombinedStruct{"world", 2}).str_member << endl;   // 调用接收复杂类型参数的函数，返回{"hello world", 3}
     cout << conn->sync_struct_rpc_request<&ExampleRPCClass::add>(10, 10) << endl;    // 调用类的成员函数，返回20
+    cout << conn->sync_struct_rpc_request<count_char>("hello world", 'o') << endl;    // 调用接收std::string_view参数的函数，返回2
+    cout << conn->sync_struct_rpc_request<fibonacci>(30) << endl;    // 调用在阻塞线程池中执行的函数，返回832040
+    auto [sum, echoed] = conn->batch(/* parallel */ true).add<add>(1, 2).add<echo>("batch").sync_request();
+    cout << sum << " " << echoed << endl;   // 批量调用，一次往返返回3 batch
+
+    // 附带截止时间的调用：截止时间随请求发给server，超时后server取消协程，客户端抛出DeadlineExceededError
+    try
+    {
+        conn->sync_struct_rpc_request<wait3s_and_echo>(Deadline::after(std::chrono::milliseconds(500)), 1);
+    }
+    catch (const DeadlineExceededError& e)
+    {
+        cout << e.what() << endl;
+    }
+
+    // 流水线调用：请求先进入发送队列，flush_pipeline时连续写出并一次读取全部响应，不必每次调用都等待一个往返
+    auto sync_conn = std::make_unique<SyncTCPConnection>("127.0.0.1", "8080");
+    std::vector<std::future<int32_t>> futures;
+    for (int32_t i = 0; i < 4; ++i) {
+        futures.push_back(sync_conn->pipeline_struct_rpc_request<add>(i, i));
+    }
+    sync_conn->flush_pipeline();
+    for (auto& future : futures) {
+        cout << future.get() << " ";    // 0 2 4 6
+    }
+    cout << endl;
     
     int c = 0;
     conn->sync_struct_rpc_request<add_ref>(1, 2, c);
     cout << c << endl;  // 调用按引用传参的函数，返回3
 
+    // 读取server各函数的统计数据，耗时单位为纳秒
+    for (const MethodStats& stats : conn->sync_struct_rpc_request<struct_rpc::rpc_stats>()) {
+        cout << format("{} requests={} p50={}ns p99={}ns p999={}ns", stats.path, stats.requests,
+            stats.handler_time.p50_ns, stats.handler_time.p99_ns, stats.handler_time.p999_ns) << endl;
+    }
+
     return 0;
 }
\ No newline at end of file
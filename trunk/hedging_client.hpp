@@ -0,0 +1,269 @@
+#pragma once
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <variant>
+#include <optional>
+#include <algorithm>
+#include <unordered_map>
+#include <boost/asio.hpp>
+#include <boost/asio/experimental/awaitable_operators.hpp>
+#include "tcp_connection.hpp"
+#include "channel.hpp"
+#include "utils/histogram.hpp"
+
+namespace struct_rpc{
+
+/**
+ * @brief: HedgingClient的配置项
+ * @member quantile: 主请求耗时超过该分位数仍未返回时发送备份请求
+ * @member window: 每个函数每积累window个耗时样本重新计算一次等待时长，样本不足一个窗口前不发送备份请求
+ * @member min_delay: 等待时长的下限，避免耗时很短的函数频繁发送备份请求
+ * @member max_extra_ratio: 备份请求数占请求总数的比例上限，每个请求为预算增加max_extra_ratio，每个备份请求消耗1
+ * @member max_burst: 预算最多累积的备份请求数，限制一段空闲后的突发
+*/
+struct HedgingClientOptions
+{
+    double quantile = 0.95;
+    size_t window = 1000;
+    std::chrono::microseconds min_delay {1000};
+    double max_extra_ratio = 0.05;
+    double max_burst = 10;
+};
+
+/**
+ * @brief: HedgingClient的统计
+ * @member requests: 可以发送备份请求的幂等调用数
+ * @member hedged: 实际发送了备份请求的调用数
+ * @member hedge_wins: 备份请求先于主请求返回的调用数
+ * @member budget_exhausted: 到达等待时长但预算不足、没有发送备份请求的调用数
+*/
+struct HedgingClientStats
+{
+    uint64_t requests = 0;
+    uint64_t hedged = 0;
+    uint64_t hedge_wins = 0;
+    uint64_t budget_exhausted = 0;
+};
+
+/**
+ * @class HedgingClient: 降低尾延迟的Channel包装。幂等函数的请求超过该函数最近耗时的p95仍未返回时，再向另一个实例发送相同的请求，
+ *        先返回的结果生效，另一个请求被取消，e.g.:
+ *        struct_rpc::Channel channel({{"127.0.0.1", "8080"}, {"127.0.0.1", "8081"}}, io_context);
+ *        struct_rpc::HedgingClient client(channel);
+ *        auto user = co_await client.async_struct_rpc_request<lookup_user>(uid);
+ * @note: 只有is_rpc_idempotent的函数会发送备份请求，其他函数直接转发给Channel。备份请求通过Channel::Route避开主请求所用的endpoint，
+ *        没有其他可用endpoint时不发送。主请求的结果（包括失败）总是生效；备份请求只在成功时胜出，失败时继续等待主请求。不支持引用参数
+*/
+class HedgingClient
+{
+public:
+    using Options = HedgingClientOptions;
+
+    explicit HedgingClient(Channel& channel, Options options = Options()) : channel(channel), options(options) {}
+
+    /**
+     * @brief: 进行一次异步RPC调用，接口与TCPConnectionBase::async_struct_rpc_request相同
+    */
+    template <auto Func, typename... Args>
+    auto async_struct_rpc_request(Args&&... args)
+        -> awaitable<typename trait_helper::rpc_return_type_getter<decltype(Func)>::type>
+    {
+        return async_struct_rpc_request<Func>(Deadline {}, std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief: 进行一次附带截止时间的异步RPC调用，截止时间同时作用于主请求和备份请求
+    */
+    template <auto Func, typename... Args>
+    auto async_struct_rpc_request(Deadline deadline, Args&&... args)
+        -> awaitable<typename trait_helper::rpc_return_type_getter<decltype(Func)>::type>
+    {
+        using ReturnType = typename trait_helper::rpc_return_type_getter<decltype(Func)>::type;
+        if constexpr (!is_rpc_idempotent<Func>) {
+            co_return co_await channel.template async_struct_rpc_request<Func>(deadline, std::forward<Args>(args)...);
+        } else {
+            static_assert(!trait_helper::is_func_containes_reference_param<decltype(Func)>(), "hedged call does not support reference params");
+            using param_tuple_type = typename trait_helper::function_traits<decltype(Func)>::decayed_arguments_tuple;
+            param_tuple_type param_tuple(std::forward<Args>(args)...);
+            requests.fetch_add(1, std::memory_order_relaxed);
+            deposit_budget();
+
+            // step 1. 样本不足时只发送主请求，否则与延迟发出的备份请求竞争
+            LatencyWindow& window = latency_window(trait_helper::struct_rpc_func_hash<Func>());
+            int64_t delay_ns = window.delay_ns.load(std::memory_order_relaxed);
+            auto start = std::chrono::steady_clock::now();
+            Outcome<ReturnType> outcome = delay_ns == 0
+                ? co_await call<Func>(channel, deadline, param_tuple)
+                : co_await race<Func>(std::chrono::nanoseconds(delay_ns), deadline, param_tuple);
+            if (outcome.index() == 1) {
+                std::rethrow_exception(std::get<1>(outcome));
+            }
+
+            // step 2. 记录本次耗时。备份请求胜出时主请求的耗时只知道不小于该值，按该值计入，备份请求不超过5%，对分位数影响很小
+            record_latency(window, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+            if constexpr (!std::is_void_v<ReturnType>) {
+                co_return std::move(std::get<0>(outcome));
+            }
+        }
+    }
+
+    HedgingClientStats stats() const
+    {
+        return HedgingClientStats {requests.load(std::memory_order_relaxed), hedged.load(std::memory_order_relaxed),
+            hedge_wins.load(std::memory_order_relaxed), budget_exhausted.load(std::memory_order_relaxed)};
+    }
+
+private:
+    /**
+     * @brief: 一次请求的结果或异常，void返回类型对应std::monostate
+    */
+    template <typename ReturnType>
+    using Outcome = std::variant<std::conditional_t<std::is_void_v<ReturnType>, std::monostate, ReturnType>, std::exception_ptr>;
+
+    /**
+     * @brief: 单个函数的耗时统计，histogram每满window个样本计算一次分位数并换成新的直方图，使等待时长跟随最近的耗时变化
+    */
+    struct LatencyWindow
+    {
+        std::mutex mtx;
+        std::unique_ptr<util::LatencyHistogram> histogram = std::make_unique<util::LatencyHistogram>();
+        size_t samples = 0;
+        std::atomic<int64_t> delay_ns {0};  // 0表示样本不足，不发送备份请求
+    };
+
+    // 预算以1/budget_scale个备份请求为单位保存为整数，便于原子地增减
+    static constexpr int64_t budget_scale = 1000;
+
+    /**
+     * @brief: 向conn发送一次请求，异常（包括被取消）作为结果返回，使operator||在主请求失败时同样立即结束
+    */
+    template <auto Func, typename ParamTuple>
+    static auto call(TCPConnectionBase& conn, Deadline deadline, const ParamTuple& param_tuple)
+        -> awaitable<Outcome<typename trait_helper::rpc_return_type_getter<decltype(Func)>::type>>
+    {
+        using ReturnType = typename trait_helper::rpc_return_type_getter<decltype(Func)>::type;
+        try
+        {
+            auto request = std::apply([&conn, deadline](const auto&... params) { return conn.template async_struct_rpc_request<Func>(deadline, params...); }, param_tuple);
+            if constexpr (std::is_void_v<ReturnType>) {
+                co_await std::move(request);
+                co_return Outcome<ReturnType>(std::in_place_index<0>);
+            } else {
+                co_return Outcome<ReturnType>(std::in_place_index<0>, co_await std::move(request));
+            }
+        }
+        catch (...)
+        {
+            co_return Outcome<ReturnType>(std::in_place_index<1>, std::current_exception());
+        }
+    }
+
+    /**
+     * @brief: 主请求与延迟发出的备份请求竞争，operator||在其中一个结束后取消另一个
+    */
+    template <auto Func, typename ParamTuple>
+    auto race(std::chrono::nanoseconds delay, Deadline deadline, const ParamTuple& param_tuple)
+        -> awaitable<Outcome<typename trait_helper::rpc_return_type_getter<decltype(Func)>::type>>
+    {
+        using namespace boost::asio::experimental::awaitable_operators;
+        Channel::Route primary_route(channel);
+        auto result = co_await (call<Func>(primary_route, deadline, param_tuple) || hedge<Func>(primary_route, delay, deadline, param_tuple));
+        if (result.index() == 1) {
+            hedge_wins.fetch_add(1, std::memory_order_relaxed);
+            co_return std::move(std::get<1>(result));
+        }
+        co_return std::move(std::get<0>(result));
+    }
+
+    /**
+     * @brief: 等待delay后向主请求所用endpoint以外的实例发送备份请求
+     * @note: 没有其他可用endpoint、预算不足或备份请求失败时一直等待，直到主请求结束时被operator||取消，因此结果总是由主请求或成功的备份请求决定
+    */
+    template <auto Func, typename ParamTuple>
+    auto hedge(const Channel::Route& primary_route, std::chrono::nanoseconds delay, Deadline deadline, const ParamTuple& param_tuple)
+        -> awaitable<Outcome<typename trait_helper::rpc_return_type_getter<decltype(Func)>::type>>
+    {
+        using ReturnType = typename trait_helper::rpc_return_type_getter<decltype(Func)>::type;
+        steady_timer timer(co_await this_coro::executor);
+        timer.expires_after(delay);
+        co_await timer.async_wait(use_awaitable);
+
+        Channel::Route hedge_route(channel, &primary_route);
+        std::optional<Outcome<ReturnType>> outcome;
+        if (!hedge_route.has_available_endpoint()) {
+            // 只有主请求所用的实例可用，向同一实例发送备份请求起不到作用
+        } else if (!acquire_budget()) {
+            budget_exhausted.fetch_add(1, std::memory_order_relaxed);
+        } else {
+            hedged.fetch_add(1, std::memory_order_relaxed);
+            outcome = co_await call<Func>(hedge_route, deadline, param_tuple);
+        }
+        if (outcome && outcome->index() == 0) {
+            co_return std::move(*outcome);
+        }
+        timer.expires_at(steady_timer::time_point::max());
+        for (;;) {
+            co_await timer.async_wait(use_awaitable);
+        }
+    }
+
+    LatencyWindow& latency_window(uint64_t path_hash)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto& window = windows[path_hash];
+        if (!window) {
+            window = std::make_unique<LatencyWindow>();
+        }
+        return *window;
+    }
+
+    void record_latency(LatencyWindow& window, int64_t latency_ns)
+    {
+        std::lock_guard<std::mutex> lock(window.mtx);
+        window.histogram->record(static_cast<uint64_t>(latency_ns));
+        if (++window.samples < options.window) {
+            return;
+        }
+        util::HistogramSnapshot snapshot;
+        snapshot.merge(*window.histogram);
+        int64_t min_delay_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(options.min_delay).count();
+        window.delay_ns.store(std::max<int64_t>({1, min_delay_ns, static_cast<int64_t>(snapshot.percentile(options.quantile))}), std::memory_order_relaxed);
+        window.histogram = std::make_unique<util::LatencyHistogram>();
+        window.samples = 0;
+    }
+
+    void deposit_budget()
+    {
+        int64_t amount = static_cast<int64_t>(options.max_extra_ratio * budget_scale);
+        int64_t limit = static_cast<int64_t>(options.max_burst * budget_scale);
+        int64_t current = budget.load(std::memory_order_relaxed);
+        while (current < limit && !budget.compare_exchange_weak(current, std::min(limit, current + amount), std::memory_order_relaxed)) {
+        }
+    }
+
+    bool acquire_budget()
+    {
+        int64_t current = budget.load(std::memory_order_relaxed);
+        while (current >= budget_scale) {
+            if (budget.compare_exchange_weak(current, current - budget_scale, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    Channel& channel;
+    Options options;
+    std::mutex mtx;
+    std::unordered_map<uint64_t, std::unique_ptr<LatencyWindow>> windows;
+    std::atomic<int64_t> budget = 0;
+    std::atomic<uint64_t> requests = 0;
+    std::atomic<uint64_t> hedged = 0;
+    std::atomic<uint64_t> hedge_wins = 0;
+    std::atomic<uint64_t> budget_exhausted = 0;
+};
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <utility>
+#include <functional>
+#include <string>
+#include <optional>
+#include <boost/asio.hpp>
+#include "tcp_server.hpp"
+#include "tcp_connection.hpp"
+
+namespace struct_rpc{
+
+/**
+ * @class LocalConnection: 调用同一进程内TCPServer的连接，不经过socket，直接进入server的处理函数表。
+ *        服务部署在同一进程时只需把连接替换为LocalConnection，调用代码不变，e.g.:
+ *        struct_rpc::LocalConnection conn(server);
+ *        conn.sync_struct_rpc_request<add>(1, 2);
+ * @note: 调用参数的类型可以直接传给函数时（类型一致或可隐式转换，引用参数传入左值），跳过序列化直接在调用方线程执行函数：
+ *        同步调用包括普通函数和rpc_blocking函数；异步调用包括非阻塞的普通函数，以及未设置截止时间的协程函数（在调用方的executor上执行）。
+ *        直接调用时函数抛出的异常原样传给调用方，且不计入server的运行指标。其余情况（例如异步调用rpc_blocking函数，或参数需要经过序列化转换）
+ *        按正常的请求包编码后交给TCPServer::HandleLocalRequest处理，行为与经TCP调用相同，只省去socket读写。
+ *        同步调用在连接独占的io_context上执行，与SyncTCPConnection一样不能被多个线程同时使用；异步调用没有共享状态，可以并发使用。
+ *        不支持流式调用，也不支持ThreadLocalSingleton的协程函数（调用方的executor不保证固定在单个线程上）
+*/
+class LocalConnection : public TCPConnectionBase
+{
+public:
+    explicit LocalConnection(TCPServer& server) : TCPConnectionBase("local", "0"), server(server) {}
+
+    /**
+     * @brief: 进行一次同步RPC调用
+    */
+    template <auto Func, typename... Args>
+    auto sync_struct_rpc_request(Args&&... args)
+        -> typename trait_helper::rpc_return_type_getter<decltype(Func)>::type
+    {
+        return sync_struct_rpc_request<Func>(Deadline {}, std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief: 进行一次附带截止时间的同步RPC调用。直接调用的函数只在开始执行前检查截止时间
+    */
+    template <auto Func, typename... Args>
+    auto sync_struct_rpc_request(Deadline deadline, Args&&... args)
+        -> typename trait_helper::rpc_return_type_getter<decltype(Func)>::type
+    {
+        if constexpr (is_direct_callable<Func, Args...>() && !trait_helper::is_asio_coroutine<decltype(Func)>) {
+            if (server.IsRegistered<Func>()) {
+                check_deadline<Func>(deadline);
+                return invoke_local<Func>(std::forward<Args>(args)...);
+            }
+        }
+        return TCPConnectionBase::sync_struct_rpc_request<Func>(deadline, std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief: 进行一次异步RPC调用
+    */
+    template <auto Func, typename... Args>
+    auto async_struct_rpc_request(Args&&... args)
+        -> awaitable<typename trait_helper::rpc_return_type_getter<decltype(Func)>::type>
+    {
+        return async_struct_rpc_request<Func>(Deadline {}, std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief: 进行一次附带截止时间的异步RPC调用。设置了截止时间的协程函数经HandleLocalRequest执行，超时后被取消
+    */
+    template <auto Func, typename... Args>
+    auto async_struct_rpc_request(Deadline deadline, Args&&... args)
+        -> awaitable<typename trait_helper::rpc_return_type_getter<decltype(Func)>::type>
+    {
+        constexpr bool is_coroutine = trait_helper::is_asio_coroutine<decltype(Func)>;
+        // rpc_blocking函数直接调用会阻塞调用方的IO线程，仍交给server的阻塞线程池执行
+        if constexpr (is_direct_callable<Func, Args...>() && !rpc_blocking<Func>) {
+            if (server.IsRegistered<Func>() && !(is_coroutine && deadline.is_set())) {
+                check_deadline<Func>(deadline);
+                if constexpr (is_coroutine) {
+                    co_return co_await invoke_local<Func>(std::forward<Args>(args)...);
+                } else {
+                    co_return invoke_local<Func>(std::forward<Args>(args)...);
+                }
+            }
+        }
+        co_return co_await TCPConnectionBase::async_struct_rpc_request<Func>(deadline, std::forward<Args>(args)...);
+    }
+
+    /**
+     * @note: 与SyncTCPConnection一样最多运行到截止时间，超时后取消处理协程并抛出DeadlineExceededError。
+     *        rpc_blocking函数已经在阻塞线程池中开始执行时无法被取消，等待其结束后才返回
+    */
+    std::string make_sync_tcp_request(util::SegmentedBuffer& tcp_request, Deadline deadline) override
+    {
+        std::string request_str = tcp_request.to_string();
+        std::optional<util::SegmentedBuffer> response;
+        std::exception_ptr error;
+        boost::asio::cancellation_signal cancel;
+        co_spawn(io_context, [this, &request_str, &response]() -> awaitable<void> {
+            response = co_await server.HandleLocalRequest(request_str);
+        }, boost::asio::bind_cancellation_slot(cancel.slot(), [&error](std::exception_ptr e) { error = e; }));
+        io_context.restart();
+        if (deadline.is_set()) {
+            io_context.run_until(deadline.time_point);
+        } else {
+            io_context.run();
+        }
+        if (!response && !error) {
+            // 等待被取消的协程结束，之后才能释放它引用的请求包
+            cancel.emit(boost::asio::cancellation_type::terminal);
+            io_context.restart();
+            io_context.run();
+            throw DeadlineExceededError("deadline exceeded");
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return response->to_string();
+    }
+
+    awaitable<std::string> make_async_tcp_request(uint64_t request_id, util::SegmentedBuffer tcp_request) override
+    {
+        std::string request_str = tcp_request.to_string();
+        request_buffers->release(std::move(tcp_request));
+        util::SegmentedBuffer response = co_await server.HandleLocalRequest(request_str);
+        co_return response.to_string();
+    }
+
+private:
+    /**
+     * @brief: 调用参数能否不经序列化直接传给Func
+    */
+    template <auto Func, typename... Args>
+    static constexpr bool is_direct_callable()
+    {
+        if constexpr (trait_helper::is_stream_function<decltype(Func)> || common_define::IsThreadLocalCoroutine<Func>()) {
+            return false;
+        } else if constexpr (trait_helper::is_member_function<decltype(Func)>) {
+            using class_type = typename trait_helper::function_traits<decltype(Func)>::class_type;
+            return std::is_invocable_v<decltype(Func), class_type*, Args&&...>;
+        } else {
+            return std::is_invocable_v<decltype(Func), Args&&...>;
+        }
+    }
+
+    /**
+     * @brief: 在当前线程直接调用Func，成员函数与server一样绑定到类的单例对象
+    */
+    template <auto Func, typename... Args>
+    static auto invoke_local(Args&&... args)
+    {
+        if constexpr (trait_helper::is_member_function<decltype(Func)>) {
+            using class_type = typename trait_helper::function_traits<decltype(Func)>::class_type;
+            return std::invoke(Func, &class_type::getInstance(), std::forward<Args>(args)...);
+        } else {
+            return std::invoke(Func, std::forward<Args>(args)...);
+        }
+    }
+
+    TCPServer& server;
+    boost::asio::io_context io_context;    // 同步调用经HandleLocalRequest执行时使用
+};
+}
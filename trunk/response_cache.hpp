@@ -0,0 +1,220 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <algorithm>
+#include "utils/io_buffer.hpp"
+
+namespace struct_rpc
+{
+/**
+ * @brief: server响应缓存的配置
+ * @member max_bytes: 全部缓存项（参数和响应体）的总字节数上限，超过后按LRU淘汰
+ * @member ttl: 缓存项的有效期，过期的缓存项在下次查找时删除
+ * @member shard_num: 分片数，每个分片有独立的锁和LRU链表，容量为max_bytes / shard_num
+*/
+struct ResponseCacheOptions
+{
+    size_t max_bytes = 64 << 20;
+    std::chrono::milliseconds ttl {1000};
+    size_t shard_num = 16;
+};
+
+/**
+ * @brief: 响应缓存的整体统计，单个函数的命中数见MethodStats
+*/
+struct ResponseCacheStats
+{
+    uint64_t entries = 0;
+    uint64_t bytes = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;     // 因容量不足被淘汰的缓存项数，不包括过期和主动失效
+};
+
+/**
+ * @class ResponseCache: 以(路径哈希, 编码后的参数)为键缓存rpc_cacheable函数的响应体
+ * @note: 命中时直接把缓存的响应体拷贝到响应缓冲区，不解析参数也不调用处理函数。查找时用请求视图构造键，不分配内存
+*/
+class ResponseCache
+{
+public:
+    explicit ResponseCache(const ResponseCacheOptions& options) : options(options)
+    {
+        size_t shard_num = std::max<size_t>(1, options.shard_num);
+        shard_capacity = options.max_bytes / shard_num;
+        for (size_t i = 0; i < shard_num; ++i) {
+            shards.push_back(std::make_unique<Shard>());
+        }
+    }
+
+    /**
+     * @brief: 查找未过期的缓存项，命中时把响应体追加到response末尾
+    */
+    bool lookup(uint64_t path_hash, std::string_view params, util::SegmentedBuffer& response)
+    {
+        Key key {path_hash, params};
+        Shard& shard = shard_of(key);
+        {
+            std::lock_guard<std::mutex> lock(shard.mtx);
+            auto iter = shard.index.find(key);
+            if (iter != shard.index.end()) {
+                auto entry = iter->second;
+                if (entry->expire_time > std::chrono::steady_clock::now()) {
+                    shard.lru.splice(shard.lru.begin(), shard.lru, entry);
+                    response.append(entry->body);
+                    hits.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+                erase(shard, entry);
+            }
+        }
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    /**
+     * @brief: 写入或更新缓存项，超过单个分片容量的响应不缓存
+    */
+    void insert(uint64_t path_hash, std::string_view params, std::string body)
+    {
+        size_t bytes = entry_bytes(params.size(), body.size());
+        if (bytes > shard_capacity) {
+            return;
+        }
+        Shard& shard = shard_of(Key {path_hash, params});
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        if (auto iter = shard.index.find(Key {path_hash, params}); iter != shard.index.end()) {
+            erase(shard, iter->second);
+        }
+        shard.lru.push_front(Entry {path_hash, std::string(params), std::move(body), std::chrono::steady_clock::now() + options.ttl});
+        shard.index.emplace(Key {path_hash, shard.lru.front().params}, shard.lru.begin());
+        shard.bytes += bytes;
+        while (shard.bytes > shard_capacity) {
+            erase(shard, std::prev(shard.lru.end()));
+            evictions.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief: 删除单个缓存项
+    */
+    void invalidate(uint64_t path_hash, std::string_view params)
+    {
+        Key key {path_hash, params};
+        Shard& shard = shard_of(key);
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        if (auto iter = shard.index.find(key); iter != shard.index.end()) {
+            erase(shard, iter->second);
+        }
+    }
+
+    /**
+     * @brief: 删除某个函数的全部缓存项，需要遍历全部分片
+    */
+    void invalidate(uint64_t path_hash)
+    {
+        for (auto& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard->mtx);
+            for (auto iter = shard->lru.begin(); iter != shard->lru.end();) {
+                auto next = std::next(iter);
+                if (iter->path_hash == path_hash) {
+                    erase(*shard, iter);
+                }
+                iter = next;
+            }
+        }
+    }
+
+    void clear()
+    {
+        for (auto& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard->mtx);
+            shard->index.clear();
+            shard->lru.clear();
+            shard->bytes = 0;
+        }
+    }
+
+    ResponseCacheStats stats() const
+    {
+        ResponseCacheStats result;
+        for (const auto& shard : shards) {
+            std::lock_guard<std::mutex> lock(shard->mtx);
+            result.entries += shard->lru.size();
+            result.bytes += shard->bytes;
+        }
+        result.hits = hits.load(std::memory_order_relaxed);
+        result.misses = misses.load(std::memory_order_relaxed);
+        result.evictions = evictions.load(std::memory_order_relaxed);
+        return result;
+    }
+
+private:
+    struct Entry
+    {
+        uint64_t path_hash = 0;
+        std::string params;
+        std::string body;
+        std::chrono::steady_clock::time_point expire_time;
+    };
+
+    /**
+     * @brief: 缓存键，params指向请求缓冲区（查找时）或缓存项自身保存的参数（索引中）
+    */
+    struct Key
+    {
+        uint64_t path_hash = 0;
+        std::string_view params;
+
+        bool operator==(const Key& other) const = default;
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const
+        {
+            return std::hash<std::string_view>()(key.params) ^ (key.path_hash * 0x9e3779b97f4a7c15ull);
+        }
+    };
+
+    struct Shard
+    {
+        mutable std::mutex mtx;
+        std::list<Entry> lru;   // 表头为最近使用的缓存项
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+        size_t bytes = 0;
+    };
+
+    static size_t entry_bytes(size_t params_size, size_t body_size)
+    {
+        return params_size + body_size + sizeof(Entry);
+    }
+
+    Shard& shard_of(const Key& key)
+    {
+        return *shards[KeyHash()(key) % shards.size()];
+    }
+
+    static void erase(Shard& shard, std::list<Entry>::iterator entry)
+    {
+        shard.bytes -= entry_bytes(entry->params.size(), entry->body.size());
+        shard.index.erase(Key {entry->path_hash, entry->params});
+        shard.lru.erase(entry);
+    }
+
+    ResponseCacheOptions options;
+    size_t shard_capacity = 0;
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::atomic<uint64_t> hits = 0;
+    std::atomic<uint64_t> misses = 0;
+    std::atomic<uint64_t> evictions = 0;
+};
+}
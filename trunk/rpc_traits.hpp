@@ -0,0 +1,36 @@
+#pragma once
+
+namespace struct_rpc
+{
+    /**
+     * @brief: 标记RPC函数为阻塞/计算密集型函数。server会把该函数放到独立的阻塞线程池中执行，不占用处理网络IO的线程，
+     *         避免单个耗时调用拖慢同一线程上的全部连接。只对普通函数生效，协程本身不会阻塞IO线程
+     * @note: 在注册函数之前通过显式特化开启，e.g.:
+     *        template <> inline constexpr bool struct_rpc::rpc_blocking<fibonacci> = true;
+    */
+    template <auto Func>
+    inline constexpr bool rpc_blocking = false;
+
+    /**
+     * @brief: 标记RPC函数为纯函数/幂等函数，结果只取决于参数。server以(路径哈希, 编码后的参数)为键缓存其成功的响应，
+     *         相同参数的请求在有效期内直接返回缓存的响应，不再调用函数。不支持流式函数，见ResponseCache
+     * @note: 在注册函数之前通过显式特化开启，e.g.:
+     *        template <> inline constexpr bool struct_rpc::rpc_cacheable<generic_add<int>> = true;
+    */
+    template <auto Func>
+    inline constexpr bool rpc_cacheable = false;
+
+    /**
+     * @brief: 标记RPC函数为幂等函数，重复执行或把相同参数的并发调用合并为一次执行不会改变结果，见CoalescingClient、HedgingClient
+     * @note: rpc_cacheable的函数同样视为幂等函数，不需要重复标记，e.g.:
+     *        template <> inline constexpr bool struct_rpc::rpc_idempotent<lookup_user> = true;
+    */
+    template <auto Func>
+    inline constexpr bool rpc_idempotent = false;
+
+    /**
+     * @brief: 函数是否可以被合并、缓存或重复发送
+    */
+    template <auto Func>
+    inline constexpr bool is_rpc_idempotent = rpc_idempotent<Func> || rpc_cacheable<Func>;
+}
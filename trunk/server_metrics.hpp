@@ -0,0 +1,203 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <limits>
+#include <algorithm>
+#include "utils/histogram.hpp"
+#include "utils/util.hpp"
+
+namespace struct_rpc
+{
+/**
+ * @brief: 一项耗时指标的统计结果，单位为纳秒
+*/
+struct LatencyStats
+{
+    uint64_t count = 0;
+    uint64_t mean_ns = 0;
+    uint64_t p50_ns = 0;
+    uint64_t p99_ns = 0;
+    uint64_t p999_ns = 0;
+    uint64_t max_ns = 0;
+};
+
+/**
+ * @brief: 单个RPC函数的统计结果，可以直接作为RPC函数的返回值
+ * @member errors: 返回码非RET_SUCC（包括处理函数抛出异常）的请求数
+ * @member bytes_in/bytes_out: 请求包和响应包的总字节数，流式调用只统计结束包
+ * @member queue_time: 从请求包读取完成到处理函数开始执行的耗时，rpc_blocking函数包含在阻塞线程池中排队的时间
+ * @member handler_time: 处理函数的耗时，包含参数解析、函数执行和返回值序列化
+ * @member send_time: 响应放入连接写队列的耗时，写队列已满（客户端读取跟不上）时明显增大
+ * @member cache_hits/cache_misses: rpc_cacheable函数查找响应缓存的命中/未命中次数，命中的请求同样计入requests
+*/
+struct MethodStats
+{
+    std::string path;
+    uint64_t requests = 0;
+    uint64_t errors = 0;
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    LatencyStats queue_time;
+    LatencyStats handler_time;
+    LatencyStats send_time;
+    uint64_t cache_hits = 0;
+    uint64_t cache_misses = 0;
+};
+
+/**
+ * @brief: 单个RPC函数的运行指标。server的每个工作线程写入各自独占的分片，记录时没有锁和跨线程竞争，读取时合并全部分片
+*/
+class MethodMetrics
+{
+public:
+    struct alignas(64) Shard
+    {
+        util::LatencyHistogram queue_time;
+        util::LatencyHistogram handler_time;
+        util::LatencyHistogram send_time;
+        std::atomic<uint64_t> errors = 0;
+        std::atomic<uint64_t> bytes_in = 0;
+        std::atomic<uint64_t> bytes_out = 0;
+        std::atomic<uint64_t> cache_hits = 0;
+        std::atomic<uint64_t> cache_misses = 0;
+    };
+
+    MethodMetrics(std::string_view path, size_t shard_num) : path(path)
+    {
+        for (size_t i = 0; i < std::max<size_t>(1, shard_num); ++i) {
+            shards.push_back(std::make_unique<Shard>());
+        }
+    }
+
+    /**
+     * @brief: 当前线程的分片。工作线程通过bind_current_thread绑定各自的分片，其他线程共用最后一个分片
+    */
+    Shard& local_shard()
+    {
+        return *shards[std::min(thread_shard_index, shards.size() - 1)];
+    }
+
+    /**
+     * @brief: 把当前线程绑定到第index个分片，由server在工作线程启动时调用
+    */
+    static void bind_current_thread(size_t index)
+    {
+        thread_shard_index = index;
+    }
+
+    MethodStats snapshot() const
+    {
+        util::HistogramSnapshot queue_time, handler_time, send_time;
+        MethodStats stats;
+        stats.path = std::string(path);
+        for (const auto& shard : shards) {
+            queue_time.merge(shard->queue_time);
+            handler_time.merge(shard->handler_time);
+            send_time.merge(shard->send_time);
+            stats.errors += shard->errors.load(std::memory_order_relaxed);
+            stats.bytes_in += shard->bytes_in.load(std::memory_order_relaxed);
+            stats.bytes_out += shard->bytes_out.load(std::memory_order_relaxed);
+            stats.cache_hits += shard->cache_hits.load(std::memory_order_relaxed);
+            stats.cache_misses += shard->cache_misses.load(std::memory_order_relaxed);
+        }
+        stats.requests = handler_time.count;
+        stats.queue_time = to_latency_stats(queue_time);
+        stats.handler_time = to_latency_stats(handler_time);
+        stats.send_time = to_latency_stats(send_time);
+        return stats;
+    }
+
+private:
+    static LatencyStats to_latency_stats(const util::HistogramSnapshot& histogram)
+    {
+        return LatencyStats {histogram.count, histogram.mean(), histogram.percentile(0.5), histogram.percentile(0.99), histogram.percentile(0.999), histogram.max};
+    }
+
+    static inline thread_local size_t thread_shard_index = std::numeric_limits<size_t>::max();
+    std::string_view path;
+    std::vector<std::unique_ptr<Shard>> shards;
+};
+
+/**
+ * @brief: 一个server全部RPC函数的运行指标，与处理函数表一一对应
+*/
+class ServerMetrics
+{
+public:
+    /**
+     * @brief: 按处理函数表中的路径创建各函数的指标，需要在server开始处理请求前调用
+    */
+    void init(const std::vector<std::string_view>& paths, size_t shard_num)
+    {
+        methods.clear();
+        for (std::string_view path : paths) {
+            methods.push_back(std::make_unique<MethodMetrics>(path, shard_num));
+        }
+    }
+
+    MethodMetrics& method(size_t index)
+    {
+        return *methods[index];
+    }
+
+    std::vector<MethodStats> snapshot() const
+    {
+        std::vector<MethodStats> result;
+        for (const auto& method : methods) {
+            result.push_back(method->snapshot());
+        }
+        return result;
+    }
+
+private:
+    std::vector<std::unique_ptr<MethodMetrics>> methods;
+};
+
+/**
+ * @brief: 进程内正在运行的server的指标登记表，供rpc_stats读取。只在server启停和读取统计时加锁，不影响请求处理
+*/
+class MetricsRegistry : public util::Singleton<MetricsRegistry>
+{
+public:
+    void add(const ServerMetrics* metrics)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        servers.push_back(metrics);
+    }
+
+    void remove(const ServerMetrics* metrics)
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        servers.erase(std::remove(servers.begin(), servers.end(), metrics), servers.end());
+    }
+
+    std::vector<MethodStats> snapshot()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        std::vector<MethodStats> result;
+        for (const ServerMetrics* metrics : servers) {
+            std::vector<MethodStats> server_stats = metrics->snapshot();
+            result.insert(result.end(), std::make_move_iterator(server_stats.begin()), std::make_move_iterator(server_stats.end()));
+        }
+        return result;
+    }
+
+private:
+    std::mutex mtx;
+    std::vector<const ServerMetrics*> servers;
+};
+
+/**
+ * @brief: 内置的统计RPC函数，返回本进程中server各RPC函数的请求数、字节数及耗时分位数。默认不注册，需要时与普通函数一样注册，e.g.:
+ *        server.RegisterServerFunctions<struct_rpc::rpc_stats>();
+ *        auto stats = conn.sync_struct_rpc_request<struct_rpc::rpc_stats>();
+*/
+inline std::vector<MethodStats> rpc_stats()
+{
+    return MetricsRegistry::getInstance().snapshot();
+}
+}
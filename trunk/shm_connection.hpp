@@ -0,0 +1,64 @@
+#pragma once
+#ifdef __linux__
+#include <memory>
+#include <string>
+#include <boost/asio.hpp>
+#include "tcp_connection.hpp"
+#include "utils/shm_stream.hpp"
+
+namespace struct_rpc{
+
+/**
+ * @class ShmConnection: 经共享内存环形队列调用同一主机上server的异步连接，server需要先调用TCPServer::ListenSharedMemory(path)，e.g.:
+ *        struct_rpc::ShmConnection conn("/tmp/struct_rpc_shm.sock", io_context);
+ *        co_await conn.async_struct_rpc_request<add>(1, 2);
+ * @note: 连接时在path处的Unix domain socket上与server交换共享内存和eventfd，之后请求和响应都只经过共享内存，见util::ShmStream。
+ *        与AsyncTCPConnection一样同一时刻只能有一个请求在途，需要并发时每个协程使用各自的连接。仅支持Linux
+*/
+class ShmConnection : public TCPConnectionBase
+{
+public:
+    ShmConnection(std::string path, boost::asio::io_context& ioc, size_t capacity = util::ShmStream::default_capacity)
+        : TCPConnectionBase(std::move(path), ""), io_context(ioc), capacity(capacity)
+    {
+    }
+
+    awaitable<void> async_connect() override
+    {
+        stream.close();
+        stream_socket socket(asio::make_strand(io_context));
+        co_await socket.async_connect(asio::local::stream_protocol::endpoint(host), use_awaitable);
+        stream = util::ShmStream::connect(std::move(socket), capacity);
+    }
+
+    awaitable<std::string> make_async_tcp_request(uint64_t request_id, util::SegmentedBuffer tcp_request) override {
+        try
+        {
+            co_await async_write_all(stream, tcp_request.buffers());
+            request_buffers->release(std::move(tcp_request));
+            co_return co_await async_read_response(stream, *response_buffers);
+        }
+        catch (const std::exception& e)
+        {
+            // 与AsyncTCPConnection相同，中途失败后关闭连接，由下次调用重连
+            stream.close();
+            throw;
+        }
+    }
+
+    /**
+     * @note: 流式调用期间连接被该调用独占，需要把RpcStream读到结束后才能发起下一个请求；提前放弃RpcStream时连接被关闭，下次调用重新连接
+    */
+    awaitable<std::unique_ptr<ResponseFrameSource>> make_async_tcp_stream(uint64_t request_id, util::SegmentedBuffer tcp_request) override {
+        co_await async_write_all(stream, tcp_request.buffers());
+        request_buffers->release(std::move(tcp_request));
+        co_return std::make_unique<ExclusiveFrameSource<util::ShmStream>>(stream, request_id, response_buffers);
+    }
+
+private:
+    boost::asio::io_context& io_context;
+    size_t capacity;
+    util::ShmStream stream;
+};
+}
+#endif
@@ -2,6 +2,12 @@
 
 #include "tcp_server.hpp"
 #include "tcp_connection.hpp"
+#include "local_connection.hpp"
+#include "shm_connection.hpp"
+#include "coalescing_client.hpp"
+#include "channel.hpp"
+#include "hedging_client.hpp"
+#include "server_metrics.hpp"
 #include "utils/util.hpp"
 #include "utils/trait_helper/trait_helper.hpp"
 #include "utils/logger.hpp"
@@ -2,25 +2,225 @@
 
 #include <utility>
 #include <boost/asio.hpp>
+#include <boost/asio/experimental/concurrent_channel.hpp>
+#include <boost/asio/experimental/awaitable_operators.hpp>
 #include <iostream>
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <variant>
+#include <future>
+#include <functional>
+#include <optional>
+#include <limits>
 #include "common_define.hpp"
 #include "utils/trait_helper/trait_helper.hpp"
+#include "utils/logger.hpp"
 
 namespace struct_rpc{
 using namespace std::chrono_literals;
 using tcp = asio::ip::tcp;
 
 
+template <typename... Calls>
+class Batch;
+
+/**
+ * @brief: 从字节流读取一个完整的响应包（包含开头的total_size），接收缓冲区取自pool
+ * @param Stream: stream_socket或util::ShmStream
+*/
+template <typename Stream>
+awaitable<std::string> async_read_response(Stream& stream, util::BufferPool<std::string>& pool)
+{
+    size_t total_size;
+    co_await async_read_exact(stream, boost::asio::mutable_buffer(&total_size, sizeof(size_t)));
+    std::string response_str = pool.acquire();
+    response_str.resize(total_size + sizeof(size_t));
+    std::memcpy(response_str.data(), &total_size, sizeof(size_t));
+    co_await async_read_exact(stream, boost::asio::mutable_buffer(response_str.data() + sizeof(size_t), total_size));
+    co_return response_str;
+}
+
+/**
+ * @brief: host以该前缀开头时表示连接同一主机上的Unix domain socket，前缀之后为socket路径，port被忽略，e.g.:
+ *        struct_rpc::SyncTCPConnection conn("unix:/tmp/struct_rpc.sock", "");
+*/
+inline constexpr std::string_view unix_host_prefix = "unix:";
+
+/**
+ * @brief: 同步连接到host:port，依次尝试解析得到的各个地址；host为"unix:路径"时连接Unix domain socket
+*/
+inline void connect_stream(stream_socket& socket, const std::string& host, const std::string& port)
+{
+    boost::system::error_code ec;
+    socket.close(ec);
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+    if (host.starts_with(unix_host_prefix)) {
+        socket.connect(asio::local::stream_protocol::endpoint(host.substr(unix_host_prefix.size())));
+        return;
+    }
+#endif
+    tcp::resolver resolver(socket.get_executor());
+    ec = asio::error::host_not_found;
+    for (const auto& entry : resolver.resolve(host, port)) {
+        socket.close(ec);
+        socket.connect(entry.endpoint(), ec);
+        if (!ec) {
+            return;
+        }
+    }
+    throw boost::system::system_error(ec);
+}
+
+/**
+ * @brief: connect_stream的异步版本
+*/
+inline awaitable<void> async_connect_stream(stream_socket& socket, const std::string& host, const std::string& port)
+{
+    boost::system::error_code ec;
+    socket.close(ec);
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+    if (host.starts_with(unix_host_prefix)) {
+        co_await socket.async_connect(asio::local::stream_protocol::endpoint(host.substr(unix_host_prefix.size())), use_awaitable);
+        co_return;
+    }
+#endif
+    tcp::resolver resolver(socket.get_executor());
+    ec = asio::error::host_not_found;
+    for (const auto& entry : co_await resolver.async_resolve(host, port, use_awaitable)) {
+        socket.close(ec);
+        co_await socket.async_connect(entry.endpoint(), redirect_error(use_awaitable, ec));
+        if (!ec) {
+            co_return;
+        }
+    }
+    throw boost::system::system_error(ec);
+}
+
+/**
+ * @brief: 流式调用的响应包来源，由各连接类型实现，依次返回同一请求的各个响应包
+*/
+class ResponseFrameSource
+{
+public:
+    virtual ~ResponseFrameSource() = default;
+    virtual awaitable<std::string> next_frame() = 0;
+};
+
+/**
+ * @brief: 独占连接上的流式调用响应包来源，直接从字节流依次读取响应包
+ * @param Stream: stream_socket或util::ShmStream
+ * @note: 每个响应包的request_id必须与本次调用一致。在读到结束包之前被销毁（调用方提前break或抛出异常）或读取出错时关闭字节流，
+ *        连接上残留的响应包随之丢弃，下一次请求由基类的重试逻辑重新连接，不会把残留的流式响应包当作自己的响应
+*/
+template <typename Stream>
+class ExclusiveFrameSource : public ResponseFrameSource
+{
+public:
+    ExclusiveFrameSource(Stream& stream, uint64_t request_id, std::shared_ptr<util::BufferPool<std::string>> response_buffers)
+        : stream(stream), request_id(request_id), response_buffers(std::move(response_buffers))
+    {
+    }
+
+    ~ExclusiveFrameSource()
+    {
+        if (!finished) {
+            close_stream(stream);
+        }
+    }
+
+    awaitable<std::string> next_frame() override
+    {
+        if (finished) {
+            throw std::runtime_error("stream already finished");
+        }
+        std::string frame = co_await async_read_response(stream, *response_buffers);
+        // 响应头不参与压缩，可以直接读取request_id和标记
+        common_define::TCPResponseView tcp_response = common_define::ParseResponseView(frame);
+        if (tcp_response.request_id != request_id) {
+            response_buffers->release(std::move(frame));
+            throw std::runtime_error("unexpected response id in stream");
+        }
+        finished = common_define::IsFinalResponse(tcp_response.flags);
+        co_return frame;
+    }
+
+private:
+    Stream& stream;
+    uint64_t request_id = 0;
+    std::shared_ptr<util::BufferPool<std::string>> response_buffers;
+    bool finished = false;
+};
+
+/**
+ * @class RpcStream: 流式调用的结果，通过next()逐个异步取得server写出的结果，e.g.:
+ *        auto stream = co_await conn->async_struct_rpc_stream<Func>(args...);
+ *        while (auto item = co_await stream.next()) { ... }
+ * @note: 结果到达后才被解析，客户端不需要缓存完整的结果集。server返回错误时next()抛出异常
+*/
+template <typename T>
+class RpcStream
+{
+public:
+    RpcStream(std::unique_ptr<ResponseFrameSource> source, std::shared_ptr<util::BufferPool<std::string>> response_buffers, size_t max_decompressed_size = 64 << 20)
+        : source(std::move(source)), response_buffers(std::move(response_buffers)), max_decompressed_size(max_decompressed_size)
+    {
+    }
+
+    /**
+     * @brief: 取得下一个结果，流结束时返回std::nullopt
+    */
+    awaitable<std::optional<T>> next()
+    {
+        if (!source) {
+            co_return std::nullopt;
+        }
+        std::string frame = co_await source->next_frame();
+        struct ResponseBufferGuard
+        {
+            std::string& frame;
+            util::BufferPool<std::string>& pool;
+            ~ResponseBufferGuard() { pool.release(std::move(frame)); }
+        } response_buffer_guard {frame, *response_buffers};
+
+        common_define::DecompressFrame<common_define::ResponseHeader>(frame, max_decompressed_size);
+        common_define::TCPResponseView tcp_response = common_define::ParseResponseView(frame);
+        if (common_define::IsFinalResponse(tcp_response.flags)) {
+            // 释放响应包来源，连接可以继续用于其他请求
+            source.reset();
+            if (tcp_response.retcode != 0) {
+                throw std::runtime_error("errcode" + std::to_string(tcp_response.retcode) + " stream request");
+            }
+            co_return std::nullopt;
+        }
+        T item;
+        std::string_view data = tcp_response.data;
+        common_define::DecodeParam(item, data);
+        co_return item;
+    }
+
+private:
+    std::unique_ptr<ResponseFrameSource> source;
+    std::shared_ptr<util::BufferPool<std::string>> response_buffers;
+    size_t max_decompressed_size = 0;
+};
+
 class TCPConnectionBase
 {
+    template <typename... Calls>
+    friend class Batch;
+
 public:
     std::string host;
     std::string port;
+    common_define::PathEncoding path_encoding = common_define::PathEncoding::HASH; // 默认只发送路径哈希，调试时可切换为发送完整路径
+    CompressionOptions compression;     // 压缩配置，在建立连接前设置，连接时与server协商。共享内存及进程内连接不压缩
     TCPConnectionBase(std::string host, std::string port): host(host), port(port) {}
     virtual ~TCPConnectionBase() {};
-    virtual std::string make_sync_tcp_request(std::string tcp_request) { throw std::runtime_error("not implemented"); }
-    virtual asio::awaitable<std::string> make_async_tcp_request(std::string tcp_request) { throw std::runtime_error("not implemented"); }
+    virtual std::string make_sync_tcp_request(util::SegmentedBuffer& tcp_request, Deadline deadline) { throw std::runtime_error("not implemented"); }
+    virtual asio::awaitable<std::string> make_async_tcp_request(uint64_t request_id, util::SegmentedBuffer tcp_request) { throw std::runtime_error("not implemented"); }
+    virtual asio::awaitable<std::unique_ptr<ResponseFrameSource>> make_async_tcp_stream(uint64_t request_id, util::SegmentedBuffer tcp_request) { throw std::runtime_error("not implemented"); }
     virtual void connect() {};
     virtual asio::awaitable<void> async_connect() { co_return; };
 
@@ -29,48 +229,46 @@ public:
     */
     template <auto Func, typename... Args>
     auto sync_struct_rpc_request(Args&&... args) {
-        // step 1. 提取出RPC函数的参数类型列表，并完美转发输入的参数列表构造对应类型的tuple
+        return sync_struct_rpc_request<Func>(Deadline {}, std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief: 进行一次附带截止时间的同步RPC调用，截止时间随请求发给server，超时后抛出DeadlineExceededError
+    */
+    template <auto Func, typename... Args>
+    auto sync_struct_rpc_request(Deadline deadline, Args&&... args) {
+        static_assert(!trait_helper::is_stream_function<decltype(Func)>, "use async_struct_rpc_stream for stream rpc");
+        // step 1. 提取出RPC函数的参数类型列表，并完美转发输入的参数列表直接构造对应类型的tuple（视图类型参数直接引用调用方的数据）
         using param_tuple_type = typename trait_helper::function_traits<decltype(Func)>::decayed_arguments_tuple;
-        param_tuple_type param_tuple = std::make_tuple(std::forward<Args>(args)...);
-        // step 2. 提取出RCP调用路径，和序列化后的参数tuple构造TCP请求对象
-        common_define::TCPRequest tcp_request {std::string(trait_helper::struct_rpc_func_path<Func>()), structbuf::serializer::SaveToString(param_tuple)};
+        param_tuple_type param_tuple(std::forward<Args>(args)...);
+        // step 2. 提取出RCP调用路径，和编码后的参数tuple构造TCP请求包
+        uint64_t request_id = next_request_id();
+        check_deadline<Func>(deadline);
+
+        util::SegmentedBuffer tcp_request = build_tcp_request<Func>(request_id, param_tuple, deadline);
 
         // step 3. 执行TCP请求，得到TCP响应对象
         std::string response_str;
         try
         {
-            response_str = make_sync_tcp_request(structbuf::serializer::SaveToString(tcp_request));
+            response_str = make_sync_tcp_request(tcp_request, deadline);
+        }
+        catch (const DeadlineExceededError&)
+        {
+            throw;
         }
         catch(const std::exception& e)
         {
             // 请求失败可能是由于超时server关闭连接导致的，再次连接后重试一次
+            check_deadline<Func>(deadline);
             connect();
-            response_str = make_sync_tcp_request(structbuf::serializer::SaveToString(tcp_request));
-        }
-        
-        common_define::TCPResponse tcp_response;
-        structbuf::deserializer::ParseFromSV(tcp_response, response_str);
-        if (tcp_response.retcode != 0) {
-            throw std::runtime_error("errcode" + std::to_string(tcp_response.retcode) + tcp_request.path);
-        }
-
-        // step 4. 从TCP响应对象中提取出RCP的返回结果
-        common_define::TCPResponse::RespnseData rsp_data;
-        structbuf::deserializer::ParseFromSV(rsp_data, tcp_response.data);
-        if constexpr (trait_helper::is_func_containes_reference_param<decltype(Func)>()) {
-            structbuf::deserializer::ParseFromSV(param_tuple, rsp_data.params);
-            tupleAssign(param_tuple, args...);
-        }
-        
-        using ReturnType = typename trait_helper::rpc_return_type_getter<decltype(Func)>::type;
-        if constexpr (!std::is_same_v<ReturnType, void>) {
-            ReturnType function_return_obj;
-            structbuf::deserializer::ParseFromSV(function_return_obj, rsp_data.ret);
-            return function_return_obj;
-        } else {
-            return;
+            check_deadline<Func>(deadline);
+            response_str = make_sync_tcp_request(tcp_request, deadline);
         }
+        request_buffers->release(std::move(tcp_request));
         
+        // step 4. 从TCP响应中提取出RCP的返回结果
+        return decode_rpc_response<Func>(response_str, param_tuple, args...);
     }
 
     /**
@@ -80,14 +278,71 @@ public:
     auto async_struct_rpc_request(Args&&... args) 
         -> awaitable<typename trait_helper::rpc_return_type_getter<decltype(Func)>::type>
     {
+        return async_struct_rpc_request<Func>(Deadline {}, std::forward<Args>(args)...);
+    }
+
+    /**
+     * @brief: 进行一次附带截止时间的异步RPC调用，截止时间随请求发给server，超时后取消等待并抛出DeadlineExceededError
+    */
+    template <auto Func, typename... Args>
+    auto async_struct_rpc_request(Deadline deadline, Args&&... args)
+        -> awaitable<typename trait_helper::rpc_return_type_getter<decltype(Func)>::type>
+    {
+        static_assert(!trait_helper::is_stream_function<decltype(Func)>, "use async_struct_rpc_stream for stream rpc");
         using param_tuple_type = typename trait_helper::function_traits<decltype(Func)>::decayed_arguments_tuple;
-        param_tuple_type param_tuple = std::make_tuple(std::forward<Args>(args)...);
-        common_define::TCPRequest tcp_request {std::string(trait_helper::struct_rpc_func_path<Func>()), structbuf::serializer::SaveToString(param_tuple)};
+        param_tuple_type param_tuple(std::forward<Args>(args)...);
+        uint64_t request_id = next_request_id();
+        check_deadline<Func>(deadline);
         std::string response_str;
         bool need_retry = false;
         try
         {
-            response_str = co_await make_async_tcp_request(structbuf::serializer::SaveToString(tcp_request));
+            response_str = co_await await_with_deadline<Func>(make_async_tcp_request(request_id, build_tcp_request<Func>(request_id, param_tuple, deadline)), deadline);
+        }
+        catch (const DeadlineExceededError&)
+        {
+            throw;
+        }
+        catch(const std::exception& e)
+        {
+            // 请求失败可能是由于超时server关闭连接导致的，再次连接后重试一次
+            need_retry = true;
+        }
+
+        if (need_retry) {
+            // 重连和重发同样受截止时间约束
+            check_deadline<Func>(deadline);
+            co_await await_with_deadline<Func>(async_connect(), deadline);
+            check_deadline<Func>(deadline);
+            response_str = co_await await_with_deadline<Func>(make_async_tcp_request(request_id, build_tcp_request<Func>(request_id, param_tuple, deadline)), deadline);
+        }
+
+        co_return decode_rpc_response<Func>(response_str, param_tuple, args...);
+    }
+
+    /**
+     * @brief: 开始构造一个批量请求，见Batch
+     * @param parallel: 是否允许server并发执行各个调用，否则按添加顺序依次执行
+    */
+    Batch<> batch(bool parallel = false);
+
+    /**
+     * @brief: 发起一次流式RPC调用，Func为最后一个参数是StreamWriter<T>的协程，args不包含该参数
+     * @return: 逐个返回T类型结果的RpcStream
+    */
+    template <auto Func, typename... Args>
+    auto async_struct_rpc_stream(Args&&... args)
+        -> awaitable<RpcStream<typename trait_helper::stream_function_traits<decltype(Func)>::item_type>>
+    {
+        using param_tuple_type = typename trait_helper::stream_function_traits<decltype(Func)>::stream_params_tuple;
+        using item_type = typename trait_helper::stream_function_traits<decltype(Func)>::item_type;
+        param_tuple_type param_tuple(std::forward<Args>(args)...);
+        uint64_t request_id = next_request_id();
+        std::unique_ptr<ResponseFrameSource> source;
+        bool need_retry = false;
+        try
+        {
+            source = co_await make_async_tcp_stream(request_id, build_tcp_request<Func>(request_id, param_tuple));
         }
         catch(const std::exception& e)
         {
@@ -97,33 +352,208 @@ public:
 
         if (need_retry) {
             co_await async_connect();
-            response_str = co_await make_async_tcp_request(structbuf::serializer::SaveToString(tcp_request));
+            source = co_await make_async_tcp_stream(request_id, build_tcp_request<Func>(request_id, param_tuple));
         }
+        co_return RpcStream<item_type>(std::move(source), response_buffers, compression.max_decompressed_size);
+    }
 
-        common_define::TCPResponse tcp_response;
-        structbuf::deserializer::ParseFromSV(tcp_response, response_str);
-        if (tcp_response.retcode != 0) {
-            throw std::runtime_error("errcode" + std::to_string(tcp_response.retcode) + tcp_request.path);
+protected:
+    /**
+     * @brief: 生成连接内唯一的请求ID，复用连接时用于匹配请求与响应
+    */
+    uint64_t next_request_id() {
+        return request_id_generator.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    /**
+     * @brief: 构造未压缩的TCP请求包：固定布局的请求头、路径（仅FULL_PATH模式）和编码后的参数依次写入分段缓冲区，发送时不做拼接
+     * @note: HASH模式下只携带编译期计算的路径哈希，不需要为路径字符串分配内存。设置了截止时间时把剩余时长写入请求头。
+     *        压缩在实际收发数据的连接写出请求时按该连接的协商结果进行，见compress_request
+    */
+    template <auto Func, typename ParamTuple>
+    util::SegmentedBuffer build_tcp_request(uint64_t request_id, const ParamTuple& param_tuple, Deadline deadline = {}) {
+        std::string_view path;
+        if (path_encoding == common_define::PathEncoding::FULL_PATH) {
+            path = trait_helper::struct_rpc_func_path<Func>();
         }
+        util::SegmentedBuffer tcp_request = request_buffers->acquire();
+        common_define::ReserveHeader<common_define::RequestHeader>(tcp_request);
+        tcp_request.append(path);
+        common_define::EncodeParams(param_tuple, tcp_request);
+        common_define::FinishRequest(tcp_request, request_id, trait_helper::struct_rpc_func_hash<Func>(), static_cast<uint32_t>(path.size()),
+            common_define::FLAG_NONE, deadline.remaining_us());
+        return tcp_request;
+    }
 
-        common_define::TCPResponse::RespnseData rsp_data;
-        structbuf::deserializer::ParseFromSV(rsp_data, tcp_response.data);
-        if constexpr (trait_helper::is_func_containes_reference_param<decltype(Func)>()) {
-            structbuf::deserializer::ParseFromSV(param_tuple, rsp_data.params);
-            tupleAssign(param_tuple, args...);
+    /**
+     * @brief: 使用本连接协商得到的压缩算法压缩请求包，未协商、包太小或已经压缩过时不做处理
+     * @note: 由直接持有socket的连接在写出前调用；ConnectionPool、Channel只转发未压缩的请求包，由选中的成员连接各自压缩
+    */
+    void compress_request(util::SegmentedBuffer& tcp_request)
+    {
+        if (const util::Codec* codec = negotiated_codec.load(std::memory_order_relaxed)) {
+            common_define::CompressFrame<common_define::RequestHeader>(tcp_request, *codec, compression.min_size);
         }
-        
+    }
+
+    /**
+     * @brief: 在刚建立的连接上协商压缩算法，需要在连接上发出其他请求之前完成。compression.codecs为空时不协商
+    */
+    void negotiate_compression(stream_socket& stream)
+    {
+        negotiated_codec.store(nullptr, std::memory_order_relaxed);
+        if (compression.codecs.empty()) {
+            return;
+        }
+        util::SegmentedBuffer request;
+        common_define::MakeNegotiateRequest(request, compression.codecs);
+        boost::asio::write(stream, request.buffers());
+        size_t total_size;
+        boost::asio::read(stream, boost::asio::buffer(&total_size, sizeof(size_t)));
+        if (total_size > compression.max_decompressed_size) {
+            throw std::runtime_error("negotiate response too large");
+        }
+        std::string response_str(total_size + sizeof(size_t), '\0');
+        std::memcpy(response_str.data(), &total_size, sizeof(size_t));
+        boost::asio::read(stream, boost::asio::buffer(response_str.data() + sizeof(size_t), total_size));
+        finish_negotiation(response_str);
+    }
+
+    /**
+     * @brief: negotiate_compression的异步版本
+    */
+    awaitable<void> async_negotiate_compression(stream_socket& stream)
+    {
+        negotiated_codec.store(nullptr, std::memory_order_relaxed);
+        if (compression.codecs.empty()) {
+            co_return;
+        }
+        util::SegmentedBuffer request;
+        common_define::MakeNegotiateRequest(request, compression.codecs);
+        co_await async_write_all(stream, request.buffers());
+        std::string response_str = co_await async_read_response(stream, *response_buffers);
+        finish_negotiation(response_str);
+        response_buffers->release(std::move(response_str));
+    }
+
+    /**
+     * @brief: 让另一个连接使用与当前连接相同的压缩配置，需要在该连接建立之前调用。协商结果由各连接分别保存，不同的server可以协商出不同的算法
+    */
+    void share_compression(TCPConnectionBase& other)
+    {
+        other.compression = compression;
+    }
+
+    /**
+     * @brief: 截止时间已过时不再发出请求，直接抛出DeadlineExceededError
+    */
+    template <auto Func>
+    static void check_deadline(const Deadline& deadline)
+    {
+        if (deadline.expired()) {
+            throw DeadlineExceededError("deadline exceeded " + std::string(trait_helper::struct_rpc_func_path<Func>()));
+        }
+    }
+
+    /**
+     * @brief: 等待异步请求的响应（或重连等其他异步操作完成），超过截止时间时抛出DeadlineExceededError
+     * @note: 计时器先完成时operator||通过取消槽取消request，各连接类型在请求被取消时负责清理连接状态（注销等待或关闭连接）
+    */
+    template <auto Func, typename T>
+    static awaitable<T> await_with_deadline(awaitable<T> request, Deadline deadline)
+    {
+        if (!deadline.is_set()) {
+            co_return co_await std::move(request);
+        }
+        using namespace boost::asio::experimental::awaitable_operators;
+        steady_timer timer(co_await this_coro::executor);
+        timer.expires_at(deadline.time_point);
+        auto result = co_await (std::move(request) || timer.async_wait(use_awaitable));
+        if (result.index() == 1) {
+            throw DeadlineExceededError("deadline exceeded " + std::string(trait_helper::struct_rpc_func_path<Func>()));
+        }
+        if constexpr (!std::is_void_v<T>) {
+            co_return std::move(std::get<0>(result));
+        }
+    }
+
+    /**
+     * @brief: 单次遍历解析响应包：先解析响应头，再依次解析返回值以及（函数包含引用参数时）调用后的参数
+    */
+    template <auto Func, typename ParamTuple, typename... Args>
+    auto decode_rpc_response(std::string& response_str, ParamTuple& param_tuple, Args&... args)
+        -> typename trait_helper::rpc_return_type_getter<decltype(Func)>::type
+    {
+        // 解析结束后把接收缓冲区归还到缓冲池
+        struct ResponseBufferGuard
+        {
+            std::string& response_str;
+            util::BufferPool<std::string>& pool;
+            ~ResponseBufferGuard() { pool.release(std::move(response_str)); }
+        } response_buffer_guard {response_str, *response_buffers};
+
+        common_define::DecompressFrame<common_define::ResponseHeader>(response_str, compression.max_decompressed_size);
+        return decode_rpc_result<Func>(common_define::ParseResponseView(response_str), param_tuple, args...);
+    }
+
+    /**
+     * @brief: 从响应视图中解析RPC调用结果，返回码非RET_SUCC时抛出异常
+    */
+    template <auto Func, typename ParamTuple, typename... Args>
+    auto decode_rpc_result(const common_define::TCPResponseView& tcp_response, ParamTuple& param_tuple, Args&... args)
+        -> typename trait_helper::rpc_return_type_getter<decltype(Func)>::type
+    {
+        if (tcp_response.retcode == static_cast<int32_t>(common_define::RetCode::RET_DEADLINE_EXCEEDED)) {
+            throw DeadlineExceededError("deadline exceeded " + std::string(trait_helper::struct_rpc_func_path<Func>()));
+        }
+        if (tcp_response.retcode != 0) {
+            throw std::runtime_error("errcode" + std::to_string(tcp_response.retcode) + std::string(trait_helper::struct_rpc_func_path<Func>()));
+        }
+
+        std::string_view data = tcp_response.data;
         using ReturnType = typename trait_helper::rpc_return_type_getter<decltype(Func)>::type;
         if constexpr (!std::is_same_v<ReturnType, void>) {
             ReturnType function_return_obj;
-            structbuf::deserializer::ParseFromSV(function_return_obj, rsp_data.ret);
-            co_return function_return_obj;
+            common_define::DecodeParam(function_return_obj, data);
+            if constexpr (trait_helper::is_func_containes_reference_param<decltype(Func)>()) {
+                common_define::DecodeParams(param_tuple, data);
+                tupleAssign(param_tuple, args...);
+            }
+            return function_return_obj;
         } else {
-            co_return;
+            if constexpr (trait_helper::is_func_containes_reference_param<decltype(Func)>()) {
+                common_define::DecodeParams(param_tuple, data);
+                tupleAssign(param_tuple, args...);
+            }
+            return;
         }
     }
 
+    /**
+     * @brief: 让另一个连接与当前连接共用缓冲池，需要在该连接建立之前调用。组合多条连接的上层对象用它避免缓冲区在各连接的池之间单向流动
+    */
+    void share_buffer_pools(TCPConnectionBase& other)
+    {
+        other.request_buffers = request_buffers;
+        other.response_buffers = response_buffers;
+    }
+
+    std::shared_ptr<util::BufferPool<util::SegmentedBuffer>> request_buffers = std::make_shared<util::BufferPool<util::SegmentedBuffer>>();   // 请求输出缓冲区池
+    std::shared_ptr<util::BufferPool<std::string>> response_buffers = std::make_shared<util::BufferPool<std::string>>();    // 响应接收缓冲区池
+
 private:
+    /**
+     * @brief: 记录server在协商响应中选定的压缩算法，server选择了本地未注册的算法时不压缩
+    */
+    void finish_negotiation(std::string_view response_str)
+    {
+        uint32_t codec_id = common_define::ParseNegotiateResponse(response_str);
+        negotiated_codec.store(util::CodecRegistry::getInstance().find(codec_id), std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> request_id_generator {0};
+    std::atomic<const util::Codec*> negotiated_codec {nullptr};    // 本连接协商得到的压缩算法，未协商时为空
+
     template <typename Tuple, std::size_t... Indices, typename... Args>
     void tupleAssignImpl(const Tuple& tuple, std::index_sequence<Indices...>, Args&... args) {
         ((args = std::get<Indices>(tuple)), ...);
@@ -136,61 +566,1022 @@ private:
     }
 };
 
-class SyncTCPConnection : public TCPConnectionBase
+/**
+ * @brief: 批量请求中的单个调用，保存RPC函数及其参数
+*/
+template <auto Func>
+struct BatchCall
 {
-private:
-    boost::asio::io_context io_context;
-    tcp::socket s;
+    static constexpr auto func = Func;
+    using param_tuple_type = typename trait_helper::function_traits<decltype(Func)>::decayed_arguments_tuple;
+    using return_type = typename trait_helper::rpc_return_type_getter<decltype(Func)>::type;
+    using result_type = std::conditional_t<std::is_void_v<return_type>, std::monostate, return_type>;
+    param_tuple_type param_tuple;
+};
+
+/**
+ * @class Batch: 批量RPC调用。多个调用编码进同一个请求包一次发出，server把各调用的结果合并进同一个响应包返回，
+ *        一次往返得到全部调用的结果，e.g.:
+ *        auto [sum, str] = co_await conn->batch().add<add>(1, 2).add<echo>("x").async_request();
+ * @param Calls: 已添加的调用，每次add返回追加了一个调用的新Batch对象
+ * @note: 返回值为按添加顺序排列的tuple，void返回类型的调用对应std::monostate；任一调用失败时整个批量调用抛出异常。
+ *        批量调用不回写引用参数，视图类型参数只引用调用方的数据，需要保证其在请求完成前有效
+*/
+template <typename... Calls>
+class Batch
+{
+    template <typename... OtherCalls>
+    friend class Batch;
+
 public:
-    SyncTCPConnection(std::string host, std::string port): TCPConnectionBase(host, port), s(io_context) 
+    using result_type = std::tuple<typename Calls::result_type...>;
+
+    Batch(TCPConnectionBase& conn, bool parallel, std::tuple<Calls...> calls = {})
+        : conn(conn), parallel(parallel), calls(std::move(calls))
     {
-        connect();
     }
 
-    void connect() override
+    /**
+     * @brief: 追加一次调用，参数规则与async_struct_rpc_request相同
+    */
+    template <auto Func, typename... Args>
+    Batch<Calls..., BatchCall<Func>> add(Args&&... args) &&
     {
-        tcp::resolver resolver(io_context);
-        boost::asio::connect(s, resolver.resolve(host, port));
+        static_assert(!trait_helper::is_func_containes_reference_param<decltype(Func)>(), "batch call does not support reference params");
+        static_assert(!trait_helper::is_stream_function<decltype(Func)>, "batch call does not support stream rpc");
+        using param_tuple_type = typename BatchCall<Func>::param_tuple_type;
+        return Batch<Calls..., BatchCall<Func>>(conn, parallel,
+            std::tuple_cat(std::move(calls), std::tuple<BatchCall<Func>>(BatchCall<Func> {param_tuple_type(std::forward<Args>(args)...)})));
     }
 
-    std::string make_sync_tcp_request(std::string tcp_request) override
+    /**
+     * @brief: 同步发出批量请求
+    */
+    result_type sync_request()
     {
-        boost::asio::write(s, boost::asio::buffer(tcp_request, tcp_request.size()));
-        size_t total_size;
-        boost::asio::read(s, boost::asio::buffer(&total_size, sizeof(size_t)));
-        std::string response_str(total_size + sizeof(size_t), '\0');
-        std::memcpy(response_str.data(), &total_size, sizeof(size_t));
-        boost::asio::read(s, boost::asio::buffer(response_str.data() + sizeof(size_t), total_size));
-        return response_str;
+        uint64_t request_id = conn.next_request_id();
+        util::SegmentedBuffer tcp_request = build_batch_request(request_id);
+        std::string response_str;
+        try
+        {
+            response_str = conn.make_sync_tcp_request(tcp_request, Deadline {});
+        }
+        catch (const std::exception& e)
+        {
+            conn.connect();
+            response_str = conn.make_sync_tcp_request(tcp_request, Deadline {});
+        }
+        conn.request_buffers->release(std::move(tcp_request));
+        return decode_batch_response(response_str);
     }
 
-};
+    /**
+     * @brief: 异步发出批量请求
+    */
+    awaitable<result_type> async_request()
+    {
+        uint64_t request_id = conn.next_request_id();
+        std::string response_str;
+        bool need_retry = false;
+        try
+        {
+            response_str = co_await conn.make_async_tcp_request(request_id, build_batch_request(request_id));
+        }
+        catch (const std::exception& e)
+        {
+            need_retry = true;
+        }
+
+        if (need_retry) {
+            co_await conn.async_connect();
+            response_str = co_await conn.make_async_tcp_request(request_id, build_batch_request(request_id));
+        }
+        co_return decode_batch_response(response_str);
+    }
 
-class AsyncTCPConnection : public TCPConnectionBase
-{
 private:
-    boost::asio::io_context& io_context;
-    tcp::socket s;
-public:
-    AsyncTCPConnection(std::string host, std::string port, boost::asio::io_context& ioc): TCPConnectionBase(host, port), io_context(ioc), s(io_context) 
+    /**
+     * @brief: 批量请求包的消息体为依次排列的各子请求包，子请求的request_id为其在批量请求中的序号
+    */
+    util::SegmentedBuffer build_batch_request(uint64_t request_id)
     {
+        util::SegmentedBuffer tcp_request = conn.request_buffers->acquire();
+        common_define::ReserveHeader<common_define::RequestHeader>(tcp_request);
+        [&]<size_t... Indices>(std::index_sequence<Indices...>) {
+            (append_sub_request<Indices>(tcp_request), ...);
+        }(std::index_sequence_for<Calls...>{});
+        uint32_t flags = common_define::FLAG_BATCH | (parallel ? common_define::FLAG_BATCH_PARALLEL : common_define::FLAG_NONE);
+        common_define::FinishRequest(tcp_request, request_id, 0, 0, flags);
+        return tcp_request;
     }
 
-    awaitable<void> async_connect()
+    template <size_t Index>
+    void append_sub_request(util::SegmentedBuffer& tcp_request)
     {
-        tcp::resolver resolver(s.get_executor());
-        co_await asio::async_connect(s, resolver.resolve(host, port), asio::use_awaitable);
+        auto& call = std::get<Index>(calls);
+        // 子请求不单独压缩，由发送连接对外层批量请求包整体压缩
+        util::SegmentedBuffer sub_request = conn.template build_tcp_request<std::remove_reference_t<decltype(call)>::func>(Index, call.param_tuple);
+        tcp_request.append_owned(std::move(sub_request));
+        conn.request_buffers->release(std::move(sub_request));
     }
 
-    awaitable<std::string> make_async_tcp_request(std::string tcp_request) override {
-        co_await boost::asio::async_write(s, boost::asio::buffer(tcp_request, tcp_request.size()), asio::use_awaitable);
-        size_t total_size;
-        co_await boost::asio::async_read(s, boost::asio::mutable_buffer(&total_size, sizeof(size_t)), asio::use_awaitable);
-        std::string response_str(total_size + sizeof(size_t), '\0');
-        std::memcpy(response_str.data(), &total_size, sizeof(size_t));
-        co_await boost::asio::async_read(s, boost::asio::mutable_buffer(response_str.data() + sizeof(size_t), total_size), asio::use_awaitable);
-        co_return response_str;
+    result_type decode_batch_response(std::string& response_str)
+    {
+        struct ResponseBufferGuard
+        {
+            std::string& response_str;
+            util::BufferPool<std::string>& pool;
+            ~ResponseBufferGuard() { pool.release(std::move(response_str)); }
+        } response_buffer_guard {response_str, *conn.response_buffers};
+
+        common_define::DecompressFrame<common_define::ResponseHeader>(response_str, conn.compression.max_decompressed_size);
+        common_define::TCPResponseView tcp_response = common_define::ParseResponseView(response_str);
+        if (tcp_response.retcode != 0) {
+            throw std::runtime_error("errcode" + std::to_string(tcp_response.retcode) + " batch request");
+        }
+        std::vector<std::string_view> frames = common_define::SplitFrames(tcp_response.data);
+        if (frames.size() != sizeof...(Calls)) {
+            throw std::runtime_error("batch response size mismatch");
+        }
+        return [&]<size_t... Indices>(std::index_sequence<Indices...>) {
+            return result_type {decode_sub_response<Indices>(frames[Indices])...};
+        }(std::index_sequence_for<Calls...>{});
+    }
+
+    template <size_t Index>
+    auto decode_sub_response(std::string_view frame)
+    {
+        using Call = std::tuple_element_t<Index, std::tuple<Calls...>>;
+        auto& call = std::get<Index>(calls);
+        common_define::TCPResponseView sub_response = common_define::ParseResponseView(frame);
+        if constexpr (std::is_void_v<typename Call::return_type>) {
+            conn.template decode_rpc_result<Call::func>(sub_response, call.param_tuple);
+            return std::monostate {};
+        } else {
+            return conn.template decode_rpc_result<Call::func>(sub_response, call.param_tuple);
+        }
     }
+
+    TCPConnectionBase& conn;
+    bool parallel = false;
+    std::tuple<Calls...> calls;
+};
+
+inline Batch<> TCPConnectionBase::batch(bool parallel)
+{
+    return Batch<>(*this, parallel);
+}
+
+class SyncTCPConnection : public TCPConnectionBase
+{
+private:
+    /**
+     * @brief: 流水线中已发出、等待响应的调用
+     * @member complete: 收到响应后解析结果并写入对应的promise
+     * @member fail: 连接出错时以异常结束对应的promise
+    */
+    struct PipelinedCall
+    {
+        std::function<void(std::string&)> complete;
+        std::function<void(std::exception_ptr)> fail;
+    };
+
+    boost::asio::io_context io_context;
+    stream_socket s;
+    std::vector<util::SegmentedBuffer> queued_requests;    // 流水线中尚未写出的请求
+    std::unordered_map<uint64_t, PipelinedCall> pipelined_calls;
+
+public:
+    size_t max_pipeline_depth = 128;    // 流水线中排队的请求达到该数量时自动发出
+
+    SyncTCPConnection(std::string host, std::string port, CompressionOptions compression = {}): TCPConnectionBase(host, port), s(io_context) 
+    {
+        this->compression = std::move(compression);
+        connect();
+    }
+
+    void connect() override
+    {
+        connect_stream(s, host, port);
+        negotiate_compression(s);
+    }
+
+    std::string make_sync_tcp_request(util::SegmentedBuffer& tcp_request, Deadline deadline) override
+    {
+        // 先完成流水线中的全部调用，保证连接上下一个响应属于本次请求
+        if (!queued_requests.empty() || !pipelined_calls.empty()) {
+            flush_pipeline();
+        }
+        compress_request(tcp_request);
+        if (deadline.is_set()) {
+            return request_until_deadline(tcp_request, deadline);
+        }
+        boost::asio::write(s, tcp_request.buffers());
+        return read_response();
+    }
+
+    /**
+     * @brief: 以流水线方式发起一次同步RPC调用，请求只进入发送队列，立即返回对应的future
+     * @note: 队列中的请求在调用flush_pipeline、对任一future调用get/wait、发起普通同步调用或排队数达到max_pipeline_depth时
+     *        一次性连续写出，随后按request_id读取全部响应。future依赖本连接对象，需要在连接销毁前取得结果；不支持引用参数
+    */
+    template <auto Func, typename... Args>
+    auto pipeline_struct_rpc_request(Args&&... args)
+        -> std::future<typename trait_helper::rpc_return_type_getter<decltype(Func)>::type>
+    {
+        static_assert(!trait_helper::is_func_containes_reference_param<decltype(Func)>(), "pipelined call does not support reference params");
+        using ReturnType = typename trait_helper::rpc_return_type_getter<decltype(Func)>::type;
+        using param_tuple_type = typename trait_helper::function_traits<decltype(Func)>::decayed_arguments_tuple;
+        param_tuple_type param_tuple(std::forward<Args>(args)...);
+        uint64_t request_id = next_request_id();
+        util::SegmentedBuffer tcp_request = build_tcp_request<Func>(request_id, param_tuple);
+        compress_request(tcp_request);
+        queued_requests.push_back(std::move(tcp_request));
+
+        auto promise = std::make_shared<std::promise<ReturnType>>();
+        std::future<ReturnType> result = promise->get_future();
+        pipelined_calls[request_id] = PipelinedCall {
+            [this, promise](std::string& response_str) {
+                try
+                {
+                    param_tuple_type unused_params;
+                    if constexpr (std::is_void_v<ReturnType>) {
+                        decode_rpc_response<Func>(response_str, unused_params);
+                        promise->set_value();
+                    } else {
+                        promise->set_value(decode_rpc_response<Func>(response_str, unused_params));
+                    }
+                }
+                catch (...)
+                {
+                    promise->set_exception(std::current_exception());
+                }
+            },
+            [promise](std::exception_ptr e) { promise->set_exception(e); }
+        };
+
+        if (queued_requests.size() >= max_pipeline_depth) {
+            flush_pipeline();
+        }
+        // 延迟执行的future：调用方等待结果时如果响应尚未读取，先把流水线中的请求发出并读取响应
+        return std::async(std::launch::deferred, [this, result = std::move(result)]() mutable {
+            if (result.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                flush_pipeline();
+            }
+            return result.get();
+        });
+    }
+
+    /**
+     * @brief: 把流水线中排队的请求连续写出，再读取全部已发出请求的响应。响应可以按任意顺序到达
+     * @note: 写出失败时重连并重发一次；读取失败时以异常结束全部等待中的调用并抛出
+    */
+    void flush_pipeline()
+    {
+        if (!queued_requests.empty()) {
+            std::vector<boost::asio::const_buffer> buffers;
+            for (auto& tcp_request : queued_requests) {
+                auto request_buffers = tcp_request.buffers();
+                buffers.insert(buffers.end(), request_buffers.begin(), request_buffers.end());
+            }
+            try
+            {
+                boost::asio::write(s, buffers);
+            }
+            catch (const std::exception& e)
+            {
+                // 请求失败可能是由于超时server关闭连接导致的，再次连接后重试一次
+                connect();
+                boost::asio::write(s, buffers);
+            }
+            for (auto& tcp_request : queued_requests) {
+                request_buffers->release(std::move(tcp_request));
+            }
+            queued_requests.clear();
+        }
+
+        try
+        {
+            while (!pipelined_calls.empty()) {
+                std::string response_str = read_response();
+                auto iter = pipelined_calls.find(common_define::ParseResponseView(response_str).request_id);
+                if (iter == pipelined_calls.end()) {
+                    response_buffers->release(std::move(response_str));
+                    continue;
+                }
+                PipelinedCall call = std::move(iter->second);
+                pipelined_calls.erase(iter);
+                call.complete(response_str);
+            }
+        }
+        catch (...)
+        {
+            auto e = std::current_exception();
+            for (auto& [request_id, call] : pipelined_calls) {
+                call.fail(e);
+            }
+            pipelined_calls.clear();
+            throw;
+        }
+    }
+
+private:
+    /**
+     * @brief: 在连接自己的io_context上异步完成一次请求，最多运行到截止时间
+     * @note: 超时后关闭socket取消未完成的读写（连接上可能残留半个响应，不能继续使用），下次调用时重新连接
+    */
+    std::string request_until_deadline(util::SegmentedBuffer& tcp_request, Deadline deadline)
+    {
+        std::optional<std::string> response_str;
+        std::exception_ptr error;
+        co_spawn(io_context, [this, &tcp_request, &response_str]() -> awaitable<void> {
+            co_await boost::asio::async_write(s, tcp_request.buffers(), use_awaitable);
+            response_str = co_await async_read_response(s, *response_buffers);
+        }, [&error](std::exception_ptr e) { error = e; });
+        io_context.restart();
+        io_context.run_until(deadline.time_point);
+        if (!response_str && !error) {
+            boost::system::error_code ec;
+            s.close(ec);
+            // 等待被取消的协程结束，之后才能释放它引用的请求缓冲区
+            io_context.restart();
+            io_context.run();
+            throw DeadlineExceededError("deadline exceeded");
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(*response_str);
+    }
+
+    /**
+     * @brief: 从socket读取一个完整的响应包
+    */
+    std::string read_response()
+    {
+        size_t total_size;
+        boost::asio::read(s, boost::asio::buffer(&total_size, sizeof(size_t)));
+        std::string response_str = response_buffers->acquire();
+        response_str.resize(total_size + sizeof(size_t));
+        std::memcpy(response_str.data(), &total_size, sizeof(size_t));
+        boost::asio::read(s, boost::asio::buffer(response_str.data() + sizeof(size_t), total_size));
+        return response_str;
+    }
+};
+
+class AsyncTCPConnection : public TCPConnectionBase
+{
+private:
+    boost::asio::io_context& io_context;
+    stream_socket s;
+public:
+    AsyncTCPConnection(std::string host, std::string port, boost::asio::io_context& ioc): TCPConnectionBase(host, port), io_context(ioc), s(io_context) 
+    {
+    }
+
+    awaitable<void> async_connect()
+    {
+        co_await async_connect_stream(s, host, port);
+        co_await async_negotiate_compression(s);
+    }
+
+    awaitable<std::string> make_async_tcp_request(uint64_t request_id, util::SegmentedBuffer tcp_request) override {
+        compress_request(tcp_request);
+        try
+        {
+            co_await boost::asio::async_write(s, tcp_request.buffers(), asio::use_awaitable);
+            request_buffers->release(std::move(tcp_request));
+            co_return co_await async_read_response(s, *response_buffers);
+        }
+        catch (const std::exception& e)
+        {
+            // 读写中途失败或因超过截止时间被取消时，连接上可能残留半个请求或响应，关闭连接后由下次调用重连
+            boost::system::error_code ec;
+            s.close(ec);
+            throw;
+        }
+    }
+
+    /**
+     * @note: 流式调用期间连接被该调用独占，需要把RpcStream读到结束后才能发起下一个请求；提前放弃RpcStream时连接被关闭，下次调用重新连接
+    */
+    awaitable<std::unique_ptr<ResponseFrameSource>> make_async_tcp_stream(uint64_t request_id, util::SegmentedBuffer tcp_request) override {
+        compress_request(tcp_request);
+        co_await boost::asio::async_write(s, tcp_request.buffers(), asio::use_awaitable);
+        request_buffers->release(std::move(tcp_request));
+        co_return std::make_unique<ExclusiveFrameSource<stream_socket>>(s, request_id, response_buffers);
+    }
+};
+
+/**
+ * @class MultiplexTCPConnection: 单条TCP连接上复用多个并发RPC请求的异步连接
+ * @note: 任意数量的协程可以同时通过同一个MultiplexTCPConnection对象发起async_struct_rpc_request，
+ *        请求经写队列依次写出，由连接内的读协程按request_id把响应分发给对应的等待者，无需等待前一个请求返回
+*/
+class MultiplexTCPConnection : public TCPConnectionBase
+{
+    using ResponseChannel = asio::experimental::concurrent_channel<void(boost::system::error_code, std::string)>;
+    using WriteChannel = asio::experimental::concurrent_channel<void(boost::system::error_code, util::SegmentedBuffer)>;
+    using GateChannel = asio::experimental::concurrent_channel<void(boost::system::error_code)>;
+
+    /**
+     * @brief: 等待响应的调用。流式调用会收到多个响应包，直到最后一个响应包才从等待表中移除
+     * @member backlog: 仅流式调用使用，已投递到response_channel但调用方尚未读取的响应包数
+    */
+    struct PendingCall
+    {
+        std::shared_ptr<ResponseChannel> response_channel;
+        std::shared_ptr<std::atomic<size_t>> backlog;
+    };
+
+    /**
+     * @brief: 一次成功建立的TCP连接的状态，由读写协程共享，连接断开后整体废弃并在重连时重新创建
+    */
+    struct Session
+    {
+        Session(asio::any_io_executor executor, size_t write_queue_size, size_t stream_queue_size,
+            std::shared_ptr<util::BufferPool<util::SegmentedBuffer>> request_buffers, std::shared_ptr<util::BufferPool<std::string>> response_buffers)
+            : socket(executor), write_channel(executor, write_queue_size), stream_queue_size(stream_queue_size),
+              request_buffers(std::move(request_buffers)), response_buffers(std::move(response_buffers))
+        {
+        }
+
+        /**
+         * @brief: 登记一个等待响应的请求，连接已断开时返回false
+         * @param backlog: 流式调用的未读响应包计数，普通调用为空
+        */
+        bool add_pending_call(uint64_t request_id, std::shared_ptr<ResponseChannel> response_channel, std::shared_ptr<std::atomic<size_t>> backlog = nullptr)
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (!alive) {
+                return false;
+            }
+            pending_calls[request_id] = PendingCall {std::move(response_channel), std::move(backlog)};
+            return true;
+        }
+
+        void remove_pending_call(uint64_t request_id)
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            pending_calls.erase(request_id);
+        }
+
+        /**
+         * @brief: 把响应交给对应的等待者，找不到等待者（例如已超时放弃）时直接丢弃
+         * @note: 读协程由连接上的全部请求共用，不能因为某个流式调用的调用方暂未读取而挂起，否则该调用方在同一连接上
+         *        发起的其他请求将永远收不到响应。因此未读响应包达到stream_queue_size的流式调用直接以错误结束，
+         *        该调用之后到达的响应包被丢弃，连接和其他调用不受影响
+        */
+        void dispatch_response(uint64_t request_id, uint32_t flags, std::string response_str)
+        {
+            PendingCall call;
+            bool overflow = false;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                auto iter = pending_calls.find(request_id);
+                if (iter == pending_calls.end()) {
+                    return;
+                }
+                call = iter->second;
+                overflow = call.backlog && call.backlog->fetch_add(1, std::memory_order_relaxed) >= stream_queue_size;
+                if (overflow || common_define::IsFinalResponse(flags)) {
+                    pending_calls.erase(iter);
+                }
+            }
+            if (overflow) {
+                // response_channel的容量比stream_queue_size多一个，总能放下这个错误
+                response_buffers->release(std::move(response_str));
+                call.response_channel->try_send(asio::error::no_buffer_space, std::string());
+                return;
+            }
+            call.response_channel->try_send(boost::system::error_code{}, std::move(response_str));
+        }
+
+        /**
+         * @brief: 标记连接失效，并以错误唤醒全部等待中的请求
+        */
+        void shutdown()
+        {
+            std::unordered_map<uint64_t, PendingCall> orphan_calls;
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                if (!alive) {
+                    return;
+                }
+                alive = false;
+                orphan_calls.swap(pending_calls);
+            }
+            write_channel.close();
+            for (auto& [request_id, call] : orphan_calls) {
+                call.response_channel->try_send(asio::error::connection_reset, std::string());
+            }
+        }
+
+        bool is_alive()
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            return alive;
+        }
+
+        stream_socket socket;     // 绑定在连接独占的strand上，只在读写协程中访问
+        WriteChannel write_channel;
+        size_t stream_queue_size = 0;   // 单个流式调用未读响应包数的上限
+        std::shared_ptr<util::BufferPool<util::SegmentedBuffer>> request_buffers;   // 与所属连接共享的缓冲池，连接析构后读写协程仍可安全使用
+        std::shared_ptr<util::BufferPool<std::string>> response_buffers;
+        std::mutex mtx;
+        bool alive = true;
+        std::unordered_map<uint64_t, PendingCall> pending_calls;
+    };
+
+    /**
+     * @brief: 流式调用的响应包来源，由读协程把该请求的响应包依次投递到channel中。提前销毁时注销等待并关闭channel
+    */
+    class SessionFrameSource : public ResponseFrameSource
+    {
+    public:
+        SessionFrameSource(std::shared_ptr<Session> session, uint64_t request_id, std::shared_ptr<ResponseChannel> response_channel,
+            std::shared_ptr<std::atomic<size_t>> backlog)
+            : session(std::move(session)), request_id(request_id), response_channel(std::move(response_channel)), backlog(std::move(backlog))
+        {
+        }
+
+        ~SessionFrameSource()
+        {
+            session->remove_pending_call(request_id);
+            response_channel->close();
+        }
+
+        awaitable<std::string> next_frame() override
+        {
+            boost::system::error_code ec;
+            std::string response_str = co_await response_channel->async_receive(redirect_error(use_awaitable, ec));
+            if (ec) {
+                throw boost::system::system_error(ec);
+            }
+            backlog->fetch_sub(1, std::memory_order_relaxed);
+            co_return response_str;
+        }
+
+    private:
+        std::shared_ptr<Session> session;
+        uint64_t request_id = 0;
+        std::shared_ptr<ResponseChannel> response_channel;
+        std::shared_ptr<std::atomic<size_t>> backlog;
+    };
+
+public:
+    /**
+     * @param write_queue_size: 等待写出的请求数上限，达到上限时发起请求的协程挂起
+     * @param stream_queue_size: 单个流式调用在客户端缓存的未读响应包数上限，超过时该流式调用以asio::error::no_buffer_space结束
+    */
+    MultiplexTCPConnection(std::string host, std::string port, boost::asio::io_context& ioc, size_t write_queue_size = 1024, size_t stream_queue_size = 1024)
+        : TCPConnectionBase(host, port), io_context(ioc), connect_gate(ioc.get_executor(), 1), write_queue_size(write_queue_size), stream_queue_size(stream_queue_size)
+    {
+        connect_gate.try_send(boost::system::error_code{});
+    }
+
+    ~MultiplexTCPConnection()
+    {
+        if (auto session = current_session()) {
+            session->shutdown();
+            asio::post(session->socket.get_executor(), [session] {
+                boost::system::error_code ec;
+                session->socket.close(ec);
+            });
+        }
+    }
+
+    /**
+     * @brief: 建立连接并启动读写协程。多个协程同时重连时只有第一个会真正发起连接
+    */
+    awaitable<void> async_connect() override
+    {
+        // connect_gate中只有一个令牌，充当异步互斥锁
+        co_await connect_gate.async_receive(use_awaitable);
+        struct GateGuard
+        {
+            GateChannel& gate;
+            ~GateGuard() { gate.try_send(boost::system::error_code{}); }
+        } gate_guard {connect_gate};
+
+        if (auto session = current_session(); session && session->is_alive()) {
+            co_return;
+        }
+
+        auto session = std::make_shared<Session>(asio::make_strand(io_context), write_queue_size, stream_queue_size, request_buffers, response_buffers);
+        co_await async_connect_stream(session->socket, host, port);
+        co_await async_negotiate_compression(session->socket);
+        co_spawn(session->socket.get_executor(), read_responses(session), detached);
+        co_spawn(session->socket.get_executor(), write_requests(session), detached);
+        {
+            std::lock_guard<std::mutex> lock(session_mtx);
+            this->session = session;
+        }
+    }
+
+    awaitable<std::string> make_async_tcp_request(uint64_t request_id, util::SegmentedBuffer tcp_request) override
+    {
+        auto session = current_session();
+        auto response_channel = std::make_shared<ResponseChannel>(co_await this_coro::executor, 1);
+        if (!session || !session->add_pending_call(request_id, response_channel)) {
+            throw std::runtime_error("connection is not established");
+        }
+        compress_request(tcp_request);
+
+        boost::system::error_code ec;
+        co_await session->write_channel.async_send(boost::system::error_code{}, std::move(tcp_request), redirect_error(use_awaitable, ec));
+        if (ec) {
+            session->remove_pending_call(request_id);
+            throw boost::system::system_error(ec);
+        }
+
+        std::string response_str = co_await response_channel->async_receive(redirect_error(use_awaitable, ec));
+        if (ec) {
+            // 等待被取消（例如超过截止时间）时注销等待，之后到达的响应直接丢弃
+            session->remove_pending_call(request_id);
+            throw boost::system::system_error(ec);
+        }
+        co_return response_str;
+    }
+
+    /**
+     * @note: 调用方读取前收到的响应包缓存在客户端，最多stream_queue_size个，超过时该流式调用失败。
+     *        调用方读取明显慢于server产生结果时，可以改用AsyncTCPConnection，由TCP流量控制限制server的发送速度
+    */
+    awaitable<std::unique_ptr<ResponseFrameSource>> make_async_tcp_stream(uint64_t request_id, util::SegmentedBuffer tcp_request) override
+    {
+        auto session = current_session();
+        // 多出的一个位置留给超出上限时的错误
+        auto response_channel = std::make_shared<ResponseChannel>(co_await this_coro::executor, stream_queue_size + 1);
+        auto backlog = std::make_shared<std::atomic<size_t>>(0);
+        if (!session || !session->add_pending_call(request_id, response_channel, backlog)) {
+            throw std::runtime_error("connection is not established");
+        }
+        auto source = std::make_unique<SessionFrameSource>(session, request_id, response_channel, backlog);
+        compress_request(tcp_request);
+
+        boost::system::error_code ec;
+        co_await session->write_channel.async_send(boost::system::error_code{}, std::move(tcp_request), redirect_error(use_awaitable, ec));
+        if (ec) {
+            throw boost::system::system_error(ec);
+        }
+        co_return source;
+    }
+
+    /**
+     * @brief: 连接当前是否可用
+    */
+    bool is_connected()
+    {
+        auto session = current_session();
+        return session && session->is_alive();
+    }
+
+private:
+    std::shared_ptr<Session> current_session()
+    {
+        std::lock_guard<std::mutex> lock(session_mtx);
+        return session;
+    }
+
+    /**
+     * @brief: 连接的写协程，把各请求协程投递的请求依次写入socket
+    */
+    static awaitable<void> write_requests(std::shared_ptr<Session> session)
+    {
+        for (;;)
+        {
+            boost::system::error_code ec;
+            util::SegmentedBuffer tcp_request = co_await session->write_channel.async_receive(redirect_error(use_awaitable, ec));
+            if (ec) {
+                break;
+            }
+            co_await boost::asio::async_write(session->socket, tcp_request.buffers(), redirect_error(use_awaitable, ec));
+            if (ec) {
+                LOG_WARN("multiplex connection write failed with {}", ec.message());
+                break;
+            }
+            session->request_buffers->release(std::move(tcp_request));
+        }
+        session->shutdown();
+        boost::system::error_code ec;
+        session->socket.close(ec);
+    }
+
+    /**
+     * @brief: 连接的读协程，持续读取响应并按request_id分发
+    */
+    static awaitable<void> read_responses(std::shared_ptr<Session> session)
+    {
+        try
+        {
+            for (;;)
+            {
+                std::string response_str = co_await async_read_response(session->socket, *session->response_buffers);
+                common_define::TCPResponseView tcp_response = common_define::ParseResponseView(response_str);
+                session->dispatch_response(tcp_response.request_id, tcp_response.flags, std::move(response_str));
+            }
+        }
+        catch (std::exception& e)
+        {
+            LOG("multiplex connection closed: {}", e.what());
+        }
+        session->shutdown();
+        boost::system::error_code ec;
+        session->socket.close(ec);
+    }
+
+    boost::asio::io_context& io_context;
+    GateChannel connect_gate;   // 容量为1的channel，用作串行化重连的异步锁
+    size_t write_queue_size = 0;
+    size_t stream_queue_size = 0;
+    std::mutex session_mtx;
+    std::shared_ptr<Session> session;
+};
+
+/**
+ * @brief: ConnectionPool的配置项
+*/
+struct ConnectionPoolOptions
+{
+    size_t min_connections = 1;
+    size_t max_connections = 8;
+    size_t grow_threshold = 64;     // 单条连接的在途请求数达到该值时视为繁忙
+    std::chrono::milliseconds idle_timeout {30000};
+    std::chrono::milliseconds maintenance_interval {1000};  // 后台重连及回收空闲连接的检查周期
+    std::chrono::milliseconds connect_timeout {1000};       // 单条连接建立（包括压缩协商）的超时时间，超时视为连接失败
+};
+
+/**
+ * @class ConnectionPool: 到同一server的多条MultiplexTCPConnection组成的连接池，对外提供与单条连接相同的async_struct_rpc_request接口
+ * @note: 每次请求选取当前在途请求最少的可用连接；所有连接的在途请求数都达到grow_threshold时新增连接，
+ *        空闲超过idle_timeout的连接会被回收直到只剩min_connections条。断开的连接由后台协程重连，请求失败时直接换一条可用连接重试
+*/
+class ConnectionPool : public TCPConnectionBase
+{
+public:
+    using Options = ConnectionPoolOptions;
+
+private:
+    struct Member
+    {
+        std::shared_ptr<MultiplexTCPConnection> conn;
+        std::atomic<size_t> inflight {0};
+        std::atomic<int64_t> last_used {0};    // 最近一次请求结束的steady_clock时间，单位ms
+        std::atomic<bool> connecting {false};
+    };
+
+    /**
+     * @brief: 占用池中一条连接的流式调用响应包来源，销毁时归还连接
+    */
+    struct PooledFrameSource : public ResponseFrameSource
+    {
+        explicit PooledFrameSource(std::shared_ptr<Member> member) : member(std::move(member)) {}
+
+        ~PooledFrameSource()
+        {
+            source.reset();
+            member->last_used = now_ms();
+            member->inflight.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        awaitable<std::string> next_frame() override
+        {
+            co_return co_await source->next_frame();
+        }
+
+        std::shared_ptr<Member> member;
+        std::unique_ptr<ResponseFrameSource> source;
+    };
+
+    /**
+     * @brief: 连接池状态，由连接池对象和后台维护协程共享
+    */
+    struct State
+    {
+        std::mutex mtx;
+        std::vector<std::shared_ptr<Member>> members;
+        std::atomic<bool> stopped {false};
+    };
+
+public:
+    /**
+     * @param compression: 各成员连接的压缩配置，成员连接在构造时复制该配置，因此需要在这里传入而不是构造后修改compression
+    */
+    ConnectionPool(std::string host, std::string port, boost::asio::io_context& ioc, Options options = Options(), CompressionOptions compression = {})
+        : TCPConnectionBase(host, port), io_context(ioc), options(options), state(std::make_shared<State>())
+    {
+        this->compression = std::move(compression);
+        this->options.max_connections = std::max<size_t>(1, std::max(options.min_connections, options.max_connections));
+        for (size_t i = 0; i < this->options.min_connections; ++i) {
+            state->members.push_back(make_member());
+        }
+        co_spawn(io_context, maintain(state, this->options), detached);
+    }
+
+    ~ConnectionPool()
+    {
+        state->stopped = true;
+    }
+
+    /**
+     * @brief: 保证池中至少有一条可用连接。普通的断线重连由后台协程完成，只有全部连接都不可用时请求方才会等待连接建立
+    */
+    awaitable<void> async_connect() override
+    {
+        std::shared_ptr<Member> member;
+        {
+            std::lock_guard<std::mutex> lock(state->mtx);
+            for (auto& candidate : state->members) {
+                if (candidate->conn->is_connected()) {
+                    co_return;
+                }
+            }
+            if (state->members.empty()) {
+                state->members.push_back(make_member());
+            }
+            member = state->members.front();
+        }
+        co_await member->conn->async_connect();
+    }
+
+    awaitable<std::string> make_async_tcp_request(uint64_t request_id, util::SegmentedBuffer tcp_request) override
+    {
+        std::shared_ptr<Member> member = checkout();
+        if (!member) {
+            throw std::runtime_error("no available connection in pool");
+        }
+        struct CheckoutGuard
+        {
+            Member& member;
+            ~CheckoutGuard()
+            {
+                member.last_used = now_ms();
+                member.inflight.fetch_sub(1, std::memory_order_relaxed);
+            }
+        } checkout_guard {*member};
+
+        try
+        {
+            co_return co_await member->conn->make_async_tcp_request(request_id, std::move(tcp_request));
+        }
+        catch (std::exception& e)
+        {
+            // 连接已失效，交给后台重连，本次失败由调用方换一条连接重试
+            if (!member->conn->is_connected()) {
+                co_spawn(io_context, reconnect(member, options.connect_timeout), detached);
+            }
+            throw;
+        }
+    }
+
+    awaitable<std::unique_ptr<ResponseFrameSource>> make_async_tcp_stream(uint64_t request_id, util::SegmentedBuffer tcp_request) override
+    {
+        std::shared_ptr<Member> member = checkout();
+        if (!member) {
+            throw std::runtime_error("no available connection in pool");
+        }
+        // 流式调用在读完或放弃之前一直计入所用连接的在途请求数
+        auto source = std::make_unique<PooledFrameSource>(member);
+        try
+        {
+            source->source = co_await member->conn->make_async_tcp_stream(request_id, std::move(tcp_request));
+        }
+        catch (std::exception& e)
+        {
+            if (!member->conn->is_connected()) {
+                co_spawn(io_context, reconnect(member, options.connect_timeout), detached);
+            }
+            throw;
+        }
+        co_return source;
+    }
+
+    /**
+     * @brief: 当前池中的连接数
+    */
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(state->mtx);
+        return state->members.size();
+    }
+
+private:
+    static int64_t now_ms()
+    {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    std::shared_ptr<Member> make_member()
+    {
+        auto member = std::make_shared<Member>();
+        member->conn = std::make_shared<MultiplexTCPConnection>(host, port, io_context);
+        share_buffer_pools(*member->conn);
+        share_compression(*member->conn);
+        member->last_used = now_ms();
+        return member;
+    }
+
+    /**
+     * @brief: 选出在途请求最少的可用连接并占用它。全部可用连接都繁忙、没有正在建立的连接且未达到连接数上限时，新增一条连接在后台建立
+     * @note: 没有可用连接时（启动或server故障后）不扩容，由已有连接的重连恢复，避免突发的请求把连接数直接推到上限
+    */
+    std::shared_ptr<Member> checkout()
+    {
+        std::shared_ptr<Member> best;
+        std::shared_ptr<Member> new_member;
+        {
+            std::lock_guard<std::mutex> lock(state->mtx);
+            bool any_connecting = false;
+            for (auto& member : state->members) {
+                any_connecting = any_connecting || member->connecting;
+                if (member->conn->is_connected() && (!best || member->inflight < best->inflight)) {
+                    best = member;
+                }
+            }
+            bool busy = best ? best->inflight >= options.grow_threshold : state->members.empty();
+            if (busy && !any_connecting && state->members.size() < options.max_connections) {
+                new_member = make_member();
+                // 在锁内标记为正在连接，后续请求在连接建立前不会再次扩容
+                new_member->connecting = true;
+                state->members.push_back(new_member);
+            }
+            if (best) {
+                best->inflight.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        if (new_member) {
+            co_spawn(io_context, reconnect(new_member, options.connect_timeout, true), detached);
+        }
+        return best;
+    }
+
+    /**
+     * @brief: 在后台建立或重建单条连接，同一连接同时只会有一个重连协程。超过connect_timeout时取消连接，由下一轮维护重试
+     * @param claimed: 调用方已经把connecting置为true
+    */
+    static awaitable<void> reconnect(std::shared_ptr<Member> member, std::chrono::milliseconds connect_timeout, bool claimed = false)
+    {
+        using namespace boost::asio::experimental::awaitable_operators;
+        if (!claimed && member->connecting.exchange(true)) {
+            co_return;
+        }
+        try
+        {
+            steady_timer timer(co_await this_coro::executor);
+            timer.expires_after(connect_timeout);
+            auto result = co_await (member->conn->async_connect() || timer.async_wait(use_awaitable));
+            if (result.index() == 1) {
+                throw std::runtime_error("connect timeout");
+            }
+        }
+        catch (std::exception& e)
+        {
+            LOG_WARN("connection pool failed to connect {}:{} with {}", member->conn->host, member->conn->port, e.what());
+        }
+        member->connecting = false;
+    }
+
+    /**
+     * @brief: 后台维护协程，周期性地重连断开的连接并回收空闲连接，连接池析构后退出
+     * @note: 各连接的重连在独立的协程中进行，无响应的server不会阻塞空闲连接的回收和其他连接的恢复
+    */
+    static awaitable<void> maintain(std::shared_ptr<State> state, Options options)
+    {
+        auto executor = co_await this_coro::executor;
+        steady_timer timer(executor);
+        while (!state->stopped)
+        {
+            std::vector<std::shared_ptr<Member>> broken;
+            {
+                std::lock_guard<std::mutex> lock(state->mtx);
+                int64_t idle_deadline = now_ms() - options.idle_timeout.count();
+                auto& members = state->members;
+                for (auto iter = members.begin(); iter != members.end();) {
+                    Member& member = **iter;
+                    if (members.size() > options.min_connections && member.inflight == 0 && !member.connecting && member.last_used < idle_deadline) {
+                        iter = members.erase(iter);
+                        continue;
+                    }
+                    if (!member.conn->is_connected()) {
+                        broken.push_back(*iter);
+                    }
+                    ++iter;
+                }
+            }
+            for (auto& member : broken) {
+                if (!member->connecting) {
+                    co_spawn(executor, reconnect(member, options.connect_timeout), detached);
+                }
+            }
+            timer.expires_after(options.maintenance_interval);
+            co_await timer.async_wait(use_awaitable);
+        }
+    }
+
+    boost::asio::io_context& io_context;
+    Options options;
+    std::shared_ptr<State> state;
 };
 
-}
\ No newline at end of file
+}
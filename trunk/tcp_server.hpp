@@ -3,14 +3,25 @@
 #include <boost/asio.hpp>
 #include <boost/asio/awaitable.hpp>
 #include <boost/asio/experimental/awaitable_operators.hpp>  // boost requirement: 1.80.0
+#include <boost/asio/experimental/concurrent_channel.hpp>
 #include <iostream>
 #include <string>
 #include <string_view>
 #include <memory>
 #include <thread>
-#include <map>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <mutex>
+#include <filesystem>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #include "common_define.hpp"
+#include "server_metrics.hpp"
+#include "response_cache.hpp"
 #include "utils/trait_helper/trait_helper.hpp"
 #include "utils/logger.hpp"
 
@@ -22,32 +33,143 @@ namespace struct_rpc
 class TCPServer
 {
     using tcp = ip::tcp;
-    using TCPProcessCoroutine = std::function<asio::awaitable<std::string>(std::string_view)>;
-    using TCPProcessFunc = std::function<std::string(std::string_view)>;
-    using TCPProcessCoroutineMap = std::map<std::string_view, TCPProcessCoroutine>;
-    using TCPProcessFuncMap = std::map<std::string_view, TCPProcessFunc>;
 public:
-    TCPServer(uint32_t thread_num, uint32_t port = 8080) : thread_num(thread_num), port(port), thread_pool(thread_num)
+    /**
+     * @brief: server的线程模型
+     * @enum SHARED_IO_CONTEXT: 全部线程运行同一个io_context，协程可能在不同线程间迁移
+     * @enum IO_CONTEXT_PER_THREAD: 每个线程运行独立的io_context并尽量绑定到固定的CPU核心，每个io_context有各自的SO_REUSEPORT acceptor，
+     *       连接及其上的全部请求始终在同一个线程中处理，避免多线程争用同一个调度器，也允许协程使用ThreadLocalSingleton
+    */
+    enum class ThreadModel
+    {
+        SHARED_IO_CONTEXT = 0,
+        IO_CONTEXT_PER_THREAD = 1,
+    };
+
+    TCPServer(uint32_t thread_num, uint32_t port = 8080, ThreadModel thread_model = ThreadModel::SHARED_IO_CONTEXT)
+        : thread_num(thread_num), port(port), thread_model(thread_model), thread_pool(thread_num)
     {
     }
 
     void Start()
     {
-        tcp::endpoint endpoint(tcp::v4(), port);
-        tcp::acceptor acceptor(io_ctx, endpoint);
-        co_spawn(io_ctx, acceptor_coroutine(std::move(acceptor)), detached);
-        signal_set signals(io_ctx, SIGINT, SIGTERM);
+        prepare_handlers();
+        MetricsRegistry::getInstance().add(&metrics);
+
+        // step 1. 创建io_context：共享模式下只有一个，由全部线程运行；独占模式下每个线程一个
+        size_t context_num = thread_model == ThreadModel::IO_CONTEXT_PER_THREAD ? thread_num : 1;
+        {
+            std::lock_guard<std::mutex> lock(lifecycle_mtx);
+            for (size_t i = 0; i < context_num; ++i) {
+                io_contexts.push_back(std::make_unique<io_context>(context_num == 1 ? static_cast<int>(thread_num) : 1));
+                if (stop_requested) {
+                    io_contexts.back()->stop();
+                }
+            }
+        }
+
+        // step 2. 创建acceptor。独占模式下每个io_context各自监听同一端口，由内核通过SO_REUSEPORT分发连接；
+        //         不支持SO_REUSEPORT的平台上退化为单个acceptor把连接轮流分配给各个io_context
+        std::vector<io_context*> all_contexts;
+        for (auto& ctx : io_contexts) {
+            all_contexts.push_back(ctx.get());
+        }
+#ifdef SO_REUSEPORT
+        for (auto& ctx : io_contexts) {
+            co_spawn(*ctx, acceptor_coroutine(make_acceptor(*ctx, context_num > 1), {ctx.get()}), detached);
+        }
+#else
+        co_spawn(*io_contexts[0], acceptor_coroutine(make_acceptor(*io_contexts[0], false), all_contexts), detached);
+#endif
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+        for (const std::string& path : unix_socket_paths) {
+            co_spawn(*io_contexts[0], acceptor_coroutine(make_unix_acceptor(*io_contexts[0], path), all_contexts), detached);
+        }
+#endif
+#ifdef __linux__
+        for (const std::string& path : shm_socket_paths) {
+            co_spawn(*io_contexts[0], acceptor_coroutine(make_unix_acceptor(*io_contexts[0], path), all_contexts, true), detached);
+        }
+#endif
+
+        signal_set signals(*io_contexts[0], SIGINT, SIGTERM);
         signals.async_wait([&](auto, auto)
-                           { io_ctx.stop(); });
-        for (int i = 0; i < thread_num; ++i)
+                           {
+                               for (auto& ctx : io_contexts) {
+                                   ctx->stop();
+                               }
+                           });
+        for (uint32_t i = 0; i < thread_num; ++i)
         {
-            boost::asio::post(thread_pool, [&]
-                              { io_ctx.run(); });
+            boost::asio::post(thread_pool, [this, i, context_num]
+                              {
+                                  if (context_num > 1) {
+                                      pin_current_thread(i);
+                                  }
+                                  MethodMetrics::bind_current_thread(i);
+                                  io_contexts[i % context_num]->run();
+                              });
         }
         thread_pool.join();
+        if (blocking_pool) {
+            blocking_pool->join();
+        }
+        MetricsRegistry::getInstance().remove(&metrics);
+        for (const auto& paths : {unix_socket_paths, shm_socket_paths}) {
+            for (const std::string& path : paths) {
+                std::error_code ec;
+                std::filesystem::remove(path, ec);
+            }
+        }
         LOG("server stopped");
     }
 
+    /**
+     * @brief: 停止server的事件循环，Start()在全部工作线程退出后返回。可以从其他线程调用，例如在同一进程内启动server的压测程序
+    */
+    void Stop()
+    {
+        std::lock_guard<std::mutex> lock(lifecycle_mtx);
+        stop_requested = true;
+        for (auto& ctx : io_contexts) {
+            ctx->stop();
+        }
+    }
+
+    /**
+     * @brief: 在调用方的协程中直接处理一个完整的请求包，不经过socket和连接的读写队列，供同一进程内的LocalConnection使用
+     * @param request_str: 完整的请求包（包含开头的total_size），处理结束前需保持有效
+     * @return: 完整的响应包，处理函数抛出异常时与经TCP调用时一样返回RET_SERVER_EXCEPTION
+     * @note: 不受SetLimits中连接数和在途请求数的限制；流式函数和ThreadLocalSingleton的协程函数不支持本地调用，返回RET_SERVER_EXCEPTION。
+     *        server不需要已经Start
+    */
+    awaitable<util::SegmentedBuffer> HandleLocalRequest(std::string_view request_str)
+    {
+        prepare_handlers();
+        auto received_time = std::chrono::steady_clock::now();
+        common_define::TCPRequestView tcp_request = common_define::ParseRequestView(request_str);
+        util::SegmentedBuffer response;
+        try
+        {
+            co_await process_request(tcp_request, response, RequestContext {nullptr, Deadline::from_timeout_us(tcp_request.timeout_us), received_time, false, true});
+        }
+        catch (std::exception& e)
+        {
+            LOG_ERROR("server process exception {}", e.what());
+            common_define::MakeErrorResponse(response, tcp_request.request_id, common_define::RetCode::RET_SERVER_EXCEPTION);
+        }
+        co_return response;
+    }
+
+    /**
+     * @brief: Func是否已注册到本server
+    */
+    template <auto Func>
+    bool IsRegistered() const
+    {
+        return find_handler(trait_helper::struct_rpc_func_hash<Func>()) != nullptr;
+    }
+
     /**
      * @brief: 批量向server注册RPC处理函数
      * @param Funcs: 可变数量非类型模板参数，期望传入对应的函数指针
@@ -55,39 +177,436 @@ public:
     template <auto... Funcs>
     constexpr void RegisterServerFunctions()
     {
-        (RegisterSingleFunction<Funcs>(process_coroutine_map, process_function_map), ...);
+        (RegisterSingleFunction<Funcs>(), ...);
+    }
+
+    /**
+     * @brief: server的流量控制限制。超出请求数限制的请求不会被执行，直接返回RET_SERVER_OVERLOADED，server内存占用不随负载无限增长
+    */
+    struct Limits
+    {
+        size_t max_connections = 10000;             // 同时保持的连接数上限，超过后新接受的连接直接关闭
+        size_t max_inflight_per_connection = 1024;  // 单条连接上已读取但尚未写回响应的请求数上限
+        size_t max_inflight_requests = 65536;       // 整个server正在处理的请求数上限
+        size_t max_frame_size = 64 << 20;           // 单个请求包的长度上限，超过时视为非法请求并关闭连接
+    };
+
+    /**
+     * @brief: 设置流量控制限制，需要在Start()之前调用
+    */
+    void SetLimits(const Limits& limits)
+    {
+        this->limits = limits;
+    }
+
+    /**
+     * @brief: 在TCP端口之外再监听一个Unix domain socket，需要在Start()之前调用。同一主机上的客户端以"unix:路径"作为host连接，
+     *        不经过TCP协议栈。启动时删除path处残留的socket文件，server停止后删除该文件
+    */
+    void ListenUnixSocket(std::string path)
+    {
+        unix_socket_paths.push_back(std::move(path));
+    }
+
+    /**
+     * @brief: 在path处的Unix domain socket上接受共享内存连接（ShmConnection），需要在Start()之前调用，仅支持Linux。
+     *        该socket只用于交换共享内存和eventfd，之后请求和响应经共享内存环形队列传递，见util::ShmStream
+    */
+    void ListenSharedMemory(std::string path)
+    {
+        shm_socket_paths.push_back(std::move(path));
+    }
+
+    /**
+     * @brief: 设置server支持的压缩算法，需要在Start()之前调用。客户端连接时发送其支持的codec列表，server选出codecs中也包含的第一个，
+     *        之后该连接上不小于min_size的响应包被压缩。是否解压由请求包的FLAG_COMPRESSED决定，解压后长度受Limits::max_frame_size限制
+    */
+    void SetCompression(CompressionOptions options)
+    {
+        compression = std::move(options);
+    }
+
+    /**
+     * @brief: 设置阻塞线程池，需要在Start()之前调用
+     * @param thread_num: 执行rpc_blocking函数的线程数
+     * @param max_queue: 正在执行和排队等待的阻塞调用总数上限，超过后新请求直接返回RET_SERVER_OVERLOADED
+    */
+    void SetBlockingExecutor(uint32_t thread_num, size_t max_queue)
+    {
+        blocking_thread_num = std::max(1u, thread_num);
+        max_blocking_queue = max_queue;
+    }
+
+    /**
+     * @brief: 设置rpc_cacheable函数的响应缓存容量和有效期，需要在Start()之前调用
+    */
+    void SetResponseCache(const ResponseCacheOptions& options)
+    {
+        response_cache = std::make_unique<ResponseCache>(options);
+    }
+
+    /**
+     * @brief: 删除以args调用Func的缓存响应，参数与调用方一样按EncodeParams编码后作为键。可以在server运行期间从任意线程调用
+    */
+    template <auto Func, typename... Args>
+    void InvalidateCache(Args&&... args)
+    {
+        typename trait_helper::function_traits<decltype(Func)>::decayed_arguments_tuple params(std::forward<Args>(args)...);
+        util::SegmentedBuffer encoded;
+        common_define::EncodeParams(params, encoded);
+        response_cache->invalidate(trait_helper::struct_rpc_func_hash<Func>(), encoded.to_string());
+    }
+
+    /**
+     * @brief: 删除Func的全部缓存响应
+    */
+    template <auto Func>
+    void InvalidateFunctionCache()
+    {
+        response_cache->invalidate(trait_helper::struct_rpc_func_hash<Func>());
+    }
+
+    /**
+     * @brief: 清空响应缓存
+    */
+    void ClearCache()
+    {
+        response_cache->clear();
+    }
+
+    /**
+     * @brief: 响应缓存的缓存项数、占用字节数及命中统计
+    */
+    ResponseCacheStats GetCacheStats() const
+    {
+        return response_cache->stats();
+    }
+
+    /**
+     * @brief: 各RPC函数的请求数、收发字节数及排队/处理/发送耗时分位数，可以在server运行期间从任意线程调用
+    */
+    std::vector<MethodStats> GetStats() const
+    {
+        return metrics.snapshot();
     }
 
 private:
+    /**
+     * @brief: 单次请求的处理上下文
+     * @member stream_sink: 流式调用的输出端，为空时（例如批量请求中的子请求）不支持流式调用
+     * @member deadline: 调用方的截止时间，已过期的请求不再执行，协程处理函数超时后被取消，均返回RET_DEADLINE_EXCEEDED
+     * @member received_time: 请求包读取完成的时间，用于统计排队耗时
+     * @member local: 是否来自HandleLocalRequest。本地调用运行在调用方的executor上，不保证固定在单个线程中
+    */
+    struct RequestContext
+    {
+        StreamSink* stream_sink = nullptr;
+        Deadline deadline;
+        std::chrono::steady_clock::time_point received_time = std::chrono::steady_clock::now();
+        bool in_batch = false;      // 是否为批量请求中的子请求，只用于区分不支持流式调用时的错误信息
+        bool local = false;
+    };
+
+    /**
+     * @brief: 创建阻塞线程池和各函数的指标，只执行一次。由Start或第一次本地调用触发，此后不能再注册函数
+    */
+    void prepare_handlers()
+    {
+        std::call_once(prepare_flag, [this] {
+            if (std::any_of(handler_table.begin(), handler_table.end(), [](const auto& entry) { return entry.blocking; })) {
+                blocking_pool = std::make_unique<boost::asio::thread_pool>(blocking_thread_num);
+            }
+            // 每个工作线程一个指标分片，其余线程（包括本地调用方）共用最后一个
+            std::vector<std::string_view> paths;
+            for (const auto& entry : handler_table) {
+                paths.push_back(entry.path);
+            }
+            metrics.init(paths, thread_num + 1);
+            handlers_prepared.store(true, std::memory_order_release);
+        });
+    }
+
+    /**
+     * @brief: 单条客户端连接的会话状态，由读协程、写协程和该连接上所有请求处理协程共享
+     * @param Stream: 连接的字节流，TCP及Unix domain socket连接为stream_socket，共享内存连接为util::ShmStream
+     * @note: 字节流绑定在连接独占的strand上，读写协程均运行在该strand中；请求处理协程运行在连接所属的io_context上，
+     *        只通过线程安全的write_channel把响应交给写协程
+    */
+    template <typename Stream>
+    struct ClientSession
+    {
+        using WriteChannel = asio::experimental::concurrent_channel<void(boost::system::error_code, util::SegmentedBuffer)>;
+
+        ClientSession(Stream stream, asio::any_io_executor request_executor, std::string remote_info, size_t write_queue_size)
+            : stream(std::move(stream)), request_executor(std::move(request_executor)),
+              write_channel(this->stream.get_executor(), write_queue_size), remote_info(std::move(remote_info))
+        {
+        }
+
+        Stream stream;
+        asio::any_io_executor request_executor; // 运行该连接上请求处理协程的executor
+        WriteChannel write_channel;     // 待写回的响应队列
+        std::string remote_info;
+        util::BufferPool<std::string> receive_buffers;          // 请求接收缓冲区，在同一连接的请求间复用
+        util::BufferPool<util::SegmentedBuffer> send_buffers;   // 响应输出缓冲区，在同一连接的请求间复用
+        std::atomic<const util::Codec*> codec {nullptr};       // 与客户端协商得到的压缩算法，未协商时为空
+        size_t compress_min_size = 0;   // 小于该长度的响应包不压缩，协商时设置
+        uint32_t inflight_requests = 0; // 已读取但尚未写回响应的请求数，仅在连接strand上访问
+        bool read_finished = false;     // 读协程是否已退出，仅在连接strand上访问
+
+        /**
+         * @brief: 使用协商得到的压缩算法压缩即将写回的响应包，在请求处理协程中调用，不占用连接的写协程
+        */
+        void compress_frame(util::SegmentedBuffer& frame) const
+        {
+            if (const util::Codec* negotiated = codec.load(std::memory_order_acquire)) {
+                common_define::CompressFrame<common_define::ResponseHeader>(frame, *negotiated, compress_min_size);
+            }
+        }
+    };
+
+    /**
+     * @brief: 流式请求的输出端，数据包与普通响应一样经连接的写队列写回，写队列满时挂起流式函数
+    */
+    template <typename Stream>
+    class SessionStreamSink : public StreamSink
+    {
+    public:
+        SessionStreamSink(std::shared_ptr<ClientSession<Stream>> session, uint64_t request_id) : session(std::move(session)), request_id(request_id) {}
+
+        util::SegmentedBuffer acquire_frame() override
+        {
+            return session->send_buffers.acquire();
+        }
+
+        awaitable<void> send_frame(util::SegmentedBuffer frame) override
+        {
+            common_define::FinishResponse(frame, request_id, static_cast<int32_t>(common_define::RetCode::RET_SUCC), common_define::FLAG_STREAM);
+            session->compress_frame(frame);
+            boost::system::error_code ec;
+            co_await session->write_channel.async_send(boost::system::error_code{}, std::move(frame), redirect_error(use_awaitable, ec));
+            if (ec) {
+                throw boost::system::system_error(ec);
+            }
+        }
+
+    private:
+        std::shared_ptr<ClientSession<Stream>> session;
+        uint64_t request_id = 0;
+    };
+
     /**
      * @brief: 处理单次RPC请求并返回对应结果
+     * @param response: 输出的完整响应包，处理函数把结果直接写入预留了响应头空间的分段缓冲区；流式调用时为结束包
+     * @return: 处理该请求的表项，未注册的路径及批量请求返回nullptr
     */
-    awaitable<common_define::TCPResponse> process_request(common_define::TCPRequest tcp_request)
+    awaitable<const common_define::HandlerEntry*> process_request(common_define::TCPRequestView tcp_request, util::SegmentedBuffer& response, const RequestContext& context)
     {
-        common_define::TCPResponse tcp_response {0, ""};
-        auto coroutine_path_iter = process_coroutine_map.find(tcp_request.path);
-        // C++20标准无法统一协程和普通函数的调用，故放在两个map里分别查询和调用
-        if (coroutine_path_iter != process_coroutine_map.end())
+        if (tcp_request.flags & common_define::FLAG_BATCH) {
+            co_await process_batch(tcp_request, response, context);
+            co_return nullptr;
+        }
+        common_define::ReserveHeader<common_define::ResponseHeader>(response);
+        common_define::RetCode retcode = common_define::RetCode::RET_SUCC;
+        uint32_t flags = common_define::FLAG_NONE;
+        // path非空时为调试/兼容模式，否则直接使用客户端发送的路径哈希查找
+        const common_define::HandlerEntry* handler = tcp_request.path.empty() ? find_handler(tcp_request.path_hash) : find_handler(tcp_request.path);
+        // C++20标准无法统一协程和普通函数的调用，故根据表项中的类型标记分别调用
+        const Deadline& deadline = context.deadline;
+        auto handler_start = std::chrono::steady_clock::now();
+        bool cache_lookup = handler != nullptr && handler->cacheable && !deadline.expired();
+        bool cache_hit = cache_lookup && response_cache->lookup(handler->path_hash, tcp_request.params, response);
+        try
         {
-            auto& func = coroutine_path_iter->second;
-            tcp_response.data = co_await func(tcp_request.params);
-        } else {
-            auto func_path_iter = process_function_map.find(tcp_request.path);
-            if (func_path_iter != process_function_map.end()) {
-                auto& func = func_path_iter->second;
-                tcp_response.data = func(tcp_request.params);
+            if (handler == nullptr) {
+                retcode = common_define::RetCode::RET_NOT_FOUND;
+            } else if (deadline.expired()) {
+                // 调用方已经放弃等待，不再执行处理函数
+                retcode = common_define::RetCode::RET_DEADLINE_EXCEEDED;
+            } else if (cache_hit) {
+                // 命中缓存时响应体已写入response，不解析参数也不调用处理函数
+            } else if (context.local && handler->thread_local_coroutine) {
+                // 本地调用的协程可能在调用方的多个线程之间切换，线程局部的单例对象不安全
+                throw std::runtime_error("coroutine of ThreadLocalSingleton is not supported for local calls");
+            } else if (handler->type == common_define::HandlerType::COROUTINE) {
+                if (!co_await run_until_deadline(handler->coroutine(tcp_request.params, response), deadline)) {
+                    retcode = common_define::RetCode::RET_DEADLINE_EXCEEDED;
+                }
+            } else if (handler->type == common_define::HandlerType::STREAM) {
+                if (context.stream_sink == nullptr) {
+                    // 批量子请求及本地调用没有可以逐个写出响应包的连接
+                    throw std::runtime_error(context.in_batch ? "stream rpc is not allowed in batch request" : "stream rpc is not supported for local calls");
+                }
+                if (!co_await run_until_deadline(handler->stream(tcp_request.params, *context.stream_sink), deadline)) {
+                    retcode = common_define::RetCode::RET_DEADLINE_EXCEEDED;
+                }
+                flags = common_define::FLAG_STREAM | common_define::FLAG_STREAM_END;
+            } else if (handler->blocking) {
+                retcode = co_await run_blocking(handler->func, tcp_request.params, response, deadline, handler_start);
             } else {
-                tcp_response.retcode = static_cast<int32_t>(common_define::RetCode::RET_NOT_FOUND);
+                handler->func(tcp_request.params, response);
             }
         }
-        LOG("succ to process req path={}", tcp_request.path);
-        co_return tcp_response;
+        catch (...)
+        {
+            record_metrics(handler, tcp_request, context.received_time, handler_start, 0, false);
+            throw;
+        }
+        if (retcode == common_define::RetCode::RET_DEADLINE_EXCEEDED) {
+            // 被取消的协程可能已写入部分结果，超时响应只保留响应头
+            response.clear();
+            common_define::ReserveHeader<common_define::ResponseHeader>(response);
+        }
+        if (cache_lookup && !cache_hit && retcode == common_define::RetCode::RET_SUCC) {
+            // 只把响应体拷贝一次到缓存项中
+            std::string body(response.size() - sizeof(common_define::ResponseHeader), '\0');
+            response.read(sizeof(common_define::ResponseHeader), body.data(), body.size());
+            response_cache->insert(handler->path_hash, tcp_request.params, std::move(body));
+        }
+        if (cache_lookup) {
+            MethodMetrics::Shard& shard = metrics.method(handler - handler_table.data()).local_shard();
+            (cache_hit ? shard.cache_hits : shard.cache_misses).fetch_add(1, std::memory_order_relaxed);
+        }
+        LOG_DEBUG("succ to process req path={}", handler ? handler->path : tcp_request.path);
+        common_define::FinishResponse(response, tcp_request.request_id, static_cast<int32_t>(retcode), flags);
+        record_metrics(handler, tcp_request, context.received_time, handler_start, response.size(), retcode == common_define::RetCode::RET_SUCC);
+        co_return handler;
     };
 
     /**
-     * @brief: 进行一个附带超时时间的异步操作。如果超时则关闭socket并返回false
+     * @brief: 记录一次请求的排队耗时、处理耗时及收发字节数，未注册的路径不统计
+    */
+    void record_metrics(const common_define::HandlerEntry* handler, const common_define::TCPRequestView& tcp_request,
+        std::chrono::steady_clock::time_point received_time, std::chrono::steady_clock::time_point handler_start, size_t bytes_out, bool succ)
+    {
+        if (handler == nullptr) {
+            return;
+        }
+        auto handler_end = std::chrono::steady_clock::now();
+        MethodMetrics::Shard& shard = metrics.method(handler - handler_table.data()).local_shard();
+        shard.queue_time.record(std::chrono::duration_cast<std::chrono::nanoseconds>(handler_start - received_time).count());
+        shard.handler_time.record(std::chrono::duration_cast<std::chrono::nanoseconds>(handler_end - handler_start).count());
+        shard.bytes_in.fetch_add(sizeof(common_define::RequestHeader) + tcp_request.path.size() + tcp_request.params.size(), std::memory_order_relaxed);
+        shard.bytes_out.fetch_add(bytes_out, std::memory_order_relaxed);
+        if (!succ) {
+            shard.errors.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * @brief: 处理批量请求，各子请求的子响应按请求中的顺序依次写入同一个响应包
+     * @note: 请求带有FLAG_BATCH_PARALLEL时各子请求在独立的协程中并发执行，否则按顺序执行。单个子请求失败只影响对应的子响应
+    */
+    awaitable<void> process_batch(common_define::TCPRequestView batch_request, util::SegmentedBuffer& response, const RequestContext& context)
+    {
+        std::vector<std::string_view> frames = common_define::SplitFrames(batch_request.params);
+        std::vector<util::SegmentedBuffer> sub_responses(frames.size());
+        // 子请求共用整个批量请求的截止时间和接收时间
+        RequestContext sub_context {nullptr, context.deadline, context.received_time, true, context.local};
+        auto process_sub_request = [this, &frames, &sub_responses, &sub_context](size_t index) -> awaitable<void> {
+            common_define::TCPRequestView sub_request;
+            try
+            {
+                sub_request = common_define::ParseRequestView(frames[index]);
+                if (sub_request.flags & common_define::FLAG_BATCH) {
+                    throw std::runtime_error("nested batch request");
+                }
+                co_await process_request(sub_request, sub_responses[index], sub_context);
+            }
+            catch (std::exception& e)
+            {
+                LOG_ERROR("server process exception {}", e.what());
+                common_define::MakeErrorResponse(sub_responses[index], sub_request.request_id, common_define::RetCode::RET_SERVER_EXCEPTION);
+            }
+        };
+
+        if (batch_request.flags & common_define::FLAG_BATCH_PARALLEL) {
+            // 子协程结束时各自投递一个完成信号，全部收到后才访问子响应
+            using DoneChannel = asio::experimental::concurrent_channel<void(boost::system::error_code)>;
+            auto executor = co_await this_coro::executor;
+            DoneChannel done_channel(executor, std::max<size_t>(1, frames.size()));
+            for (size_t i = 0; i < frames.size(); ++i) {
+                co_spawn(executor, process_sub_request(i), [&done_channel](std::exception_ptr) {
+                    done_channel.try_send(boost::system::error_code{});
+                });
+            }
+            for (size_t i = 0; i < frames.size(); ++i) {
+                co_await done_channel.async_receive(use_awaitable);
+            }
+        } else {
+            for (size_t i = 0; i < frames.size(); ++i) {
+                co_await process_sub_request(i);
+            }
+        }
+
+        common_define::ReserveHeader<common_define::ResponseHeader>(response);
+        for (auto& sub_response : sub_responses) {
+            response.append_owned(std::move(sub_response));
+        }
+        common_define::FinishResponse(response, batch_request.request_id, static_cast<int32_t>(common_define::RetCode::RET_SUCC), common_define::FLAG_BATCH);
+    }
+
+    /**
+     * @brief: 在阻塞线程池中执行普通RPC函数，当前协程挂起等待其完成，IO线程可以继续处理其他请求
+     * @param handler_start: 输出函数在阻塞线程池中开始执行的时间，排队耗时计入请求的排队时间
+     * @return: 排队中的阻塞调用数已达上限时不执行函数，直接返回RET_SERVER_OVERLOADED；排队期间超过截止时间时不执行函数，返回RET_DEADLINE_EXCEEDED
+    */
+    awaitable<common_define::RetCode> run_blocking(void (*func)(std::string_view, util::SegmentedBuffer&), std::string_view params, util::SegmentedBuffer& response,
+        Deadline deadline, std::chrono::steady_clock::time_point& handler_start)
+    {
+        if (blocking_pending.fetch_add(1, std::memory_order_relaxed) >= max_blocking_queue) {
+            blocking_pending.fetch_sub(1, std::memory_order_relaxed);
+            co_return common_define::RetCode::RET_SERVER_OVERLOADED;
+        }
+        struct PendingGuard
+        {
+            std::atomic<size_t>& pending;
+            ~PendingGuard() { pending.fetch_sub(1, std::memory_order_relaxed); }
+        } guard {blocking_pending};
+        // co_spawn到阻塞线程池上执行，完成后当前协程在原executor上恢复；函数抛出的异常会在这里重新抛出
+        bool executed = co_await co_spawn(blocking_pool->get_executor(), [func, params, &response, deadline, &handler_start]() -> awaitable<bool> {
+            handler_start = std::chrono::steady_clock::now();
+            if (deadline.expired()) {
+                co_return false;
+            }
+            func(params, response);
+            co_return true;
+        }, use_awaitable);
+        co_return executed ? common_define::RetCode::RET_SUCC : common_define::RetCode::RET_DEADLINE_EXCEEDED;
+    }
+
+    /**
+     * @brief: 执行协程处理函数直到完成或超过截止时间
+     * @return: 截止时间前完成返回true
+     * @note: 计时器先完成时operator||通过取消槽向处理协程发出取消信号，处理协程当前挂起的异步操作以operation_aborted结束
+    */
+    awaitable<bool> run_until_deadline(awaitable<void> handler, Deadline deadline)
+    {
+        if (!deadline.is_set()) {
+            co_await std::move(handler);
+            co_return true;
+        }
+        using namespace boost::asio::experimental::awaitable_operators;
+        steady_timer timer(co_await this_coro::executor);
+        timer.expires_at(deadline.time_point);
+        auto result = co_await (std::move(handler) || timer.async_wait(use_awaitable));
+        co_return result.index() == 0;
+    }
+
+    /**
+     * @brief: 读取部分数据并把读取的字节数写入bytes，用于配合async_operation_with_timeout分段读取
+    */
+    template <typename Stream>
+    static awaitable<void> read_some_into(Stream& stream, asio::mutable_buffer buffer, size_t& bytes)
+    {
+        bytes = co_await async_read_some(stream, buffer);
+    }
+
+    /**
+     * @brief: 进行一个附带超时时间的异步操作，超时返回false
+     * @note: operator||在任一操作完成后会取消另一个，因此超时后async_op已被取消，不需要额外cancel整个socket（会误伤同一连接上其他读写操作）
     */
-    awaitable<std::pair<bool, std::string>> async_operation_with_timeout(auto&& async_op, tcp::socket& socket, uint32_t timeout_seconds) {
+    awaitable<std::pair<bool, std::string>> async_operation_with_timeout(auto&& async_op, uint32_t timeout_seconds) {
         using namespace boost::asio::experimental::awaitable_operators;
         auto executor = co_await this_coro::executor;
         steady_timer timer(executor);
@@ -97,116 +616,465 @@ private:
         if (result.index() == 0) {
             co_return std::pair{true, ""};
         } else {
-            socket.cancel();
             co_return std::pair{false, "timed out"};
         }
     }
 
     /**
-     * @brief: 用于处理单个 TCP 客户端连接的协程。客户端达到超时时间且无请求会关闭，实现超时自动退出的连接池
+     * @brief: 处理单个请求并把响应投递到连接的写队列。每个请求运行在独立的协程中，慢请求不会阻塞同一连接上的其他请求
+     * @param request_str: 接收缓冲区，请求视图及解析出的视图类型参数都指向该缓冲区，因此由本协程持有直到处理结束
+     * @param received_time: 请求包读取完成的时间
     */
-    awaitable<void> handle_client(tcp::socket socket, uint32_t timeout_seconds = 5)
+    template <typename Stream>
+    awaitable<void> reply_request(std::shared_ptr<ClientSession<Stream>> session, std::string request_str, std::chrono::steady_clock::time_point received_time)
+    {
+        uint64_t request_id = common_define::ParseRequestHeader(request_str).request_id;
+        util::SegmentedBuffer response = session->send_buffers.acquire();
+        SessionStreamSink<Stream> stream_sink(session, request_id);
+        // 请求处理结束后归还全局在途请求名额
+        struct InflightGuard
+        {
+            std::atomic<size_t>& inflight;
+            ~InflightGuard() { inflight.fetch_sub(1, std::memory_order_relaxed); }
+        } inflight_guard {total_inflight_requests};
+        const common_define::HandlerEntry* handler = nullptr;
+        try
+        {
+            // 压缩的请求在处理协程中解压，不占用连接的读协程；解压后才能完整解析path和参数，解析失败时返回RET_SERVER_EXCEPTION
+            common_define::DecompressFrame<common_define::RequestHeader>(request_str, limits.max_frame_size);
+            common_define::TCPRequestView tcp_request = common_define::ParseRequestView(request_str);
+            handler = co_await process_request(tcp_request, response, RequestContext {&stream_sink, Deadline::from_timeout_us(tcp_request.timeout_us), received_time});
+        }
+        catch (std::exception& e)
+        {
+            LOG_ERROR("server process exception {}", e.what());
+            common_define::MakeErrorResponse(response, request_id, common_define::RetCode::RET_SERVER_EXCEPTION);
+        }
+        session->receive_buffers.release(std::move(request_str));
+        session->compress_frame(response);
+
+        auto send_start = std::chrono::steady_clock::now();
+        boost::system::error_code ec;
+        co_await session->write_channel.async_send(boost::system::error_code{}, std::move(response), redirect_error(use_awaitable, ec));
+        if (ec) {
+            LOG("client {} connection closed before response of request {} was queued", session->remote_info, request_id);
+        } else if (handler != nullptr) {
+            metrics.method(handler - handler_table.data()).local_shard().send_time.record(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - send_start).count());
+        }
+    }
+
+    /**
+     * @brief: 连接的写协程，按完成顺序依次写回各请求的响应。响应头、返回值和参数各分段以const_buffer序列一次写出，不做拼接
+    */
+    template <typename Stream>
+    awaitable<void> write_responses(std::shared_ptr<ClientSession<Stream>> session, uint32_t timeout_seconds)
     {
-        auto remote_endpoint = socket.remote_endpoint();
-        std::string remote_info = std::format("host={}, port={}", remote_endpoint.address().to_string(),  std::to_string(remote_endpoint.port()));
-        LOG("connected with client {}", remote_info);
         for (;;)
         {
-            // step 1. 读取TCP请求序列化的头部（包含整个请求包长度信息）
-            size_t total_size;
+            boost::system::error_code ec;
+            util::SegmentedBuffer response = co_await session->write_channel.async_receive(redirect_error(use_awaitable, ec));
+            if (ec) {
+                co_return;
+            }
+
             if (auto [succ, msg] = co_await async_operation_with_timeout(
-                async_read(socket, asio::mutable_buffer(&total_size, sizeof(size_t)), use_awaitable),
-                socket,
+                async_write_all(session->stream, response.buffers()),
                 timeout_seconds
             ); !succ) {
-                LOG("client {} async read msg head failed with {}, destroy this corotine", remote_info, msg);
+                LOG("client {} async write response failed with {}, destroy this corotine", session->remote_info, msg);
+                session->write_channel.close();
+                close_stream(session->stream);
+                co_return;
+            }
+            // 流式调用的中间数据包不结束请求
+            common_define::ResponseHeader header;
+            response.read(0, &header, sizeof(common_define::ResponseHeader));
+            bool is_final = common_define::IsFinalResponse(header.flags);
+            session->send_buffers.release(std::move(response));
+
+            // 读协程已退出且全部响应已写回，连接生命周期结束
+            if (is_final && --session->inflight_requests == 0 && session->read_finished) {
+                session->write_channel.close();
+                co_return;
+            }
+        }
+    }
+
+    /**
+     * @brief: 用于处理单个 TCP 客户端连接的协程。客户端达到超时时间且无请求会关闭，实现超时自动退出的连接池
+     * @note: 本协程只负责持续读取请求，每个请求交给独立的协程处理，响应由写协程按完成顺序写回并通过request_id与请求对应
+    */
+    template <typename Stream>
+    awaitable<void> handle_client(Stream stream, asio::any_io_executor request_executor, std::string remote_info, uint32_t timeout_seconds = 5)
+    {
+        LOG("connected with client {}", remote_info);
+        auto session = std::make_shared<ClientSession<Stream>>(std::move(stream), std::move(request_executor), std::move(remote_info), max_queued_responses);
+        co_spawn(session->stream.get_executor(), write_responses(session, timeout_seconds), detached);
+
+        // 读协程退出时，如果没有未完成的请求则由读协程负责通知写协程退出，否则由写协程写完最后一个响应后自行退出
+        struct ReadFinishedGuard
+        {
+            ClientSession<Stream>& session;
+            ~ReadFinishedGuard()
+            {
+                session.read_finished = true;
+                if (session.inflight_requests == 0) {
+                    session.write_channel.close();
+                }
+            }
+        } read_finished_guard {*session};
+
+        for (;;)
+        {
+            // step 1. 读取TCP请求序列化的头部（包含整个请求包长度信息）。仍有未完成请求时连接不算空闲，超时后继续等待。
+            //         头部可能分多次到达，已读取的字节数在超时后保留，继续等待时从断点续读，不会错位
+            size_t total_size = 0;
+            size_t header_read = 0;
+            while (header_read < sizeof(size_t))
+            {
+                size_t bytes = 0;
+                auto [succ, msg] = co_await async_operation_with_timeout(
+                    read_some_into(session->stream, asio::mutable_buffer(reinterpret_cast<char*>(&total_size) + header_read, sizeof(size_t) - header_read), bytes),
+                    timeout_seconds
+                );
+                if (succ) {
+                    header_read += bytes;
+                    continue;
+                }
+                if (session->inflight_requests > 0 && session->stream.is_open()) {
+                    continue;
+                }
+                LOG("client {} async read msg head failed with {}, destroy this corotine", session->remote_info, msg);
+                co_return;
+            }
+            // 请求长度来自客户端，超过上限时不分配接收缓冲区，直接关闭连接
+            if (total_size > limits.max_frame_size) {
+                LOG_WARN("client {} sent request of {} bytes exceeding max_frame_size {}, close connection", session->remote_info, total_size, limits.max_frame_size);
                 co_return;
             }
 
-            // step 2. 读取整个TCP请求结构体
-            std::string request_str(total_size + sizeof(size_t), '\0');
+            // step 2. 读取整个TCP请求结构体，接收缓冲区从连接的缓冲池中复用
+            std::string request_str = session->receive_buffers.acquire();
+            request_str.resize(total_size + sizeof(size_t));
             std::memcpy(request_str.data(), &total_size, sizeof(size_t));
             if (auto [succ, msg] = co_await async_operation_with_timeout(
-                async_read(socket, asio::mutable_buffer(request_str.data() + sizeof(size_t), total_size), use_awaitable),
-                socket,
+                async_read_exact(session->stream, asio::mutable_buffer(request_str.data() + sizeof(size_t), total_size)),
                 timeout_seconds
             ); !succ) {
-                LOG("client {} async read msg body failed with {}, destroy this corotine",remote_info, msg);
+                LOG("client {} async read msg body failed with {}, destroy this corotine", session->remote_info, msg);
                 co_return;
             }
-            
-            // step 3. 根据请求中编码的path调用对应的RPC函数
-            common_define::TCPResponse tcp_response;
+
+            // step 3. 校验请求头后把接收缓冲区交给独立协程调用对应的RPC函数，不等待其完成即开始读取下一个请求。
+            //         压缩的请求只校验固定请求头，path等由处理协程在解压后解析
+            uint64_t request_id = 0;
+            uint32_t flags = 0;
             try
             {
-                common_define::TCPRequest tcp_request;
-                structbuf::deserializer::ParseFromSV(tcp_request, request_str);
-                tcp_response = co_await process_request(std::move(tcp_request));
+                common_define::RequestHeader header = common_define::ParseRequestHeader(request_str);
+                if (!(header.flags & common_define::FLAG_COMPRESSED)) {
+                    common_define::ParseRequestView(request_str);
+                }
+                request_id = header.request_id;
+                flags = header.flags;
             }
             catch (std::exception& e)
             {
-                LOG("server process exception {}", e.what());
-                tcp_response.retcode = static_cast<int32_t>(common_define::RetCode::RET_SERVER_EXCEPTION);
-            }
-            
-            // step 4. 写回调用结果
-            std::string response_str = structbuf::serializer::SaveToString(tcp_response);
-            if (auto [succ, msg] = co_await async_operation_with_timeout(
-                async_write(socket, asio::buffer(response_str, response_str.size()), use_awaitable),
-                socket,
-                timeout_seconds
-            ); !succ) {
-                LOG("client {} async write response failed with {}, destroy this corotine",remote_info, msg);
+                LOG_WARN("client {} sent malformed request: {}, close connection", session->remote_info, e.what());
                 co_return;
             }
+            ++session->inflight_requests;
+            if (flags & common_define::FLAG_NEGOTIATE) {
+                // 协商请求由读协程直接回复，保证之后读取的请求都能看到协商结果
+                util::SegmentedBuffer response = session->send_buffers.acquire();
+                negotiate_compression(*session, request_str, response);
+                session->receive_buffers.release(std::move(request_str));
+                boost::system::error_code ec;
+                co_await session->write_channel.async_send(boost::system::error_code{}, std::move(response), redirect_error(use_awaitable, ec));
+                if (ec) {
+                    co_return;
+                }
+                continue;
+            }
+            if (!try_admit_request(*session)) {
+                // 超过在途请求数限制的请求不执行，由读协程直接回复RET_SERVER_OVERLOADED。写队列已满时读协程随之挂起，不再读取新请求
+                session->receive_buffers.release(std::move(request_str));
+                util::SegmentedBuffer response = session->send_buffers.acquire();
+                common_define::MakeErrorResponse(response, request_id, common_define::RetCode::RET_SERVER_OVERLOADED);
+                boost::system::error_code ec;
+                co_await session->write_channel.async_send(boost::system::error_code{}, std::move(response), redirect_error(use_awaitable, ec));
+                if (ec) {
+                    co_return;
+                }
+                continue;
+            }
+            co_spawn(session->request_executor, reply_request(session, std::move(request_str), std::chrono::steady_clock::now()), [](std::exception_ptr e) {
+                try {
+                    if (e) { std::rethrow_exception(e); }
+                }
+                catch (std::exception &e) {
+                    LOG_ERROR("reply_request exception {}", e.what());
+                }
+            });
+        }
+    }
+
+    /**
+     * @brief: 从客户端按优先顺序列出的codec中选出server也启用的第一个，记录到连接上并构造协商响应
+     * @note: server未启用压缩或没有共同支持的codec时回复CODEC_NONE，该连接不压缩响应
+    */
+    template <typename Stream>
+    void negotiate_compression(ClientSession<Stream>& session, std::string_view request_str, util::SegmentedBuffer& response)
+    {
+        common_define::TCPRequestView tcp_request = common_define::ParseRequestView(request_str);
+        uint32_t selected = util::CODEC_NONE;
+        for (size_t offset = 0; offset + sizeof(uint32_t) <= tcp_request.params.size(); offset += sizeof(uint32_t)) {
+            uint32_t codec_id;
+            std::memcpy(&codec_id, tcp_request.params.data() + offset, sizeof(uint32_t));
+            if (std::find(compression.codecs.begin(), compression.codecs.end(), codec_id) != compression.codecs.end()
+                && util::CodecRegistry::getInstance().find(codec_id) != nullptr) {
+                selected = codec_id;
+                break;
+            }
+        }
+        session.compress_min_size = compression.min_size;
+        session.codec.store(util::CodecRegistry::getInstance().find(selected), std::memory_order_release);
+        LOG("client {} negotiated compression codec {}", session.remote_info, selected);
+
+        common_define::ReserveHeader<common_define::ResponseHeader>(response);
+        response.append(std::string_view(reinterpret_cast<const char*>(&selected), sizeof(uint32_t)));
+        common_define::FinishResponse(response, tcp_request.request_id, static_cast<int32_t>(common_define::RetCode::RET_SUCC), common_define::FLAG_NEGOTIATE);
+    }
+
+    /**
+     * @brief: 检查连接及整个server的在途请求数是否超过限制，未超过时占用一个全局在途请求名额
+     * @note: 调用前本请求已计入连接的inflight_requests
+    */
+    template <typename Stream>
+    bool try_admit_request(const ClientSession<Stream>& session)
+    {
+        if (session.inflight_requests > limits.max_inflight_per_connection) {
+            return false;
+        }
+        if (total_inflight_requests.fetch_add(1, std::memory_order_relaxed) >= limits.max_inflight_requests) {
+            total_inflight_requests.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief: 创建监听server端口的acceptor
+     * @param reuse_port: 是否开启SO_REUSEPORT，允许多个acceptor监听同一端口
+    */
+    tcp::acceptor make_acceptor(io_context& ctx, bool reuse_port)
+    {
+        tcp::endpoint endpoint(tcp::v4(), port);
+        tcp::acceptor acceptor(ctx);
+        acceptor.open(endpoint.protocol());
+        acceptor.set_option(tcp::acceptor::reuse_address(true));
+#ifdef SO_REUSEPORT
+        if (reuse_port) {
+            using reuse_port_option = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+            acceptor.set_option(reuse_port_option(true));
+        }
+#endif
+        acceptor.bind(endpoint);
+        acceptor.listen();
+        return acceptor;
+    }
+
+    /**
+     * @brief: 把当前线程绑定到指定的CPU核心，失败时只打印日志
+    */
+    static void pin_current_thread(uint32_t index)
+    {
+#ifdef __linux__
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(index % std::max(1u, std::thread::hardware_concurrency()), &cpuset);
+        if (int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset); ret != 0) {
+            LOG_WARN("failed to pin server thread {} to cpu, errno {}", index, ret);
         }
+#endif
     }
 
     /**
      * @brief: acceptor coroutine
+     * @param Acceptor: tcp::acceptor或local::stream_protocol::acceptor，接受的连接统一转换为stream_socket处理
+     * @param worker_contexts: 新连接依次轮流分配到这些io_context上处理
+     * @param shared_memory: 是否为共享内存连接的握手socket，是则先完成util::ShmStream的握手，之后在共享内存上收发请求
     */
-    awaitable<void> acceptor_coroutine(tcp::acceptor acceptor)
+    template <typename Acceptor>
+    awaitable<void> acceptor_coroutine(Acceptor acceptor, std::vector<io_context*> worker_contexts, bool shared_memory = false)
     {
+        size_t next_worker = 0;
         for (;;) {
             try
             {
-                tcp::socket socket = co_await acceptor.async_accept(use_awaitable);
-                co_spawn(io_ctx, handle_client(std::move(socket)), [](std::exception_ptr e) {
+                // 每条连接的socket绑定到所属io_context上独立的strand，保证该连接上的读写协程串行执行
+                io_context& worker = *worker_contexts[next_worker++ % worker_contexts.size()];
+                auto socket = co_await acceptor.async_accept(asio::any_io_executor(asio::make_strand(worker)), use_awaitable);
+                if (active_connections.fetch_add(1, std::memory_order_relaxed) >= limits.max_connections) {
+                    active_connections.fetch_sub(1, std::memory_order_relaxed);
+                    LOG_WARN("connection count reaches max_connections {}, reject new connection", limits.max_connections);
+                    boost::system::error_code ec;
+                    socket.close(ec);
+                    continue;
+                }
+                std::string remote_info = make_remote_info(socket);
+                auto executor = socket.get_executor();
+                stream_socket stream(std::move(socket));
+                co_spawn(executor, serve_stream(std::move(stream), worker.get_executor(), std::move(remote_info), shared_memory), [this](std::exception_ptr e) {
+                    active_connections.fetch_sub(1, std::memory_order_relaxed);
                     try {
                         if (e) { std::rethrow_exception(e); }        
                     }
+                    catch (boost::system::system_error &e) {
+                        // 客户端主动断开连接属于正常情况
+                        if (e.code() == asio::error::eof) {
+                            LOG_DEBUG("client closed connection");
+                        } else {
+                            LOG_ERROR("handle_client exception {}, close connection", e.what());
+                        }
+                    }
                     catch (std::exception &e) {
-                        LOG("handle_client exception {}, close connection", e.what());
+                        LOG_ERROR("handle_client exception {}, close connection", e.what());
                     }
                 });
             } catch (std::exception &e) {
-                LOG("accept with exception {}, skip", e.what());
+                LOG_ERROR("accept with exception {}, skip", e.what());
             }
         }
     }
 
+    /**
+     * @brief: 处理一条已接受的连接，共享内存连接先在socket上完成握手
+    */
+    awaitable<void> serve_stream(stream_socket stream, asio::any_io_executor request_executor, std::string remote_info, bool shared_memory)
+    {
+#ifdef __linux__
+        if (shared_memory) {
+            util::ShmStream shm_stream = co_await util::ShmStream::accept(std::move(stream));
+            co_await handle_client(std::move(shm_stream), std::move(request_executor), std::move(remote_info));
+            co_return;
+        }
+#endif
+        co_await handle_client(std::move(stream), std::move(request_executor), std::move(remote_info));
+    }
+
+    /**
+     * @brief: 生成日志中使用的客户端描述，TCP连接为地址和端口，Unix domain socket连接为socket路径
+    */
+    static std::string make_remote_info(const tcp::socket& socket)
+    {
+        boost::system::error_code ec;
+        auto remote_endpoint = socket.remote_endpoint(ec);
+        if (ec) {
+            return "host=unknown";
+        }
+        return std::format("host={}, port={}", remote_endpoint.address().to_string(), std::to_string(remote_endpoint.port()));
+    }
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+    static std::string make_remote_info(const local::stream_protocol::socket& socket)
+    {
+        boost::system::error_code ec;
+        auto local_endpoint = socket.local_endpoint(ec);
+        return std::format("unix={}", ec ? std::string("unknown") : local_endpoint.path());
+    }
+
+    /**
+     * @brief: 创建监听Unix domain socket的acceptor，先删除path处残留的socket文件
+    */
+    static local::stream_protocol::acceptor make_unix_acceptor(io_context& ctx, const std::string& path)
+    {
+        std::error_code ec;
+        std::filesystem::remove(path, ec);
+        return local::stream_protocol::acceptor(ctx, local::stream_protocol::endpoint(path));
+    }
+#endif
+
+    /**
+     * @brief: 根据请求路径查找处理函数：计算一次路径哈希后在有序表中二分查找，命中后只需一次字符串比较校验
+     * @return: 未注册的路径返回nullptr
+    */
+    const common_define::HandlerEntry* find_handler(std::string_view path) const
+    {
+        const common_define::HandlerEntry* handler = find_handler(trait_helper::fnv1a_hash(path));
+        if (handler == nullptr || handler->path != path) {
+            return nullptr;
+        }
+        return handler;
+    }
+
+    /**
+     * @brief: 根据路径哈希查找处理函数。注册时已保证不同路径的哈希不冲突，因此无需再比较路径字符串
+    */
+    const common_define::HandlerEntry* find_handler(uint64_t path_hash) const
+    {
+        auto iter = std::lower_bound(handler_table.begin(), handler_table.end(), path_hash,
+            [](const common_define::HandlerEntry& entry, uint64_t hash) { return entry.path_hash < hash; });
+        if (iter == handler_table.end() || iter->path_hash != path_hash) {
+            return nullptr;
+        }
+        return &*iter;
+    }
+
     /**
      * @brief: 注册单个RPC函数
      * @param Func: RPC函数指针
+     * @note: 表项在编译期生成，注册时按路径哈希有序插入处理函数表。不同路径哈希冲突时抛出异常。
+     *        指标按处理函数表中的位置索引，Start或第一次本地调用之后再注册会打乱位置，因此抛出异常
     */
     template <auto Func>
-    void RegisterSingleFunction(TCPProcessCoroutineMap& process_coroutine_map, TCPProcessFuncMap& process_func_map)
+    void RegisterSingleFunction()
     {
-        constexpr std::string_view path = trait_helper::struct_rpc_func_path<Func>();
-        if constexpr (trait_helper::is_asio_coroutine<decltype(Func)>) {
-            process_coroutine_map[path] = common_define::CommonCoroutineTemplate<Func>;
+        if (handlers_prepared.load(std::memory_order_acquire)) {
+            throw std::logic_error("rpc functions must be registered before Start or the first local call");
+        }
+        constexpr common_define::HandlerEntry entry = common_define::MakeHandlerEntry<Func>();
+        // 协程在暂停点前后可能被不同线程执行，只有连接固定在单个线程上时才能安全使用ThreadLocalSingleton
+        if (entry.thread_local_coroutine && thread_model != ThreadModel::IO_CONTEXT_PER_THREAD) {
+            throw std::logic_error("coroutine of ThreadLocalSingleton requires ThreadModel::IO_CONTEXT_PER_THREAD");
+        }
+        auto iter = std::lower_bound(handler_table.begin(), handler_table.end(), entry.path_hash,
+            [](const common_define::HandlerEntry& entry, uint64_t hash) { return entry.path_hash < hash; });
+        if (iter != handler_table.end() && iter->path_hash == entry.path_hash) {
+            if (iter->path != entry.path) {
+                throw std::runtime_error(std::format("rpc path hash collision between {} and {}", iter->path, entry.path));
+            }
+            *iter = entry;
         } else {
-            process_func_map[path] = common_define::CommonFuncTemplate<Func>;
+            handler_table.insert(iter, entry);
         }
-        LOG("registered func path {}", path);
+        LOG("registered func path {}", entry.path);
     }
 
 private:
-    io_context io_ctx;  // asio io_context
+    std::vector<std::unique_ptr<io_context>> io_contexts;  // asio io_context，数量由线程模型决定
     uint32_t thread_num = 0;    // server框架中不区分IO和工作线程，所有IO和其他阻塞全部采用协程异步进行
     uint32_t port = 0;
+    ThreadModel thread_model = ThreadModel::SHARED_IO_CONTEXT;
     boost::asio::thread_pool thread_pool;
-    TCPProcessCoroutineMap process_coroutine_map;
-    TCPProcessFuncMap process_function_map;
+    std::vector<common_define::HandlerEntry> handler_table;    // 按path_hash有序排列的处理函数表
+    size_t max_queued_responses = 64;   // 单条连接上已处理完成、等待写回的响应队列长度上限
+    uint32_t blocking_thread_num = 2;   // 阻塞线程池的线程数
+    size_t max_blocking_queue = 1024;   // 阻塞调用（执行中+排队）数量上限
+    std::atomic<size_t> blocking_pending = 0;
+    Limits limits;
+    CompressionOptions compression;     // server启用的压缩算法，为空时不压缩响应
+    std::atomic<size_t> active_connections = 0;    // 当前保持的连接数
+    std::atomic<size_t> total_inflight_requests = 0;   // 整个server正在处理的请求数
+    std::unique_ptr<boost::asio::thread_pool> blocking_pool;    // 执行rpc_blocking函数的线程池，仅在注册了此类函数时创建
+    ServerMetrics metrics;  // 与handler_table一一对应的各函数运行指标
+    std::unique_ptr<ResponseCache> response_cache = std::make_unique<ResponseCache>(ResponseCacheOptions {});  // rpc_cacheable函数的响应缓存
+    std::once_flag prepare_flag;
+    std::atomic<bool> handlers_prepared = false;   // prepare_handlers已执行，处理函数表不能再修改
+    std::vector<std::string> unix_socket_paths;    // ListenUnixSocket添加的Unix domain socket路径
+    std::vector<std::string> shm_socket_paths;     // ListenSharedMemory添加的握手socket路径
+    std::mutex lifecycle_mtx;   // 保护Start创建io_context与Stop之间的并发
+    bool stop_requested = false;
 };
 }
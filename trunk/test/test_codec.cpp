@@ -0,0 +1,229 @@
+#include "test_util.hpp"
+#include "../struct_rpc.hpp"
+#include <random>
+
+using namespace struct_rpc;
+
+namespace
+{
+std::string RepetitiveData(size_t size)
+{
+    std::string data;
+    for (size_t i = 0; data.size() < size; ++i) {
+        data += "struct_rpc payload " + std::to_string(i % 17) + ";";
+    }
+    data.resize(size);
+    return data;
+}
+
+std::string RandomData(size_t size, uint32_t seed = 1)
+{
+    std::mt19937 rng(seed);
+    std::string data(size, '\0');
+    for (char& c : data) {
+        c = static_cast<char>(rng());
+    }
+    return data;
+}
+
+/**
+ * @brief: 按客户端的方式构造请求包：请求头 + 路径 + 参数
+*/
+util::SegmentedBuffer MakeRequest(uint64_t request_id, std::string_view path, const std::tuple<int32_t, std::string, std::string_view>& params, uint32_t flags = 0)
+{
+    util::SegmentedBuffer request;
+    common_define::ReserveHeader<common_define::RequestHeader>(request);
+    request.append(path);
+    common_define::EncodeParams(params, request);
+    common_define::FinishRequest(request, request_id, 42, static_cast<uint32_t>(path.size()), flags, 1000);
+    return request;
+}
+}
+
+TEST_CASE(request_round_trip)
+{
+    std::string large(2000, 'x');
+    util::SegmentedBuffer request = MakeRequest(7, "ns::func", {-5, large, "view"});
+    std::string request_str = request.to_string();
+
+    common_define::TCPRequestView view = common_define::ParseRequestView(request_str);
+    CHECK(view.request_id == 7);
+    CHECK(view.path_hash == 42);
+    CHECK(view.path == "ns::func");
+    CHECK(view.timeout_us == 1000);
+    std::tuple<int32_t, std::string, std::string_view> params;
+    common_define::DecodeParams(params, view.params);
+    CHECK(std::get<0>(params) == -5);
+    CHECK(std::get<1>(params) == large);
+    CHECK(std::get<2>(params) == "view");
+}
+
+TEST_CASE(request_parse_rejects_malformed)
+{
+    std::string request_str = MakeRequest(1, "path", {1, "a", "b"}).to_string();
+    CHECK_THROWS(common_define::ParseRequestView(request_str.substr(0, 10)), std::runtime_error);
+    CHECK_THROWS(common_define::ParseRequestView(request_str.substr(0, request_str.size() - 1)), std::runtime_error);
+
+    // path_size超出消息体：完整解析拒绝，只校验固定请求头时接受（压缩包的path_size是解压后的长度）
+    common_define::RequestHeader header;
+    std::memcpy(&header, request_str.data(), sizeof(header));
+    header.path_size = 1 << 20;
+    std::memcpy(request_str.data(), &header, sizeof(header));
+    CHECK_THROWS(common_define::ParseRequestView(request_str), std::runtime_error);
+    CHECK(common_define::ParseRequestHeader(request_str).request_id == 1);
+
+    std::tuple<int32_t, std::string, std::string_view> params;
+    CHECK_THROWS(common_define::DecodeParams(params, std::string_view("\x01\x02", 2)), std::runtime_error);
+}
+
+TEST_CASE(response_round_trip)
+{
+    util::SegmentedBuffer response;
+    common_define::ReserveHeader<common_define::ResponseHeader>(response);
+    common_define::EncodeParam(std::string("result"), response);
+    common_define::FinishResponse(response, 9, 0, common_define::FLAG_STREAM);
+    std::string response_str = response.to_string();
+
+    common_define::TCPResponseView view = common_define::ParseResponseView(response_str);
+    CHECK(view.request_id == 9);
+    CHECK(view.retcode == 0);
+    CHECK(!common_define::IsFinalResponse(view.flags));
+    CHECK(common_define::IsFinalResponse(common_define::FLAG_STREAM | common_define::FLAG_STREAM_END));
+    CHECK(common_define::IsFinalResponse(common_define::FLAG_NONE));
+    std::string result;
+    std::string_view data = view.data;
+    common_define::DecodeParam(result, data);
+    CHECK(result == "result");
+    CHECK(data.empty());
+}
+
+TEST_CASE(split_frames_keeps_order)
+{
+    std::string body;
+    for (uint64_t id = 0; id < 5; ++id) {
+        body += MakeRequest(id, "", {static_cast<int32_t>(id), "s", "v"}).to_string();
+    }
+    std::vector<std::string_view> frames = common_define::SplitFrames(body);
+    CHECK(frames.size() == 5);
+    for (uint64_t id = 0; id < 5; ++id) {
+        CHECK(common_define::ParseRequestView(frames[id]).request_id == id);
+    }
+    CHECK_THROWS(common_define::SplitFrames(std::string_view(body).substr(0, body.size() - 1)), std::runtime_error);
+}
+
+TEST_CASE(segmented_buffer_spans_segments)
+{
+    util::SegmentedBuffer buffer;
+    buffer.append("abc");
+    buffer.append_owned(std::string(util::SegmentedBuffer::inline_threshold, 'x'));
+    buffer.append("def");
+    std::string flat = buffer.to_string();
+    CHECK(flat.size() == buffer.size());
+
+    char read_back[8];
+    buffer.read(1, read_back, sizeof(read_back));
+    CHECK(std::string_view(read_back, sizeof(read_back)) == flat.substr(1, sizeof(read_back)));
+
+    size_t tail = buffer.size() - 5;
+    buffer.overwrite(tail, "12345", 5);
+    CHECK(buffer.to_string().substr(tail) == "12345");
+    CHECK(!buffer.contiguous_view(0).has_value());
+    CHECK(buffer.contiguous_view(buffer.size() - 3).value() == "345");
+    CHECK_THROWS(buffer.read(buffer.size() - 2, read_back, 4), std::out_of_range);
+    CHECK_THROWS(buffer.overwrite(buffer.size() + 1, "a", 1), std::out_of_range);
+}
+
+TEST_CASE(lz_round_trip)
+{
+    util::LZCodec codec;
+    for (size_t size : {0, 1, 15, 16, 255, 4096, 70000, 1 << 20}) {
+        for (const std::string& raw : {RepetitiveData(size), RandomData(size, static_cast<uint32_t>(size))}) {
+            std::string compressed;
+            codec.compress(raw, compressed);
+            std::string restored(raw.size(), '\0');
+            codec.decompress(compressed, restored.data(), restored.size());
+            CHECK(restored == raw);
+        }
+    }
+    std::string compressed;
+    codec.compress(RepetitiveData(100000), compressed);
+    CHECK(compressed.size() < 100000 / 4);
+}
+
+TEST_CASE(lz_rejects_corrupt_input)
+{
+    util::LZCodec codec;
+    std::string raw = RepetitiveData(10000);
+    std::string compressed;
+    codec.compress(raw, compressed);
+    std::string restored(raw.size() + 1, '\0');
+
+    CHECK_THROWS(codec.decompress(std::string_view(compressed).substr(0, compressed.size() / 2), restored.data(), raw.size()), std::runtime_error);
+    CHECK_THROWS(codec.decompress(compressed, restored.data(), raw.size() + 1), std::runtime_error);
+    CHECK_THROWS(codec.decompress(compressed, restored.data(), raw.size() - 1), std::runtime_error);
+    // 任意字节序列都不能越界读写，解压失败时抛出异常
+    for (uint32_t seed = 0; seed < 64; ++seed) {
+        std::string garbage = RandomData(512, seed);
+        try {
+            codec.decompress(garbage, restored.data(), raw.size());
+        } catch (const std::runtime_error&) {
+        }
+    }
+}
+
+TEST_CASE(compress_frame_round_trip)
+{
+    const util::Codec& codec = *util::CodecRegistry::getInstance().find(util::CODEC_LZ);
+    for (size_t size : {5000, 200000}) {
+        std::string body = RepetitiveData(size);
+        util::SegmentedBuffer frame;
+        common_define::ReserveHeader<common_define::ResponseHeader>(frame);
+        frame.append(body.substr(0, 8));
+        frame.append_owned(body.substr(8));
+        common_define::FinishResponse(frame, 3, 0);
+
+        CHECK(common_define::CompressFrame<common_define::ResponseHeader>(frame, codec, 1024));
+        std::string frame_str = frame.to_string();
+        CHECK(frame_str.size() < size);
+        CHECK(common_define::ParseResponseView(frame_str).request_id == 3);
+        CHECK_THROWS(common_define::DecompressFrame<common_define::ResponseHeader>(frame_str, size - 1), std::runtime_error);
+        CHECK(common_define::DecompressFrame<common_define::ResponseHeader>(frame_str, size));
+        common_define::TCPResponseView view = common_define::ParseResponseView(frame_str);
+        CHECK(view.data == body);
+        CHECK(!(view.flags & common_define::FLAG_COMPRESSED));
+    }
+}
+
+TEST_CASE(compress_frame_skips_incompressible)
+{
+    const util::Codec& codec = *util::CodecRegistry::getInstance().find(util::CODEC_LZ);
+    for (size_t size : {100, 5000, 200000}) {
+        util::SegmentedBuffer frame;
+        common_define::ReserveHeader<common_define::ResponseHeader>(frame);
+        frame.append_owned(RandomData(size));
+        common_define::FinishResponse(frame, 4, 0);
+        std::string before = frame.to_string();
+        CHECK(!common_define::CompressFrame<common_define::ResponseHeader>(frame, codec, 0));
+        CHECK(frame.to_string() == before);
+    }
+}
+
+TEST_CASE(decompress_rejects_unknown_codec)
+{
+    util::SegmentedBuffer frame;
+    common_define::ReserveHeader<common_define::ResponseHeader>(frame);
+    frame.append_owned(RepetitiveData(10000));
+    common_define::FinishResponse(frame, 5, 0);
+    CHECK(common_define::CompressFrame<common_define::ResponseHeader>(frame, *util::CodecRegistry::getInstance().find(util::CODEC_LZ), 0));
+    std::string frame_str = frame.to_string();
+    common_define::CompressedHeader compressed_header;
+    std::memcpy(&compressed_header, frame_str.data() + sizeof(common_define::ResponseHeader), sizeof(compressed_header));
+    compressed_header.codec_id = 200;
+    std::memcpy(frame_str.data() + sizeof(common_define::ResponseHeader), &compressed_header, sizeof(compressed_header));
+    CHECK_THROWS(common_define::DecompressFrame<common_define::ResponseHeader>(frame_str, 1 << 20), std::runtime_error);
+}
+
+int main()
+{
+    return struct_rpc::test::RunAllTests();
+}
@@ -0,0 +1,120 @@
+#include "test_util.hpp"
+#include "../response_cache.hpp"
+#include <thread>
+
+using namespace struct_rpc;
+
+namespace
+{
+constexpr uint64_t path_a = 1;
+constexpr uint64_t path_b = 2;
+
+/**
+ * @brief: 单个缓存项占用的字节数，参数和响应体长度相同时相同
+*/
+uint64_t EntryBytes()
+{
+    ResponseCache cache(ResponseCacheOptions {1 << 20, std::chrono::milliseconds(1000), 1});
+    cache.insert(path_a, "k0", std::string(100, 'v'));
+    return cache.stats().bytes;
+}
+
+bool Lookup(ResponseCache& cache, uint64_t path_hash, std::string_view params, std::string* body = nullptr)
+{
+    util::SegmentedBuffer response;
+    bool hit = cache.lookup(path_hash, params, response);
+    if (body != nullptr) {
+        *body = response.to_string();
+    }
+    return hit;
+}
+}
+
+TEST_CASE(lookup_returns_inserted_body)
+{
+    ResponseCache cache(ResponseCacheOptions {});
+    std::string body;
+    CHECK(!Lookup(cache, path_a, "k0"));
+    cache.insert(path_a, "k0", "body0");
+    CHECK(Lookup(cache, path_a, "k0", &body));
+    CHECK(body == "body0");
+    // 路径哈希和参数共同组成键
+    CHECK(!Lookup(cache, path_b, "k0"));
+    CHECK(!Lookup(cache, path_a, "k1"));
+
+    cache.insert(path_a, "k0", "body1");
+    CHECK(Lookup(cache, path_a, "k0", &body));
+    CHECK(body == "body1");
+    ResponseCacheStats stats = cache.stats();
+    CHECK(stats.entries == 1);
+    CHECK(stats.hits == 2);
+    CHECK(stats.misses == 3);
+}
+
+TEST_CASE(evicts_least_recently_used)
+{
+    uint64_t entry_bytes = EntryBytes();
+    ResponseCache cache(ResponseCacheOptions {3 * entry_bytes, std::chrono::milliseconds(1000), 1});
+    cache.insert(path_a, "k0", std::string(100, 'v'));
+    cache.insert(path_a, "k1", std::string(100, 'v'));
+    cache.insert(path_a, "k2", std::string(100, 'v'));
+    // 访问k0后k1成为最久未使用的缓存项
+    CHECK(Lookup(cache, path_a, "k0"));
+    cache.insert(path_a, "k3", std::string(100, 'v'));
+
+    CHECK(!Lookup(cache, path_a, "k1"));
+    CHECK(Lookup(cache, path_a, "k0"));
+    CHECK(Lookup(cache, path_a, "k2"));
+    CHECK(Lookup(cache, path_a, "k3"));
+    ResponseCacheStats stats = cache.stats();
+    CHECK(stats.entries == 3);
+    CHECK(stats.bytes == 3 * entry_bytes);
+    CHECK(stats.evictions == 1);
+
+    // 超过分片容量的响应不缓存，也不淘汰已有的缓存项
+    cache.insert(path_a, "huge", std::string(4 * entry_bytes, 'v'));
+    CHECK(!Lookup(cache, path_a, "huge"));
+    CHECK(cache.stats().entries == 3);
+}
+
+TEST_CASE(expires_after_ttl)
+{
+    ResponseCache cache(ResponseCacheOptions {1 << 20, std::chrono::milliseconds(50), 1});
+    cache.insert(path_a, "k0", "body0");
+    CHECK(Lookup(cache, path_a, "k0"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    CHECK(!Lookup(cache, path_a, "k0"));
+    ResponseCacheStats stats = cache.stats();
+    CHECK(stats.entries == 0);
+    CHECK(stats.bytes == 0);
+    CHECK(stats.evictions == 0);
+}
+
+TEST_CASE(invalidates_by_key_and_by_path)
+{
+    ResponseCache cache(ResponseCacheOptions {1 << 20, std::chrono::milliseconds(1000), 4});
+    for (std::string params : {"k0", "k1", "k2"}) {
+        cache.insert(path_a, params, "a");
+        cache.insert(path_b, params, "b");
+    }
+    cache.invalidate(path_a, "k0");
+    CHECK(!Lookup(cache, path_a, "k0"));
+    CHECK(Lookup(cache, path_a, "k1"));
+    CHECK(Lookup(cache, path_b, "k0"));
+
+    cache.invalidate(path_a);
+    CHECK(!Lookup(cache, path_a, "k1"));
+    CHECK(!Lookup(cache, path_a, "k2"));
+    CHECK(Lookup(cache, path_b, "k1"));
+    CHECK(cache.stats().entries == 3);
+
+    cache.clear();
+    CHECK(!Lookup(cache, path_b, "k1"));
+    CHECK(cache.stats().entries == 0);
+    CHECK(cache.stats().bytes == 0);
+}
+
+int main()
+{
+    return struct_rpc::test::RunAllTests();
+}
@@ -0,0 +1,540 @@
+#include "test_util.hpp"
+#include "../struct_rpc.hpp"
+#include <memory>
+#include <thread>
+#include <unistd.h>
+#include <boost/asio/experimental/awaitable_operators.hpp>
+
+using namespace struct_rpc;
+using namespace std::chrono_literals;
+
+/**
+ * 测试用的RPC函数
+*/
+inline int32_t add(int32_t a, int32_t b) {
+    return a + b;
+}
+inline std::string echo(std::string input) {
+    return input;
+}
+
+/**
+ * 等待delay_ms毫秒后返回input，用于构造乱序完成的请求和超过截止时间的请求
+*/
+inline awaitable<std::string> slow_echo(int32_t delay_ms, std::string input) {
+    steady_timer timer(co_await this_coro::executor);
+    timer.expires_after(std::chrono::milliseconds(delay_ms));
+    co_await timer.async_wait(use_awaitable);
+    co_return input;
+}
+
+inline awaitable<void> count_up(int32_t from, int32_t count, StreamWriter<int32_t> writer) {
+    for (int32_t i = 0; i < count; ++i) {
+        co_await writer.write(from + i);
+    }
+}
+
+/**
+ * 写出count个结果后抛出异常，调用方应先收到这些结果，再从next()得到异常
+*/
+inline awaitable<void> fail_after(int32_t count, StreamWriter<int32_t> writer) {
+    for (int32_t i = 0; i < count; ++i) {
+        co_await writer.write(i);
+    }
+    throw std::runtime_error("stream failed");
+}
+
+/**
+ * 在阻塞线程池中占用线程，用于填满阻塞调用队列
+*/
+inline int32_t blocking_sleep(int32_t delay_ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+    return delay_ms;
+}
+template <> inline constexpr bool struct_rpc::rpc_blocking<blocking_sleep> = true;
+
+/**
+ * 记录实际执行次数的幂等函数，用于检查相同的并发调用只执行一次
+*/
+inline std::atomic<int32_t> lookup_executions {0};
+inline awaitable<int32_t> lookup_once(int32_t key) {
+    lookup_executions.fetch_add(1);
+    steady_timer timer(co_await this_coro::executor);
+    timer.expires_after(100ms);
+    co_await timer.async_wait(use_awaitable);
+    co_return key * 2;
+}
+template <> inline constexpr bool struct_rpc::rpc_idempotent<lookup_once> = true;
+
+/**
+ * 每4次调用中有一次等待50ms，其余立即返回，用于触发备份请求
+*/
+inline std::atomic<int32_t> jittery_executions {0};
+inline awaitable<int32_t> jittery_echo(int32_t value) {
+    if (jittery_executions.fetch_add(1) % 4 == 0) {
+        steady_timer timer(co_await this_coro::executor);
+        timer.expires_after(50ms);
+        co_await timer.async_wait(use_awaitable);
+    }
+    co_return value;
+}
+template <> inline constexpr bool struct_rpc::rpc_idempotent<jittery_echo> = true;
+
+namespace
+{
+/**
+ * @brief: 每个测试使用独立的端口，避免上一个测试残留的连接影响下一个测试
+*/
+uint32_t NextPort()
+{
+    static uint32_t port = 18650;
+    return port++;
+}
+
+std::string TempPath(const std::string& name)
+{
+    return "/tmp/struct_rpc_test_" + std::to_string(::getpid()) + "_" + name;
+}
+
+void RegisterTestFunctions(TCPServer& server)
+{
+    server.RegisterServerFunctions<add, echo, slow_echo, count_up, fail_after, blocking_sleep, lookup_once, jittery_echo>();
+}
+
+/**
+ * @class TestServer: 在后台线程中运行的server，析构时停止
+ * @param configure: 在Start()之前对server做额外的设置
+*/
+class TestServer
+{
+public:
+    explicit TestServer(uint32_t listen_port, std::function<void(TCPServer&)> configure = {}) : port(std::to_string(listen_port)), server(2, listen_port)
+    {
+        RegisterTestFunctions(server);
+        if (configure) {
+            configure(server);
+        }
+        thread = std::thread([this] { server.Start(); });
+        std::this_thread::sleep_for(200ms);
+    }
+
+    ~TestServer()
+    {
+        server.Stop();
+        thread.join();
+    }
+
+    std::string port;
+    TCPServer server;
+    std::thread thread;
+};
+
+/**
+ * @brief: 调用并返回结果的状态：0为成功，否则为错误码，用于检查并发调用中哪些被拒绝
+*/
+int32_t ErrorCode(const std::exception& e)
+{
+    std::string_view what = e.what();
+    if (!what.starts_with("errcode")) {
+        return -1;
+    }
+    return std::atoi(what.data() + std::string_view("errcode").size());
+}
+}
+
+TEST_CASE(sync_call)
+{
+    TestServer server(NextPort());
+    SyncTCPConnection conn("127.0.0.1", server.port);
+    CHECK(conn.sync_struct_rpc_request<add>(1, 2) == 3);
+    CHECK(conn.sync_struct_rpc_request<echo>(std::string(100000, 'e')) == std::string(100000, 'e'));
+    conn.path_encoding = common_define::PathEncoding::FULL_PATH;
+    CHECK(conn.sync_struct_rpc_request<add>(3, 4) == 7);
+}
+
+TEST_CASE(unix_socket_call)
+{
+    std::string path = TempPath("unix.sock");
+    TestServer server(NextPort(), [&path](TCPServer& s) { s.ListenUnixSocket(path); });
+    SyncTCPConnection conn("unix:" + path, "");
+    CHECK(conn.sync_struct_rpc_request<add>(1, 2) == 3);
+}
+
+TEST_CASE(compressed_call)
+{
+    TestServer server(NextPort(), [](TCPServer& s) { s.SetCompression(CompressionOptions {{util::CODEC_LZ}}); });
+    SyncTCPConnection conn("127.0.0.1", server.port, CompressionOptions {{util::CODEC_LZ}});
+    std::string large;
+    while (large.size() < 200000) {
+        large += "compressible payload ";
+    }
+    CHECK(conn.sync_struct_rpc_request<echo>(large) == large);
+}
+
+TEST_CASE(pipeline_flush)
+{
+    TestServer server(NextPort());
+    SyncTCPConnection conn("127.0.0.1", server.port);
+    std::vector<std::future<int32_t>> futures;
+    for (int32_t i = 0; i < 10; ++i) {
+        futures.push_back(conn.pipeline_struct_rpc_request<add>(i, i));
+    }
+    conn.flush_pipeline();
+    for (int32_t i = 0; i < 10; ++i) {
+        CHECK(futures[i].get() == 2 * i);
+    }
+
+    // 达到max_pipeline_depth时自动发出，普通调用之前先完成流水线中的调用
+    conn.max_pipeline_depth = 4;
+    futures.clear();
+    for (int32_t i = 0; i < 6; ++i) {
+        futures.push_back(conn.pipeline_struct_rpc_request<add>(i, 1));
+    }
+    CHECK(conn.sync_struct_rpc_request<add>(100, 1) == 101);
+    for (int32_t i = 0; i < 6; ++i) {
+        CHECK(futures[i].get() == i + 1);
+    }
+}
+
+TEST_CASE(batch_keeps_order)
+{
+    TestServer server(NextPort());
+    SyncTCPConnection conn("127.0.0.1", server.port);
+    for (bool parallel : {false, true}) {
+        // 并发执行时第一个调用最后完成，结果仍按添加顺序排列
+        auto [first, second, third] = conn.batch(parallel).add<slow_echo>(100, "first").add<add>(1, 2).add<echo>("third").sync_request();
+        CHECK(first == "first");
+        CHECK(second == 3);
+        CHECK(third == "third");
+    }
+}
+
+TEST_CASE(partial_header_resume)
+{
+    TestServer server(NextPort());
+    io_context ioc;
+    ip::tcp::socket socket(ioc);
+    socket.connect(ip::tcp::endpoint(ip::make_address("127.0.0.1"), static_cast<uint16_t>(std::stoi(server.port))));
+
+    util::SegmentedBuffer request;
+    common_define::ReserveHeader<common_define::RequestHeader>(request);
+    common_define::EncodeParams(std::tuple<int32_t, int32_t> {20, 22}, request);
+    common_define::FinishRequest(request, 9, trait_helper::struct_rpc_func_hash<add>(), 0);
+    std::string request_str = request.to_string();
+
+    // 依次在total_size中间、请求头中间和参数中间断开，server需要在多次读取之间保留已读取的部分
+    size_t offsets[] = {0, 5, 20, sizeof(common_define::RequestHeader) + 3, request_str.size()};
+    for (size_t i = 0; i + 1 < std::size(offsets); ++i) {
+        boost::asio::write(socket, boost::asio::buffer(request_str.data() + offsets[i], offsets[i + 1] - offsets[i]));
+        std::this_thread::sleep_for(100ms);
+    }
+
+    size_t total_size;
+    boost::asio::read(socket, boost::asio::buffer(&total_size, sizeof(size_t)));
+    std::string response_str(total_size + sizeof(size_t), '\0');
+    std::memcpy(response_str.data(), &total_size, sizeof(size_t));
+    boost::asio::read(socket, boost::asio::buffer(response_str.data() + sizeof(size_t), total_size));
+    common_define::TCPResponseView response = common_define::ParseResponseView(response_str);
+    CHECK(response.request_id == 9);
+    CHECK(response.retcode == 0);
+    int32_t sum = 0;
+    std::string_view data = response.data;
+    common_define::DecodeParam(sum, data);
+    CHECK(sum == 42);
+}
+
+TEST_CASE(async_call_and_stream)
+{
+    TestServer server(NextPort());
+    io_context ioc;
+    AsyncTCPConnection conn("127.0.0.1", server.port, ioc);
+    // 第一次调用时尚未连接，经重试路径建立连接
+    CHECK(RunCoroutine(ioc, conn.async_struct_rpc_request<add>(1, 2)) == 3);
+
+    auto collect = [&conn](int32_t from, int32_t count) -> awaitable<std::vector<int32_t>> {
+        std::vector<int32_t> items;
+        auto stream = co_await conn.async_struct_rpc_stream<count_up>(from, count);
+        while (auto item = co_await stream.next()) {
+            items.push_back(*item);
+        }
+        co_return items;
+    };
+    CHECK(RunCoroutine(ioc, collect(10, 3)) == std::vector<int32_t>({10, 11, 12}));
+    CHECK(RunCoroutine(ioc, collect(0, 0)).empty());
+
+    auto collect_until_error = [&conn]() -> awaitable<std::vector<int32_t>> {
+        std::vector<int32_t> items;
+        auto stream = co_await conn.async_struct_rpc_stream<fail_after>(2);
+        try
+        {
+            while (auto item = co_await stream.next()) {
+                items.push_back(*item);
+            }
+        }
+        catch (const std::runtime_error&)
+        {
+            items.push_back(-1);
+        }
+        co_return items;
+    };
+    CHECK(RunCoroutine(ioc, collect_until_error()) == std::vector<int32_t>({0, 1, -1}));
+
+    // 提前放弃的流式调用关闭连接，之后的调用重新连接，不会读到残留的流式响应
+    auto abandon = [&conn]() -> awaitable<int32_t> {
+        {
+            auto stream = co_await conn.async_struct_rpc_stream<count_up>(0, 1000);
+            co_await stream.next();
+        }
+        co_return co_await conn.async_struct_rpc_request<add>(2, 3);
+    };
+    CHECK(RunCoroutine(ioc, abandon()) == 5);
+}
+
+TEST_CASE(multiplex_out_of_order)
+{
+    TestServer server(NextPort());
+    io_context ioc;
+    MultiplexTCPConnection conn("127.0.0.1", server.port, ioc);
+    std::vector<std::string> completed;
+    auto call = [&conn, &completed](int32_t delay_ms, std::string input) -> awaitable<void> {
+        std::string result = co_await conn.async_struct_rpc_request<slow_echo>(delay_ms, input);
+        CHECK(result == input);
+        completed.push_back(result);
+    };
+    auto both = [&call]() -> awaitable<void> {
+        using namespace boost::asio::experimental::awaitable_operators;
+        co_await (call(300, "slow") && call(0, "fast"));
+    };
+    RunCoroutine(ioc, both());
+    CHECK(completed == std::vector<std::string>({"fast", "slow"}));
+
+    auto collect = [&conn]() -> awaitable<std::vector<int32_t>> {
+        std::vector<int32_t> items;
+        auto stream = co_await conn.async_struct_rpc_stream<count_up>(0, 100);
+        while (auto item = co_await stream.next()) {
+            items.push_back(*item);
+        }
+        co_return items;
+    };
+    CHECK(RunCoroutine(ioc, collect()).size() == 100);
+}
+
+TEST_CASE(deadline_cancels_call)
+{
+    TestServer server(NextPort());
+    SyncTCPConnection sync_conn("127.0.0.1", server.port);
+    CHECK_THROWS(sync_conn.sync_struct_rpc_request<slow_echo>(Deadline::after(100ms), 1000, "late"), DeadlineExceededError);
+    CHECK(sync_conn.sync_struct_rpc_request<add>(1, 2) == 3);
+    CHECK(sync_conn.sync_struct_rpc_request<slow_echo>(Deadline::after(1000ms), 10, "in time") == "in time");
+
+    io_context ioc;
+    AsyncTCPConnection async_conn("127.0.0.1", server.port, ioc);
+    MultiplexTCPConnection multiplex_conn("127.0.0.1", server.port, ioc);
+    for (TCPConnectionBase* conn : {static_cast<TCPConnectionBase*>(&async_conn), static_cast<TCPConnectionBase*>(&multiplex_conn)}) {
+        auto start = std::chrono::steady_clock::now();
+        CHECK_THROWS(RunCoroutine(ioc, conn->async_struct_rpc_request<slow_echo>(Deadline::after(100ms), 1000, "late")), DeadlineExceededError);
+        CHECK(std::chrono::steady_clock::now() - start < 900ms);
+        CHECK(RunCoroutine(ioc, conn->async_struct_rpc_request<add>(1, 2)) == 3);
+    }
+}
+
+TEST_CASE(retry_after_server_restart)
+{
+    uint32_t port = NextPort();
+    io_context ioc;
+    auto server = std::make_unique<TestServer>(port);
+    SyncTCPConnection sync_conn("127.0.0.1", server->port);
+    AsyncTCPConnection async_conn("127.0.0.1", server->port, ioc);
+    MultiplexTCPConnection multiplex_conn("127.0.0.1", server->port, ioc);
+    CHECK(sync_conn.sync_struct_rpc_request<add>(1, 2) == 3);
+    CHECK(RunCoroutine(ioc, async_conn.async_struct_rpc_request<add>(1, 2)) == 3);
+    CHECK(RunCoroutine(ioc, multiplex_conn.async_struct_rpc_request<add>(1, 2)) == 3);
+
+    // 原连接被server关闭，下一次调用失败后重新连接并重试一次
+    server.reset();
+    server = std::make_unique<TestServer>(port);
+    CHECK(sync_conn.sync_struct_rpc_request<add>(2, 3) == 5);
+    CHECK(RunCoroutine(ioc, async_conn.async_struct_rpc_request<add>(2, 3)) == 5);
+    CHECK(RunCoroutine(ioc, multiplex_conn.async_struct_rpc_request<add>(2, 3)) == 5);
+}
+
+TEST_CASE(overload_rejects_blocking_calls)
+{
+    TestServer server(NextPort(), [](TCPServer& s) { s.SetBlockingExecutor(1, 1); });
+    io_context ioc;
+    MultiplexTCPConnection conn("127.0.0.1", server.port, ioc);
+    auto call = [&conn]() -> awaitable<int32_t> {
+        try
+        {
+            co_await conn.async_struct_rpc_request<blocking_sleep>(300);
+            co_return 0;
+        }
+        catch (const std::runtime_error& e)
+        {
+            co_return ErrorCode(e);
+        }
+    };
+    std::vector<std::future<int32_t>> futures;
+    for (int i = 0; i < 3; ++i) {
+        futures.push_back(co_spawn(ioc, call(), use_future));
+    }
+    RunUntilReady(ioc, futures);
+    std::vector<int32_t> codes;
+    for (auto& future : futures) {
+        codes.push_back(future.get());
+    }
+    CHECK(std::count(codes.begin(), codes.end(), 0) == 1);
+    CHECK(std::count(codes.begin(), codes.end(), static_cast<int32_t>(common_define::RetCode::RET_SERVER_OVERLOADED)) == 2);
+    // 队列空出后可以继续执行
+    CHECK(RunCoroutine(ioc, conn.async_struct_rpc_request<blocking_sleep>(1)) == 1);
+}
+
+TEST_CASE(local_call)
+{
+    TCPServer server(1, NextPort());
+    RegisterTestFunctions(server);
+    LocalConnection conn(server);
+    CHECK(conn.sync_struct_rpc_request<add>(1, 2) == 3);
+    CHECK(conn.sync_struct_rpc_request<blocking_sleep>(1) == 1);
+    CHECK_THROWS(conn.sync_struct_rpc_request<slow_echo>(Deadline::after(50ms), 1000, "late"), DeadlineExceededError);
+
+    io_context ioc;
+    CHECK(RunCoroutine(ioc, conn.async_struct_rpc_request<echo>(std::string("local"))) == "local");
+    CHECK(RunCoroutine(ioc, conn.async_struct_rpc_request<slow_echo>(10, "coroutine")) == "coroutine");
+    CHECK_THROWS(RunCoroutine(ioc, conn.async_struct_rpc_request<slow_echo>(Deadline::after(50ms), 1000, "late")), DeadlineExceededError);
+}
+
+#ifdef __linux__
+TEST_CASE(shared_memory_ring_wraparound)
+{
+    std::string path = TempPath("shm.sock");
+    TestServer server(NextPort(), [&path](TCPServer& s) { s.ListenSharedMemory(path); });
+    io_context ioc;
+    // 每个请求和响应约占环形队列的3/8，连续调用使读写位置多次越过队列末尾
+    ShmConnection conn(path, ioc, 8192);
+    auto calls = [&conn]() -> awaitable<void> {
+        for (int i = 0; i < 20; ++i) {
+            std::string input(3000, static_cast<char>('a' + i % 26));
+            input += std::to_string(i);
+            CHECK(co_await conn.async_struct_rpc_request<echo>(input) == input);
+        }
+        auto stream = co_await conn.async_struct_rpc_stream<count_up>(0, 50);
+        int32_t expected = 0;
+        while (auto item = co_await stream.next()) {
+            CHECK(*item == expected++);
+        }
+        CHECK(expected == 50);
+    };
+    RunCoroutine(ioc, calls());
+}
+#endif
+
+TEST_CASE(connection_pool_concurrent_calls)
+{
+    TestServer server(NextPort());
+    io_context ioc;
+    ConnectionPoolOptions options;
+    options.grow_threshold = 4;
+    ConnectionPool pool("127.0.0.1", server.port, ioc, options);
+    auto call = [&pool](int32_t i) -> awaitable<std::string> {
+        co_return co_await pool.async_struct_rpc_request<slow_echo>(10, std::to_string(i));
+    };
+    std::vector<std::future<std::string>> futures;
+    for (int32_t i = 0; i < 50; ++i) {
+        futures.push_back(co_spawn(ioc, call(i), use_future));
+    }
+    RunUntilReady(ioc, futures);
+    for (int32_t i = 0; i < 50; ++i) {
+        CHECK(futures[i].get() == std::to_string(i));
+    }
+}
+
+TEST_CASE(channel_avoids_unhealthy_endpoint)
+{
+    TestServer server(NextPort());
+    io_context ioc;
+    // 端口1上没有server，连接失败后该endpoint被标记为不可用，请求全部落到可用的endpoint上
+    Channel channel({{"127.0.0.1", server.port}, {"127.0.0.1", "1"}}, ioc);
+    auto calls = [&channel]() -> awaitable<void> {
+        for (int32_t i = 0; i < 20; ++i) {
+            CHECK(co_await channel.async_struct_rpc_request<add>(i, 1) == i + 1);
+        }
+    };
+    RunCoroutine(ioc, calls());
+    std::vector<ChannelEndpointStats> stats = channel.endpoint_stats();
+    CHECK(stats.size() == 2);
+    CHECK(stats[0].healthy);
+    CHECK(stats[0].inflight == 0);
+    CHECK(stats[0].ewma_latency_us > 0);
+    CHECK(!stats[1].healthy);
+}
+
+TEST_CASE(hedging_respects_budget)
+{
+    TestServer server_a(NextPort());
+    TestServer server_b(NextPort());
+    io_context ioc;
+    Channel channel({{"127.0.0.1", server_a.port}, {"127.0.0.1", server_b.port}}, ioc);
+    HedgingClientOptions options;
+    options.quantile = 0.5;
+    options.window = 20;
+    options.min_delay = 2ms;
+    options.max_extra_ratio = 0.1;
+    options.max_burst = 2;
+    HedgingClient client(channel, options);
+
+    auto calls = [&channel, &client]() -> awaitable<void> {
+        // 等待后台协程连接两个endpoint，备份请求需要主请求以外的可用endpoint
+        steady_timer timer(co_await this_coro::executor);
+        for (int i = 0; i < 100; ++i) {
+            std::vector<ChannelEndpointStats> stats = channel.endpoint_stats();
+            if (std::all_of(stats.begin(), stats.end(), [](const auto& s) { return s.healthy; })) {
+                break;
+            }
+            timer.expires_after(20ms);
+            co_await timer.async_wait(use_awaitable);
+        }
+        for (int32_t i = 0; i < 200; ++i) {
+            CHECK(co_await client.async_struct_rpc_request<jittery_echo>(i) == i);
+        }
+    };
+    RunCoroutine(ioc, calls());
+    HedgingClientStats stats = client.stats();
+    CHECK(stats.requests == 200);
+    CHECK(stats.hedged > 0);
+    CHECK(stats.hedge_wins <= stats.hedged);
+    CHECK(static_cast<double>(stats.hedged) <= stats.requests * options.max_extra_ratio + options.max_burst);
+}
+
+TEST_CASE(singleflight_fan_out)
+{
+    TestServer server(NextPort());
+    io_context ioc;
+    MultiplexTCPConnection conn("127.0.0.1", server.port, ioc);
+    CoalescingClient client(conn);
+    lookup_executions = 0;
+    auto call = [&client]() -> awaitable<int32_t> {
+        co_return co_await client.async_struct_rpc_request<lookup_once>(21);
+    };
+    std::vector<std::future<int32_t>> futures;
+    for (int i = 0; i < 10; ++i) {
+        futures.push_back(co_spawn(ioc, call(), use_future));
+    }
+    RunUntilReady(ioc, futures);
+    for (auto& future : futures) {
+        CHECK(future.get() == 42);
+    }
+    CHECK(lookup_executions == 1);
+    CoalescingClientStats stats = client.stats();
+    CHECK(stats.requests == 10);
+    CHECK(stats.coalesced == 9);
+
+    // 在途调用结束后不缓存（cache_ttl为0），再次调用重新执行
+    CHECK(RunCoroutine(ioc, call()) == 42);
+    CHECK(lookup_executions == 2);
+}
+
+int main()
+{
+    return struct_rpc::test::RunAllTests();
+}
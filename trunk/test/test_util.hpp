@@ -0,0 +1,112 @@
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <stdexcept>
+#include <future>
+#include <boost/asio.hpp>
+
+/**
+ * 测试用的最小断言工具，不依赖第三方测试框架。每个测试文件编译为独立的可执行程序，由ctest逐个运行，e.g.:
+ * TEST_CASE(codec_round_trip) { CHECK(1 + 1 == 2); }
+ * int main() { return struct_rpc::test::RunAllTests(); }
+*/
+namespace struct_rpc
+{
+namespace test
+{
+struct TestCase
+{
+    const char* name;
+    std::function<void()> body;
+};
+
+inline std::vector<TestCase>& Registry()
+{
+    static std::vector<TestCase> cases;
+    return cases;
+}
+
+struct TestRegistrar
+{
+    TestRegistrar(const char* name, std::function<void()> body)
+    {
+        Registry().push_back(TestCase {name, std::move(body)});
+    }
+};
+
+/**
+ * @brief: 依次运行全部已注册的测试，返回失败的测试数，作为进程退出码
+*/
+inline int RunAllTests()
+{
+    int failed = 0;
+    for (const TestCase& test_case : Registry()) {
+        try
+        {
+            test_case.body();
+            std::cout << "[PASS] " << test_case.name << std::endl;
+        }
+        catch (const std::exception& e)
+        {
+            ++failed;
+            std::cout << "[FAIL] " << test_case.name << ": " << e.what() << std::endl;
+        }
+    }
+    std::cout << Registry().size() - failed << "/" << Registry().size() << " passed" << std::endl;
+    return failed;
+}
+
+/**
+ * @brief: 运行io_context直到futures全部就绪
+ * @note: Channel、ConnectionPool等对象的后台协程一直占用io_context，不能等待run()返回
+*/
+template <typename T>
+void RunUntilReady(boost::asio::io_context& ioc, std::vector<std::future<T>>& futures)
+{
+    ioc.restart();
+    for (std::future<T>& future : futures) {
+        while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            ioc.run_one();
+        }
+    }
+}
+
+/**
+ * @brief: 在io_context上运行协程直到其结束，返回协程的结果并原样抛出协程中的异常
+*/
+template <typename T>
+T RunCoroutine(boost::asio::io_context& ioc, boost::asio::awaitable<T> coroutine)
+{
+    std::vector<std::future<T>> result;
+    result.push_back(boost::asio::co_spawn(ioc, std::move(coroutine), boost::asio::use_future));
+    RunUntilReady(ioc, result);
+    return result[0].get();
+}
+}
+}
+
+#define STRUCT_RPC_TEST_CONCAT_IMPL(a, b) a##b
+#define STRUCT_RPC_TEST_CONCAT(a, b) STRUCT_RPC_TEST_CONCAT_IMPL(a, b)
+
+#define TEST_CASE(name) \
+    static void name(); \
+    static struct_rpc::test::TestRegistrar STRUCT_RPC_TEST_CONCAT(name, _registrar)(#name, name); \
+    static void name()
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            throw std::runtime_error(std::string(__FILE__) + ":" + std::to_string(__LINE__) + " CHECK(" #cond ") failed"); \
+        } \
+    } while (0)
+
+#define CHECK_THROWS(expr, exception_type) \
+    do { \
+        bool thrown = false; \
+        try { (void)(expr); } catch (const exception_type&) { thrown = true; } \
+        if (!thrown) { \
+            throw std::runtime_error(std::string(__FILE__) + ":" + std::to_string(__LINE__) + " CHECK_THROWS(" #expr ") did not throw " #exception_type); \
+        } \
+    } while (0)
@@ -0,0 +1,257 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <memory>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include "util.hpp"
+
+namespace struct_rpc
+{
+namespace util
+{
+/**
+ * @brief: 压缩算法的编号，写入压缩包头并在连接建立时协商
+ * @enum CODEC_NONE: 不压缩，协商失败时的结果
+ * @enum CODEC_LZ: 内置的LZ77字节流压缩，见LZCodec
+ * @note: 自定义codec使用128及以上的编号
+*/
+enum CodecId : uint32_t
+{
+    CODEC_NONE = 0,
+    CODEC_LZ = 1,
+};
+
+/**
+ * @brief: 可插拔的压缩算法接口，实现需要是无状态且线程安全的
+*/
+class Codec
+{
+public:
+    virtual ~Codec() = default;
+    virtual uint32_t id() const = 0;
+    /**
+     * @brief: 把input压缩后写入output（覆盖output原有内容）
+    */
+    virtual void compress(std::string_view input, std::string& output) const = 0;
+    /**
+     * @brief: 把input解压到output开始的raw_size字节，输入损坏或解压长度与raw_size不符时抛出异常
+    */
+    virtual void decompress(std::string_view input, char* output, size_t raw_size) const = 0;
+};
+
+/**
+ * @class LZCodec: 内置的快速压缩算法，采用与LZ4 block相同的序列格式：[token][字面量长度扩展][字面量][2字节偏移][匹配长度扩展]
+ * @note: 只用单个哈希表查找4字节匹配，不做熵编码，压缩速度优先。连续未找到匹配时逐渐增大步长，已压缩过的数据很快扫描完
+*/
+class LZCodec : public Codec
+{
+public:
+    uint32_t id() const override { return CODEC_LZ; }
+
+    void compress(std::string_view input, std::string& output) const override
+    {
+        const auto* src = reinterpret_cast<const uint8_t*>(input.data());
+        size_t size = input.size();
+        output.resize(size + size / 255 + 16);
+        auto* dst = reinterpret_cast<uint8_t*>(output.data());
+        size_t out_pos = 0;
+        size_t anchor = 0;
+
+        if (size > min_match + last_literals) {
+            // 哈希表只保存位置，候选位置还要比较实际字节，表中残留的位置不会导致错误匹配
+            thread_local std::array<uint32_t, 1 << hash_log> table;
+            table.fill(0);
+            size_t match_limit = size - last_literals;
+            size_t pos = 1;
+            while (pos + min_match <= match_limit) {
+                uint32_t sequence = load32(src + pos);
+                uint32_t& slot = table[hash(sequence)];
+                size_t candidate = slot;
+                slot = static_cast<uint32_t>(pos);
+                if (candidate >= pos || pos - candidate > max_offset || load32(src + candidate) != sequence) {
+                    pos += 1 + ((pos - anchor) >> skip_trigger);
+                    continue;
+                }
+                size_t match_len = min_match;
+                while (pos + match_len < match_limit && src[candidate + match_len] == src[pos + match_len]) {
+                    ++match_len;
+                }
+                out_pos = write_sequence(dst, out_pos, src + anchor, pos - anchor, pos - candidate, match_len);
+                pos += match_len;
+                anchor = pos;
+            }
+        }
+        // 最后一个序列只有字面量
+        out_pos = write_sequence(dst, out_pos, src + anchor, size - anchor, 0, 0);
+        output.resize(out_pos);
+    }
+
+    void decompress(std::string_view input, char* output, size_t raw_size) const override
+    {
+        const auto* src = reinterpret_cast<const uint8_t*>(input.data());
+        auto* dst = reinterpret_cast<uint8_t*>(output);
+        size_t in_pos = 0;
+        size_t out_pos = 0;
+        for (;;) {
+            if (in_pos >= input.size()) {
+                throw std::runtime_error("truncated compressed data");
+            }
+            uint8_t token = src[in_pos++];
+            size_t literal_len = token >> 4;
+            if (literal_len == 15) {
+                literal_len += read_length(src, input.size(), in_pos);
+            }
+            if (literal_len > input.size() - in_pos || literal_len > raw_size - out_pos) {
+                throw std::runtime_error("corrupted compressed data");
+            }
+            std::memcpy(dst + out_pos, src + in_pos, literal_len);
+            in_pos += literal_len;
+            out_pos += literal_len;
+            if (in_pos == input.size()) {
+                break;
+            }
+
+            if (input.size() - in_pos < 2) {
+                throw std::runtime_error("truncated compressed data");
+            }
+            size_t offset = src[in_pos] | (static_cast<size_t>(src[in_pos + 1]) << 8);
+            in_pos += 2;
+            size_t match_len = (token & 15) + min_match;
+            if ((token & 15) == 15) {
+                match_len += read_length(src, input.size(), in_pos);
+            }
+            if (offset == 0 || offset > out_pos || match_len > raw_size - out_pos) {
+                throw std::runtime_error("corrupted compressed data");
+            }
+            // 匹配区间可能与输出重叠（offset < match_len），此时只能逐字节复制
+            const uint8_t* match = dst + out_pos - offset;
+            if (offset >= match_len) {
+                std::memcpy(dst + out_pos, match, match_len);
+            } else {
+                for (size_t i = 0; i < match_len; ++i) {
+                    dst[out_pos + i] = match[i];
+                }
+            }
+            out_pos += match_len;
+        }
+        if (out_pos != raw_size) {
+            throw std::runtime_error("compressed data size mismatch");
+        }
+    }
+
+private:
+    static constexpr size_t min_match = 4;
+    static constexpr size_t last_literals = 5;     // 结尾的若干字节总是作为字面量输出
+    static constexpr size_t max_offset = 65535;
+    static constexpr int hash_log = 14;
+    static constexpr int skip_trigger = 6;          // 每连续2^skip_trigger字节未命中，查找步长加1
+
+    static uint32_t load32(const uint8_t* ptr)
+    {
+        uint32_t value;
+        std::memcpy(&value, ptr, sizeof(value));
+        return value;
+    }
+
+    static uint32_t hash(uint32_t sequence)
+    {
+        return (sequence * 2654435761u) >> (32 - hash_log);
+    }
+
+    static size_t write_length(uint8_t* dst, size_t out_pos, size_t length)
+    {
+        while (length >= 255) {
+            dst[out_pos++] = 255;
+            length -= 255;
+        }
+        dst[out_pos++] = static_cast<uint8_t>(length);
+        return out_pos;
+    }
+
+    static size_t read_length(const uint8_t* src, size_t size, size_t& in_pos)
+    {
+        size_t length = 0;
+        uint8_t byte;
+        do {
+            if (in_pos >= size) {
+                throw std::runtime_error("truncated compressed data");
+            }
+            byte = src[in_pos++];
+            length += byte;
+        } while (byte == 255);
+        return length;
+    }
+
+    /**
+     * @brief: 写出一个序列，match_len为0时只写字面量（最后一个序列）
+    */
+    static size_t write_sequence(uint8_t* dst, size_t out_pos, const uint8_t* literals, size_t literal_len, size_t offset, size_t match_len)
+    {
+        size_t token_pos = out_pos++;
+        size_t match_code = match_len == 0 ? 0 : match_len - min_match;
+        dst[token_pos] = static_cast<uint8_t>((std::min<size_t>(literal_len, 15) << 4) | std::min<size_t>(match_code, 15));
+        if (literal_len >= 15) {
+            out_pos = write_length(dst, out_pos, literal_len - 15);
+        }
+        std::memcpy(dst + out_pos, literals, literal_len);
+        out_pos += literal_len;
+        if (match_len == 0) {
+            return out_pos;
+        }
+        dst[out_pos++] = static_cast<uint8_t>(offset & 0xff);
+        dst[out_pos++] = static_cast<uint8_t>(offset >> 8);
+        if (match_code >= 15) {
+            out_pos = write_length(dst, out_pos, match_code - 15);
+        }
+        return out_pos;
+    }
+};
+
+/**
+ * @class CodecRegistry: 按编号查找压缩算法，内置LZCodec。自定义codec需要在建立连接、启动server之前注册，e.g.:
+ *        struct_rpc::util::CodecRegistry::getInstance().add(std::make_unique<MyCodec>());
+*/
+class CodecRegistry : public Singleton<CodecRegistry>
+{
+public:
+    CodecRegistry()
+    {
+        add(std::make_unique<LZCodec>());
+    }
+
+    /**
+     * @brief: 注册压缩算法，编号已存在时替换原有实现
+    */
+    void add(std::unique_ptr<Codec> codec)
+    {
+        auto iter = std::find_if(codecs.begin(), codecs.end(), [&codec](const auto& item) { return item->id() == codec->id(); });
+        if (iter != codecs.end()) {
+            *iter = std::move(codec);
+        } else {
+            codecs.push_back(std::move(codec));
+        }
+    }
+
+    /**
+     * @return: 未注册的编号返回nullptr
+    */
+    const Codec* find(uint32_t id) const
+    {
+        for (const auto& codec : codecs) {
+            if (codec->id() == id) {
+                return codec.get();
+            }
+        }
+        return nullptr;
+    }
+
+private:
+    std::vector<std::unique_ptr<Codec>> codecs;
+};
+}
+}
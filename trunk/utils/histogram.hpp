@@ -0,0 +1,120 @@
+#pragma once
+#include <atomic>
+#include <array>
+#include <vector>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+namespace struct_rpc
+{
+namespace util
+{
+/**
+ * @brief: 无锁的HDR风格直方图，记录非负整数（例如纳秒耗时）的分布
+ * @note: 值按2的幂分组，每组再等分为sub_bucket_count个子桶，相对误差不超过1/sub_bucket_count，桶数量固定不随记录次数增长。
+ *        record只做几次relaxed原子加，可以被多个线程并发调用；读取时通过HistogramSnapshot合并多个直方图
+*/
+class LatencyHistogram
+{
+public:
+    static constexpr uint32_t sub_bucket_bits = 4;
+    static constexpr uint64_t sub_bucket_count = 1ull << sub_bucket_bits;
+    static constexpr uint32_t max_bits = 42;    // 可区分的最大值约为4.4e12（纳秒时约73分钟），更大的值计入最后一个桶
+    static constexpr size_t bucket_count = (max_bits - sub_bucket_bits + 1) * sub_bucket_count;
+
+    void record(uint64_t value)
+    {
+        buckets[bucket_index(value)].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+        uint64_t current_max = max.load(std::memory_order_relaxed);
+        while (value > current_max && !max.compare_exchange_weak(current_max, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    /**
+     * @brief: 值所在的桶
+    */
+    static size_t bucket_index(uint64_t value)
+    {
+        if (value < sub_bucket_count) {
+            return value;
+        }
+        uint32_t bits = std::bit_width(value);
+        if (bits > max_bits) {
+            return bucket_count - 1;
+        }
+        uint32_t shift = bits - 1 - sub_bucket_bits;
+        return ((shift + 1) << sub_bucket_bits) + ((value >> shift) - sub_bucket_count);
+    }
+
+    /**
+     * @brief: 桶内可能出现的最大值，作为该桶在分位数计算中的代表值
+    */
+    static uint64_t bucket_upper_bound(size_t index)
+    {
+        if (index < sub_bucket_count) {
+            return index;
+        }
+        uint32_t shift = static_cast<uint32_t>(index >> sub_bucket_bits) - 1;
+        uint64_t lower = (sub_bucket_count + (index & (sub_bucket_count - 1))) << shift;
+        return lower + (1ull << shift) - 1;
+    }
+
+private:
+    friend class HistogramSnapshot;
+
+    std::array<std::atomic<uint64_t>, bucket_count> buckets {};
+    std::atomic<uint64_t> count = 0;
+    std::atomic<uint64_t> sum = 0;
+    std::atomic<uint64_t> max = 0;
+};
+
+/**
+ * @brief: 直方图某一时刻的只读副本，可以合并多个线程各自记录的直方图后计算分位数
+*/
+class HistogramSnapshot
+{
+public:
+    HistogramSnapshot() : buckets(LatencyHistogram::bucket_count, 0) {}
+
+    void merge(const LatencyHistogram& histogram)
+    {
+        for (size_t i = 0; i < buckets.size(); ++i) {
+            buckets[i] += histogram.buckets[i].load(std::memory_order_relaxed);
+        }
+        count += histogram.count.load(std::memory_order_relaxed);
+        sum += histogram.sum.load(std::memory_order_relaxed);
+        max = std::max(max, histogram.max.load(std::memory_order_relaxed));
+    }
+
+    /**
+     * @brief: 第quantile分位（0~1）的值，没有记录时返回0
+    */
+    uint64_t percentile(double quantile) const
+    {
+        if (count == 0) {
+            return 0;
+        }
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(quantile * static_cast<double>(count))));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < buckets.size(); ++i) {
+            seen += buckets[i];
+            if (seen >= rank) {
+                return std::min(LatencyHistogram::bucket_upper_bound(i), max);
+            }
+        }
+        return max;
+    }
+
+    uint64_t mean() const { return count == 0 ? 0 : sum / count; }
+
+    std::vector<uint64_t> buckets;
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+};
+}
+}
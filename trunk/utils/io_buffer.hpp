@@ -0,0 +1,261 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <span>
+#include <mutex>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <boost/asio/buffer.hpp>
+
+namespace struct_rpc
+{
+namespace util
+{
+/**
+ * @brief: 分段输出缓冲区，写出时以const_buffer序列一次性发送（scatter-gather），避免把各段数据拼接成一个连续的字符串
+ * @note: 长度前缀、请求/响应头等小块数据追加到内部复用的inline_data中；StructBuffer序列化得到的大块字符串直接移入，不再拷贝
+*/
+class SegmentedBuffer
+{
+public:
+    // 小于该长度的字符串直接拷贝到inline_data，避免产生过多的小分段
+    static constexpr size_t inline_threshold = 512;
+
+    /**
+     * @brief: 拷贝追加一段数据
+    */
+    void append(std::string_view data)
+    {
+        if (!segments.empty() && segments.back().is_inline) {
+            segments.back().size += data.size();
+        } else {
+            segments.push_back(Segment {true, inline_data.size(), data.size()});
+        }
+        inline_data.append(data);
+        total_size += data.size();
+    }
+
+    /**
+     * @brief: 追加一段数据并接管其所有权，较大的字符串不发生拷贝
+    */
+    void append_owned(std::string&& data)
+    {
+        if (data.size() < inline_threshold) {
+            append(std::string_view(data));
+            return;
+        }
+        total_size += data.size();
+        segments.push_back(Segment {false, owned_data.size(), data.size()});
+        owned_data.push_back(std::move(data));
+    }
+
+    /**
+     * @brief: 把另一个缓冲区的全部分段追加到末尾，其中接管所有权的分段直接移入，不发生拷贝
+    */
+    void append_owned(SegmentedBuffer&& other)
+    {
+        for (const Segment& segment : other.segments) {
+            if (segment.is_inline) {
+                append(std::string_view(other.inline_data.data() + segment.offset, segment.size));
+            } else {
+                total_size += segment.size;
+                segments.push_back(Segment {false, owned_data.size(), segment.size});
+                owned_data.push_back(std::move(other.owned_data[segment.offset]));
+            }
+        }
+        other.clear();
+    }
+
+    /**
+     * @brief: 覆盖写入[offset, offset + size)范围内的数据（用于回填头部），范围可以跨越多个分段
+     * @note: 范围超出缓冲区末尾时抛出std::out_of_range，不写入任何数据
+    */
+    void overwrite(size_t offset, const void* data, size_t size)
+    {
+        check_range(offset, size);
+        const char* src = static_cast<const char*>(data);
+        for (const Segment& segment : segments) {
+            if (size == 0) {
+                return;
+            }
+            if (offset >= segment.size) {
+                offset -= segment.size;
+                continue;
+            }
+            size_t length = std::min(size, segment.size - offset);
+            char* dst = segment.is_inline ? inline_data.data() + segment.offset : owned_data[segment.offset].data();
+            std::memcpy(dst + offset, src, length);
+            src += length;
+            size -= length;
+            offset = 0;
+        }
+    }
+
+    /**
+     * @brief: 读取[offset, offset + size)范围内的数据（用于读取已填写的头部或拷贝部分数据），范围可以跨越多个分段
+     * @note: 范围超出缓冲区末尾时抛出std::out_of_range
+    */
+    void read(size_t offset, void* data, size_t size) const
+    {
+        check_range(offset, size);
+        char* dst = static_cast<char*>(data);
+        for (const Segment& segment : segments) {
+            if (size == 0) {
+                return;
+            }
+            if (offset >= segment.size) {
+                offset -= segment.size;
+                continue;
+            }
+            size_t length = std::min(size, segment.size - offset);
+            std::memcpy(dst, segment_data(segment) + offset, length);
+            dst += length;
+            size -= length;
+            offset = 0;
+        }
+    }
+
+    /**
+     * @brief: [offset, size())范围位于同一个分段中时返回其视图，跨越多个分段时返回std::nullopt，在下一次修改前有效
+    */
+    std::optional<std::string_view> contiguous_view(size_t offset) const
+    {
+        check_range(offset, 0);
+        size_t remaining = total_size - offset;
+        for (const Segment& segment : segments) {
+            if (offset < segment.size) {
+                if (remaining > segment.size - offset) {
+                    return std::nullopt;
+                }
+                return std::string_view(segment_data(segment) + offset, segment.size - offset);
+            }
+            offset -= segment.size;
+        }
+        return std::string_view();
+    }
+
+    /**
+     * @brief: 返回用于scatter-gather写出的const_buffer序列，在下一次修改前有效
+     * @note: 返回span而非vector，异步写操作内部拷贝缓冲区序列时不需要分配内存
+    */
+    std::span<const boost::asio::const_buffer> buffers()
+    {
+        buffer_sequence.clear();
+        for (const Segment& segment : segments) {
+            buffer_sequence.emplace_back(segment_data(segment), segment.size);
+        }
+        return buffer_sequence;
+    }
+
+    /**
+     * @brief: 把全部分段拼接成一个连续的字符串，用于不经过socket的场景
+    */
+    std::string to_string() const
+    {
+        std::string result;
+        result.reserve(total_size);
+        for (const Segment& segment : segments) {
+            result.append(segment_data(segment), segment.size);
+        }
+        return result;
+    }
+
+    size_t size() const { return total_size; }
+
+    size_t capacity() const { return inline_data.capacity(); }
+
+    /**
+     * @brief: 清空数据，保留inline_data等内部容器的容量以便复用
+    */
+    void clear()
+    {
+        inline_data.clear();
+        owned_data.clear();
+        segments.clear();
+        buffer_sequence.clear();
+        total_size = 0;
+    }
+
+private:
+    struct Segment
+    {
+        bool is_inline;     // true时数据位于inline_data[offset, offset + size)，否则为owned_data[offset]
+        size_t offset;
+        size_t size;
+    };
+
+    const char* segment_data(const Segment& segment) const
+    {
+        return segment.is_inline ? inline_data.data() + segment.offset : owned_data[segment.offset].data();
+    }
+
+    void check_range(size_t offset, size_t size) const
+    {
+        if (offset > total_size || size > total_size - offset) {
+            throw std::out_of_range("segmented buffer range out of bounds");
+        }
+    }
+
+    std::string inline_data;
+    std::vector<std::string> owned_data;
+    std::vector<Segment> segments;
+    std::vector<boost::asio::const_buffer> buffer_sequence;
+    size_t total_size = 0;
+};
+
+/**
+ * @brief: 线程安全的缓冲区对象池，复用std::string、SegmentedBuffer等带clear()和capacity()的缓冲区，减少高QPS下的内存分配
+ * @param T: 可移动的缓冲区类型，移动时保留其内部已分配的内存
+*/
+template <typename T>
+class BufferPool
+{
+public:
+    /**
+     * @param max_pooled: 池中最多缓存的缓冲区数量
+     * @param max_capacity: 超过该容量的缓冲区归还时直接释放，避免偶发的大请求长期占用内存
+    */
+    BufferPool(size_t max_pooled = 16, size_t max_capacity = 1 << 20) : max_pooled(max_pooled), max_capacity(max_capacity)
+    {
+    }
+
+    /**
+     * @brief: 取出一个空的缓冲区，池为空时新建
+    */
+    T acquire()
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (free_list.empty()) {
+            return T();
+        }
+        T buffer = std::move(free_list.back());
+        free_list.pop_back();
+        return buffer;
+    }
+
+    /**
+     * @brief: 归还缓冲区，清空数据但保留容量
+    */
+    void release(T&& buffer)
+    {
+        if (buffer.capacity() > max_capacity) {
+            return;
+        }
+        buffer.clear();
+        std::lock_guard<std::mutex> lock(mtx);
+        if (free_list.size() < max_pooled) {
+            free_list.push_back(std::move(buffer));
+        }
+    }
+
+private:
+    std::mutex mtx;
+    std::vector<T> free_list;
+    size_t max_pooled = 0;
+    size_t max_capacity = 0;
+};
+}
+}
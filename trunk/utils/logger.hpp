@@ -1,11 +1,33 @@
 #pragma once
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <format>
 #include <chrono>
 #include <ctime>
+#include <cstdio>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <cstdlib>
 #include "util.hpp"
 
+/**
+ * 编译期日志级别：低于STRUCT_RPC_LOG_LEVEL的日志宏展开为空语句，参数也不会被求值。可以在编译选项中定义，e.g.:
+ * -DSTRUCT_RPC_LOG_LEVEL=STRUCT_RPC_LOG_LEVEL_DEBUG
+*/
+#define STRUCT_RPC_LOG_LEVEL_TRACE 0
+#define STRUCT_RPC_LOG_LEVEL_DEBUG 1
+#define STRUCT_RPC_LOG_LEVEL_INFO 2
+#define STRUCT_RPC_LOG_LEVEL_WARN 3
+#define STRUCT_RPC_LOG_LEVEL_ERROR 4
+#ifndef STRUCT_RPC_LOG_LEVEL
+#define STRUCT_RPC_LOG_LEVEL STRUCT_RPC_LOG_LEVEL_INFO
+#endif
+
 namespace struct_rpc
 {
 namespace util
@@ -18,19 +40,259 @@ struct StringLiteral {
     constexpr StringLiteral(const char (&str)[N]) {
         std::copy_n(str, N, value);
     }
-    
+
     char value[N];
 };
 
+/**
+ * @brief: 日志级别，取值与STRUCT_RPC_LOG_LEVEL_*宏一致
+*/
+enum class LogLevel
+{
+    LEVEL_TRACE = STRUCT_RPC_LOG_LEVEL_TRACE,
+    LEVEL_DEBUG = STRUCT_RPC_LOG_LEVEL_DEBUG,
+    LEVEL_INFO = STRUCT_RPC_LOG_LEVEL_INFO,
+    LEVEL_WARN = STRUCT_RPC_LOG_LEVEL_WARN,
+    LEVEL_ERROR = STRUCT_RPC_LOG_LEVEL_ERROR,
+};
+
+inline constexpr std::string_view logLevelName(LogLevel level)
+{
+    constexpr std::string_view names[] = {"TRACE", "DEBUG", "INFO", "WARN", "ERROR"};
+    return names[static_cast<int>(level)];
+}
+
+/**
+ * @brief: 单个线程的日志环形队列，由该线程写入、后台刷新线程读取（单生产者单消费者），写入时无锁
+ * @note: 每条日志格式化到固定大小的槽位中，超长的日志被截断；队列已满时丢弃新日志并计数，不阻塞业务线程
+*/
+class LogRing
+{
+public:
+    static constexpr size_t capacity = 512;     // 槽位数量，必须为2的幂
+    static constexpr size_t slot_size = 256;    // 单条日志的最大长度
+
+    struct Slot
+    {
+        uint32_t size = 0;
+        char data[slot_size];
+    };
+
+    LogRing() : slots(std::make_unique<Slot[]>(capacity)) {}
+
+    /**
+     * @brief: 取得下一个可写的槽位，队列已满时返回nullptr
+    */
+    Slot* try_claim()
+    {
+        uint64_t head = write_index.load(std::memory_order_relaxed);
+        if (head - read_index.load(std::memory_order_acquire) >= capacity) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        return &slots[head & (capacity - 1)];
+    }
+
+    /**
+     * @brief: 发布try_claim取得的槽位，此后刷新线程才能读取
+    */
+    void publish()
+    {
+        write_index.store(write_index.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief: 把已发布的日志依次追加到output末尾，只由刷新线程调用
+    */
+    void drain(std::string& output)
+    {
+        uint64_t tail = read_index.load(std::memory_order_relaxed);
+        uint64_t head = write_index.load(std::memory_order_acquire);
+        for (; tail != head; ++tail) {
+            const Slot& slot = slots[tail & (capacity - 1)];
+            output.append(slot.data, slot.size);
+            output.push_back('\n');
+        }
+        read_index.store(tail, std::memory_order_release);
+        if (uint64_t dropped_num = dropped.exchange(0, std::memory_order_relaxed); dropped_num > 0) {
+            output.append(std::format("[logger] {} log entries dropped because the ring buffer was full\n", dropped_num));
+        }
+    }
+
+    bool empty() const
+    {
+        return read_index.load(std::memory_order_acquire) == write_index.load(std::memory_order_acquire);
+    }
+
+private:
+    std::unique_ptr<Slot[]> slots;
+    alignas(64) std::atomic<uint64_t> write_index = 0;
+    alignas(64) std::atomic<uint64_t> read_index = 0;
+    std::atomic<uint64_t> dropped = 0;
+};
+
+/**
+ * @brief: 异步日志后端。各线程写入自己的LogRing，后台线程定期把全部队列合并后一次写出到stdout
+ * @note: 业务线程只做格式化和一次release store，不加锁、不flush；同一线程的日志保持顺序，不同线程之间不保证顺序。
+ *        退出顺序：单例对象和刷新线程在进程退出时有意不销毁，静态对象析构、其他线程退出时打印的日志仍然写入有效的对象，
+ *        不依赖各编译单元静态对象的析构顺序。线程的日志队列在该线程的thread_local对象析构时释放，此后该线程打印的日志
+ *        （例如在其他thread_local或静态对象的析构函数中）不再进入队列，而是连同此前未写出的日志一起同步写出。
+ *        exit时由atexit注册的flush写出全部队列中的日志
+*/
+class AsyncLogger
+{
+public:
+    AsyncLogger(const AsyncLogger&) = delete;
+    AsyncLogger& operator=(const AsyncLogger&) = delete;
+
+    static AsyncLogger& getInstance()
+    {
+        // 有意泄漏，见类的说明
+        static AsyncLogger* instance = new AsyncLogger();
+        return *instance;
+    }
+
+    /**
+     * @brief: 在调用线程中立即写出全部已发布的日志
+    */
+    void flush()
+    {
+        std::string output;
+        write_pending(output);
+    }
+
+    /**
+     * @brief: 同步写出一条日志，写出前先写出各队列中已发布的日志。用于所属线程的队列已经释放的情况
+    */
+    void write_direct(std::string_view line)
+    {
+        std::string output;
+        write_pending(output, line);
+    }
+
+    /**
+     * @brief: 当前线程的日志队列，首次调用时创建并登记到刷新线程
+     * @return: 当前线程正在退出、队列已经释放时返回nullptr
+    */
+    LogRing* local_ring()
+    {
+        // ring_released不需要析构，在holder析构之后仍然可以安全读取
+        thread_local bool ring_released = false;
+        struct RingHolder
+        {
+            std::shared_ptr<LogRing> ring;
+            ~RingHolder() { ring_released = true; }
+        };
+        if (ring_released) {
+            return nullptr;
+        }
+        thread_local RingHolder holder {[this] {
+            auto new_ring = std::make_shared<LogRing>();
+            std::lock_guard<std::mutex> lock(mtx);
+            rings.push_back(new_ring);
+            return new_ring;
+        }()};
+        return holder.ring.get();
+    }
+
+private:
+    AsyncLogger()
+    {
+        std::thread([this] { flush_loop(); }).detach();
+        std::atexit([] { getInstance().flush(); });
+    }
+
+    /**
+     * @brief: 取出全部队列中已发布的日志并写出，同时回收所属线程已经退出的空队列
+     * @param line: 追加在队列中的日志之后一起写出的一条日志
+     * @return: 是否写出了日志
+    */
+    bool write_pending(std::string& output, std::string_view line = {})
+    {
+        // 读取和写出在同一把锁内完成，刷新线程与flush写出的日志不会乱序
+        std::lock_guard<std::mutex> output_lock(output_mtx);
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            for (auto& ring : rings) {
+                ring->drain(output);
+            }
+            // 线程退出后其队列只被这里引用，写完剩余日志即可回收
+            std::erase_if(rings, [](const std::shared_ptr<LogRing>& ring) { return ring.use_count() == 1 && ring->empty(); });
+        }
+        if (!line.empty()) {
+            output.append(line);
+            output.push_back('\n');
+        }
+        if (output.empty()) {
+            return false;
+        }
+        std::fwrite(output.data(), 1, output.size(), stdout);
+        std::fflush(stdout);
+        output.clear();
+        return true;
+    }
+
+    void flush_loop()
+    {
+        std::string output;
+        for (;;) {
+            if (!write_pending(output)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            }
+        }
+    }
+
+    std::mutex mtx;     // 只保护rings的增删，线程首次写日志和读取队列时获取，业务线程不会等待写出
+    std::mutex output_mtx;  // 串行化队列的读取与写出，只由刷新线程和flush获取
+    std::vector<std::shared_ptr<LogRing>> rings;
+};
+
+/**
+ * @brief: 返回当前时间"yyyy-MM-dd HH:mm:ss"，每个线程缓存上一次格式化的结果，同一秒内不再调用localtime_r和strftime
+*/
+inline std::string_view cachedCurrentTime()
+{
+    thread_local std::time_t cached_second = -1;
+    thread_local char cached_text[32] = {};
+    thread_local size_t cached_size = 0;
+    std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    if (now != cached_second) {
+        std::tm local_time;
+#ifdef _WIN32
+        localtime_s(&local_time, &now);
+#else
+        localtime_r(&now, &local_time);
+#endif
+        cached_size = ::strftime(cached_text, sizeof(cached_text), "%Y-%m-%d %H:%M:%S", &local_time);
+        cached_second = now;
+    }
+    return std::string_view(cached_text, cached_size);
+}
+
 /**
  * @brief: 打印日志。由于std::format要求传入的格式化字符串为编译期常量，故放在模板参数中
+ * @note: 日志直接格式化到当前线程日志队列的槽位中，不分配内存，由AsyncLogger的后台线程写出
 */
-template <StringLiteral FMT, typename... Args>
+template <LogLevel Level, StringLiteral FMT, typename... Args>
 inline void logMessage(std::string_view file, const char* function, int line, Args&&... args) {
-    std::string user_message = std::format(FMT.value, std::forward<Args>(args)...);
-    std::string log_entry = std::format("[{}] [{}:{}:{}] {}",
-                                        getCurrentTime(), file, function, line, user_message);
-    std::cout << log_entry << std::endl;
+    LogRing* ring = AsyncLogger::getInstance().local_ring();
+    // 线程退出过程中队列已经释放，格式化到栈上的槽位后同步写出
+    LogRing::Slot exiting_slot;
+    LogRing::Slot* slot = ring != nullptr ? ring->try_claim() : &exiting_slot;
+    if (slot == nullptr) {
+        return;
+    }
+    char* begin = slot->data;
+    char* end = slot->data + LogRing::slot_size;
+    // format_to_n最多写入指定长度，返回的out不会越过槽位末尾
+    char* out = std::format_to_n(begin, end - begin, "[{}] [{}] [{}:{}:{}] ", cachedCurrentTime(), logLevelName(Level), file, function, line).out;
+    out = std::format_to_n(out, end - out, FMT.value, std::forward<Args>(args)...).out;
+    slot->size = static_cast<uint32_t>(out - begin);
+    if (ring != nullptr) {
+        ring->publish();
+    } else {
+        AsyncLogger::getInstance().write_direct(std::string_view(slot->data, slot->size));
+    }
 }
 
 /**
@@ -47,7 +309,40 @@ inline constexpr std::string_view extractFileName(const std::string_view path) {
 }
 
 
-#define LOG(fmt, ...) struct_rpc::util::logMessage<fmt>(struct_rpc::util::extractFileName(__FILE__), __FUNCTION__, __LINE__, ##__VA_ARGS__)
+#define STRUCT_RPC_LOG_IMPL(level, fmt, ...) struct_rpc::util::logMessage<level, fmt>(struct_rpc::util::extractFileName(__FILE__), __FUNCTION__, __LINE__, ##__VA_ARGS__)
+
+#if STRUCT_RPC_LOG_LEVEL <= STRUCT_RPC_LOG_LEVEL_TRACE
+#define LOG_TRACE(fmt, ...) STRUCT_RPC_LOG_IMPL(struct_rpc::util::LogLevel::LEVEL_TRACE, fmt, ##__VA_ARGS__)
+#else
+#define LOG_TRACE(fmt, ...) ((void)0)
+#endif
+
+#if STRUCT_RPC_LOG_LEVEL <= STRUCT_RPC_LOG_LEVEL_DEBUG
+#define LOG_DEBUG(fmt, ...) STRUCT_RPC_LOG_IMPL(struct_rpc::util::LogLevel::LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(fmt, ...) ((void)0)
+#endif
 
+#if STRUCT_RPC_LOG_LEVEL <= STRUCT_RPC_LOG_LEVEL_INFO
+#define LOG_INFO(fmt, ...) STRUCT_RPC_LOG_IMPL(struct_rpc::util::LogLevel::LEVEL_INFO, fmt, ##__VA_ARGS__)
+#else
+#define LOG_INFO(fmt, ...) ((void)0)
+#endif
+
+#if STRUCT_RPC_LOG_LEVEL <= STRUCT_RPC_LOG_LEVEL_WARN
+#define LOG_WARN(fmt, ...) STRUCT_RPC_LOG_IMPL(struct_rpc::util::LogLevel::LEVEL_WARN, fmt, ##__VA_ARGS__)
+#else
+#define LOG_WARN(fmt, ...) ((void)0)
+#endif
+
+#if STRUCT_RPC_LOG_LEVEL <= STRUCT_RPC_LOG_LEVEL_ERROR
+#define LOG_ERROR(fmt, ...) STRUCT_RPC_LOG_IMPL(struct_rpc::util::LogLevel::LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(fmt, ...) ((void)0)
+#endif
+
+// 兼容原有的LOG宏，等同于LOG_INFO
+#define LOG(fmt, ...) LOG_INFO(fmt, ##__VA_ARGS__)
+
+}
 }
-}
\ No newline at end of file
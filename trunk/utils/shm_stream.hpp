@@ -0,0 +1,432 @@
+#pragma once
+#ifdef __linux__
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <boost/asio.hpp>
+#include <boost/asio/generic/stream_protocol.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+
+namespace struct_rpc
+{
+namespace util
+{
+/**
+ * @brief: 共享内存中单个方向的字节环形队列的控制块。读写位置单调递增，取模capacity得到数据区下标
+ * @note: 两端进程各自映射同一块内存，原子变量必须是无锁的才能跨进程使用
+*/
+struct ShmRingControl
+{
+    alignas(64) std::atomic<uint64_t> write_pos = 0;
+    alignas(64) std::atomic<uint64_t> read_pos = 0;
+    alignas(64) std::atomic<uint32_t> reader_waiting = 0;   // 读端即将阻塞在data eventfd上，写端发布数据后需要唤醒
+    std::atomic<uint32_t> writer_waiting = 0;               // 写端即将阻塞在space eventfd上，读端释放空间后需要唤醒
+    std::atomic<uint32_t> closed = 0;                       // 任一端关闭后置1
+};
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free);
+
+/**
+ * @brief: 基于共享内存环形队列的双向字节流，用于同一主机上进程间的RPC，数据不经过内核协议栈
+ * @note: 共享内存布局为[ring 0控制块][ring 1控制块][ring 0数据区][ring 1数据区]，ring 0为客户端到server方向。
+ *        每个ring有data和space两个eventfd：对端处于忙碌状态时读写只访问共享内存，只有对端标记了即将阻塞才通过eventfd唤醒，
+ *        本端在阻塞前先短暂自旋。共享内存和eventfd由客户端创建，通过已连接的Unix domain socket以SCM_RIGHTS传给server，
+ *        该socket在握手后保留，用于感知对端进程退出。
+ *        同一方向同时只能有一个读协程和一个写协程，读写需要在同一个strand上调用
+*/
+class ShmStream
+{
+public:
+    using socket_type = boost::asio::generic::stream_protocol::socket;
+    static constexpr size_t default_capacity = 1 << 20;    // 单个方向的队列容量，必须为2的幂
+    static constexpr int spin_count = 256;                 // 阻塞前自旋检查的次数
+
+    ShmStream() = default;
+
+    /**
+     * @brief: 客户端在已连接的Unix domain socket上创建共享内存流，接管socket
+    */
+    static ShmStream connect(socket_type socket, size_t capacity = default_capacity)
+    {
+        if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+            throw std::invalid_argument("shm ring capacity must be a power of 2");
+        }
+        FileDescriptor memfd(::memfd_create("struct_rpc_shm", MFD_CLOEXEC));
+        if (memfd.fd < 0 || ::ftruncate(memfd.fd, static_cast<off_t>(region_size(capacity))) != 0) {
+            throw_errno("failed to create shared memory");
+        }
+        auto mapping = std::make_shared<Mapping>(memfd.fd, region_size(capacity));
+        new (mapping->data) ShmRingControl();
+        new (mapping->data + sizeof(ShmRingControl)) ShmRingControl();
+
+        FileDescriptor events[4];
+        for (FileDescriptor& event : events) {
+            event.fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (event.fd < 0) {
+                throw_errno("failed to create eventfd");
+            }
+        }
+        int fds[5] = {memfd.fd, events[0].fd, events[1].fd, events[2].fd, events[3].fd};
+        uint64_t capacity_value = capacity;
+        send_fds(socket.native_handle(), &capacity_value, sizeof(capacity_value), fds);
+        return ShmStream(std::move(socket), std::move(mapping), capacity, true, events);
+    }
+
+    /**
+     * @brief: server从已接受的Unix domain socket上接收客户端创建的共享内存流，接管socket
+    */
+    static boost::asio::awaitable<ShmStream> accept(socket_type socket)
+    {
+        co_await socket.async_wait(boost::asio::socket_base::wait_read, boost::asio::use_awaitable);
+        uint64_t capacity = 0;
+        FileDescriptor fds[5];
+        receive_fds(socket.native_handle(), &capacity, sizeof(capacity), fds);
+        struct stat file_stat;
+        if (capacity == 0 || (capacity & (capacity - 1)) != 0 || ::fstat(fds[0].fd, &file_stat) != 0
+            || static_cast<size_t>(file_stat.st_size) != region_size(capacity)) {
+            throw std::runtime_error("invalid shm handshake");
+        }
+        auto mapping = std::make_shared<Mapping>(fds[0].fd, region_size(capacity));
+        co_return ShmStream(std::move(socket), std::move(mapping), capacity, false, fds + 1);
+    }
+
+    ShmStream(ShmStream&&) = default;
+    ShmStream& operator=(ShmStream&&) = default;
+
+    ~ShmStream()
+    {
+        close();
+    }
+
+    boost::asio::any_io_executor get_executor()
+    {
+        return state->control_socket.get_executor();
+    }
+
+    bool is_open() const
+    {
+        return state && state->control_socket.is_open();
+    }
+
+    /**
+     * @brief: 读取恰好buffer.size()字节。对端关闭且已读完剩余数据时抛出eof
+    */
+    boost::asio::awaitable<size_t> async_read(boost::asio::mutable_buffer buffer)
+    {
+        size_t done = 0;
+        while (done < buffer.size()) {
+            done += co_await async_read_some(buffer + done);
+        }
+        co_return done;
+    }
+
+    /**
+     * @brief: 读取队列中已有的数据，至多buffer.size()字节，队列为空时挂起等待。只在等待时挂起，被取消时不会消耗数据
+    */
+    boost::asio::awaitable<size_t> async_read_some(boost::asio::mutable_buffer buffer)
+    {
+        std::shared_ptr<State> state = checked_state();
+        ShmRingControl& ring = *state->in_control;
+        char* out = static_cast<char*>(buffer.data());
+        if (buffer.size() == 0) {
+            co_return 0;
+        }
+        for (;;) {
+            uint64_t read_pos = ring.read_pos.load(std::memory_order_relaxed);
+            // 控制块位于对端可写的共享内存中，长度按容量截断，避免越界访问
+            uint64_t available = std::min<uint64_t>(ring.write_pos.load(std::memory_order_acquire) - read_pos, state->capacity);
+            if (available == 0) {
+                if (ring.closed.load(std::memory_order_acquire)) {
+                    throw boost::system::system_error(boost::asio::error::eof);
+                }
+                co_await wait_until(ring.reader_waiting, state->in_data_event, [&ring, read_pos] {
+                    return ring.write_pos.load(std::memory_order_seq_cst) != read_pos || ring.closed.load(std::memory_order_seq_cst);
+                });
+                continue;
+            }
+            size_t size = std::min<uint64_t>(available, buffer.size());
+            size_t offset = read_pos & (state->capacity - 1);
+            size_t first = std::min(size, state->capacity - offset);
+            std::memcpy(out, state->in_data + offset, first);
+            std::memcpy(out + first, state->in_data, size - first);
+            ring.read_pos.store(read_pos + size, std::memory_order_seq_cst);
+            if (ring.writer_waiting.load(std::memory_order_seq_cst)) {
+                notify(state->in_space_event);
+            }
+            co_return size;
+        }
+    }
+
+    /**
+     * @brief: 依次写入全部缓冲区，队列已满时挂起等待对端读取。对端已关闭时抛出broken_pipe
+    */
+    boost::asio::awaitable<size_t> async_write(std::span<const boost::asio::const_buffer> buffers)
+    {
+        std::shared_ptr<State> state = checked_state();
+        ShmRingControl& ring = *state->out_control;
+        size_t total = 0;
+        for (const boost::asio::const_buffer& buffer : buffers) {
+            const char* data = static_cast<const char*>(buffer.data());
+            size_t done = 0;
+            while (done < buffer.size()) {
+                if (ring.closed.load(std::memory_order_acquire)) {
+                    throw boost::system::system_error(boost::asio::error::broken_pipe);
+                }
+                uint64_t write_pos = ring.write_pos.load(std::memory_order_relaxed);
+                uint64_t used = write_pos - ring.read_pos.load(std::memory_order_acquire);
+                uint64_t free_space = used < state->capacity ? state->capacity - used : 0;
+                if (free_space == 0) {
+                    co_await wait_until(ring.writer_waiting, state->out_space_event, [&ring, write_pos, capacity = state->capacity] {
+                        return write_pos - ring.read_pos.load(std::memory_order_seq_cst) < capacity || ring.closed.load(std::memory_order_seq_cst);
+                    });
+                    continue;
+                }
+                size_t size = std::min<uint64_t>(free_space, buffer.size() - done);
+                size_t offset = write_pos & (state->capacity - 1);
+                size_t first = std::min(size, state->capacity - offset);
+                std::memcpy(state->out_data + offset, data + done, first);
+                std::memcpy(state->out_data, data + done + first, size - first);
+                ring.write_pos.store(write_pos + size, std::memory_order_seq_cst);
+                if (ring.reader_waiting.load(std::memory_order_seq_cst)) {
+                    notify(state->out_data_event);
+                }
+                done += size;
+            }
+            total += buffer.size();
+        }
+        co_return total;
+    }
+
+    /**
+     * @brief: 关闭流并唤醒对端的读写协程，本端挂起中的读写以operation_aborted结束
+    */
+    void close()
+    {
+        if (state) {
+            state->shutdown();
+            state.reset();
+        }
+    }
+
+private:
+    struct FileDescriptor
+    {
+        int fd = -1;
+        FileDescriptor() = default;
+        explicit FileDescriptor(int fd) : fd(fd) {}
+        FileDescriptor(const FileDescriptor&) = delete;
+        ~FileDescriptor() { if (fd >= 0) { ::close(fd); } }
+        int release() { return std::exchange(fd, -1); }
+    };
+
+    struct Mapping
+    {
+        Mapping(int fd, size_t size) : size(size)
+        {
+            void* ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (ptr == MAP_FAILED) {
+                throw_errno("failed to map shared memory");
+            }
+            data = static_cast<char*>(ptr);
+        }
+        ~Mapping() { ::munmap(data, size); }
+
+        char* data = nullptr;
+        size_t size = 0;
+    };
+
+    /**
+     * @brief: 流的全部状态，由流对象和监视对端退出的协程共同持有
+    */
+    struct State
+    {
+        State(socket_type socket, std::shared_ptr<Mapping> mapping, size_t capacity, bool is_client, FileDescriptor* events)
+            : control_socket(std::move(socket)), mapping(std::move(mapping)), capacity(capacity),
+              in_data_event(control_socket.get_executor()), in_space_event(control_socket.get_executor()),
+              out_data_event(control_socket.get_executor()), out_space_event(control_socket.get_executor())
+        {
+            char* controls = this->mapping->data;
+            char* rings = controls + 2 * sizeof(ShmRingControl);
+            // 客户端写ring 0、读ring 1，server相反
+            size_t in_index = is_client ? 1 : 0;
+            size_t out_index = 1 - in_index;
+            in_control = std::launder(reinterpret_cast<ShmRingControl*>(controls + in_index * sizeof(ShmRingControl)));
+            out_control = std::launder(reinterpret_cast<ShmRingControl*>(controls + out_index * sizeof(ShmRingControl)));
+            in_data = rings + in_index * capacity;
+            out_data = rings + out_index * capacity;
+            in_data_event.assign(events[in_index * 2].release());
+            in_space_event.assign(events[in_index * 2 + 1].release());
+            out_data_event.assign(events[out_index * 2].release());
+            out_space_event.assign(events[out_index * 2 + 1].release());
+        }
+
+        /**
+         * @brief: 标记两个方向均已关闭并唤醒两端全部可能挂起的读写，随后关闭本端的描述符
+        */
+        void mark_closed()
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            in_control->closed.store(1, std::memory_order_seq_cst);
+            out_control->closed.store(1, std::memory_order_seq_cst);
+            for (auto* event : {&in_data_event, &in_space_event, &out_data_event, &out_space_event}) {
+                notify(*event);
+            }
+        }
+
+        void shutdown()
+        {
+            if (!control_socket.is_open()) {
+                return;
+            }
+            mark_closed();
+            std::lock_guard<std::mutex> lock(mtx);
+            boost::system::error_code ec;
+            control_socket.close(ec);
+            for (auto* event : {&in_data_event, &in_space_event, &out_data_event, &out_space_event}) {
+                event->close(ec);
+            }
+        }
+
+        std::mutex mtx;     // 监视协程与关闭流的线程可能不同，保证不会向已关闭的描述符写入
+        socket_type control_socket;
+        std::shared_ptr<Mapping> mapping;
+        size_t capacity = 0;
+        ShmRingControl* in_control = nullptr;
+        ShmRingControl* out_control = nullptr;
+        char* in_data = nullptr;
+        char* out_data = nullptr;
+        boost::asio::posix::stream_descriptor in_data_event;
+        boost::asio::posix::stream_descriptor in_space_event;
+        boost::asio::posix::stream_descriptor out_data_event;
+        boost::asio::posix::stream_descriptor out_space_event;
+    };
+
+    ShmStream(socket_type socket, std::shared_ptr<Mapping> mapping, size_t capacity, bool is_client, FileDescriptor* events)
+        : state(std::make_shared<State>(std::move(socket), std::move(mapping), capacity, is_client, events))
+    {
+        // 握手后socket上不再有数据，可读即表示对端关闭或进程退出，此时唤醒本端挂起的读写
+        boost::asio::co_spawn(state->control_socket.get_executor(), watch_peer(state), boost::asio::detached);
+    }
+
+    static boost::asio::awaitable<void> watch_peer(std::shared_ptr<State> state)
+    {
+        boost::system::error_code ec;
+        co_await state->control_socket.async_wait(boost::asio::socket_base::wait_read, boost::asio::redirect_error(boost::asio::use_awaitable, ec));
+        if (state->control_socket.is_open()) {
+            state->mark_closed();
+        }
+    }
+
+    std::shared_ptr<State> checked_state() const
+    {
+        if (!state) {
+            throw boost::system::system_error(boost::asio::error::bad_descriptor);
+        }
+        return state;
+    }
+
+    /**
+     * @brief: 自旋检查ready，仍未就绪时标记即将阻塞，再次检查后等待eventfd
+     * @note: 标记与检查均为seq_cst，与对端"先发布数据、再读取等待标记"的顺序配合，不会丢失唤醒；多余的唤醒只会导致一次重新检查
+    */
+    template <typename Ready>
+    static boost::asio::awaitable<void> wait_until(std::atomic<uint32_t>& waiting, boost::asio::posix::stream_descriptor& event, Ready ready)
+    {
+        for (int i = 0; i < spin_count; ++i) {
+            if (ready()) {
+                co_return;
+            }
+        }
+        waiting.store(1, std::memory_order_seq_cst);
+        struct WaitingGuard
+        {
+            std::atomic<uint32_t>& waiting;
+            ~WaitingGuard() { waiting.store(0, std::memory_order_relaxed); }
+        } waiting_guard {waiting};
+        if (ready()) {
+            co_return;
+        }
+        uint64_t counter = 0;
+        co_await event.async_read_some(boost::asio::buffer(&counter, sizeof(counter)), boost::asio::use_awaitable);
+    }
+
+    static void notify(boost::asio::posix::stream_descriptor& event)
+    {
+        if (event.is_open()) {
+            uint64_t value = 1;
+            [[maybe_unused]] ssize_t ret = ::write(event.native_handle(), &value, sizeof(value));
+        }
+    }
+
+    static size_t region_size(size_t capacity)
+    {
+        return 2 * sizeof(ShmRingControl) + 2 * capacity;
+    }
+
+    [[noreturn]] static void throw_errno(const char* message)
+    {
+        throw boost::system::system_error(boost::system::error_code(errno, boost::system::system_category()), message);
+    }
+
+    static void send_fds(int socket, const void* payload, size_t payload_size, std::span<const int> fds)
+    {
+        iovec iov {const_cast<void*>(payload), payload_size};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * 5)] = {};
+        msghdr message {};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = CMSG_SPACE(sizeof(int) * fds.size());
+        cmsghdr* header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int) * fds.size());
+        std::memcpy(CMSG_DATA(header), fds.data(), sizeof(int) * fds.size());
+        if (::sendmsg(socket, &message, MSG_NOSIGNAL) != static_cast<ssize_t>(payload_size)) {
+            throw_errno("failed to send shm handshake");
+        }
+    }
+
+    static void receive_fds(int socket, void* payload, size_t payload_size, std::span<FileDescriptor, 5> fds)
+    {
+        iovec iov {payload, payload_size};
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int) * 5)] = {};
+        msghdr message {};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        ssize_t received = ::recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+        cmsghdr* header = CMSG_FIRSTHDR(&message);
+        if (header != nullptr && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+            size_t fd_num = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < fd_num; ++i) {
+                int fd;
+                std::memcpy(&fd, CMSG_DATA(header) + i * sizeof(int), sizeof(int));
+                if (i < fds.size()) {
+                    fds[i].fd = fd;
+                } else {
+                    ::close(fd);
+                }
+            }
+        }
+        if (received != static_cast<ssize_t>(payload_size) || fds.back().fd < 0) {
+            throw std::runtime_error("invalid shm handshake");
+        }
+    }
+
+    std::shared_ptr<State> state;
+};
+}
+}
+#endif
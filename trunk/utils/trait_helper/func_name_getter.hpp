@@ -1,6 +1,7 @@
 #pragma once
 #include <string>
 #include <string_view>
+#include <cstdint>
 #include <array>   // std::array
 #include <utility> // std::index_sequence
 #include <iostream>
@@ -80,6 +81,29 @@ namespace trait_helper
         constexpr auto& value = struct_rpc_func_path_holder<Addr>::value;
         return std::string_view(value.data(), value.size());
     }
+
+    /**
+     * @brief: 64位FNV-1a哈希，编译期和运行期计算结果一致
+    */
+    constexpr uint64_t fnv1a_hash(std::string_view str)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for (char c : str) {
+            hash ^= static_cast<uint8_t>(c);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    /**
+     * @brief: 编译期计算RPC函数路径的哈希值，用于服务端处理函数表的查找
+    */
+    template <auto Addr>
+    constexpr uint64_t struct_rpc_func_hash()
+    {
+        constexpr uint64_t value = fnv1a_hash(struct_rpc_func_path<Addr>());
+        return value;
+    }
 }
 
 }
\ No newline at end of file
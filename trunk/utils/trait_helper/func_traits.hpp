@@ -2,10 +2,15 @@
 #include <type_traits>
 #include <vector>
 #include <functional>
+#include <span>
+#include <string_view>
 #include <boost/asio.hpp>
 #include "../../StructBuffer/trunk/utils/trait_helper.h"
 namespace struct_rpc
 {
+template <typename T>
+class StreamWriter;
+
 namespace trait_helper
 {
     /**
@@ -111,5 +116,54 @@ namespace trait_helper
         using arguments_tuple = typename function_traits<F>::arguments_tuple;
         return has_reference<arguments_tuple>::value;
     }
+
+    /**
+     * @brief: 判断参数类型是否为可以直接指向接收缓冲区的视图类型，包括std::string_view和单字节元素的std::span<const T>
+     * @note: 接收缓冲区中的数据不保证按多字节类型对齐，因此只支持单字节元素的span
+    */
+    template <typename T>
+    struct is_view_param : std::false_type {};
+
+    template <>
+    struct is_view_param<std::string_view> : std::true_type {};
+
+    template <typename T>
+    struct is_view_param<std::span<const T>> : std::bool_constant<sizeof(T) == 1 && std::is_trivially_copyable_v<T>> {};
+
+    template <typename T>
+    inline constexpr bool is_view_param_v = is_view_param<T>::value;
+    /**
+     * @brief: 流式RPC函数：返回awaitable<void>的协程，最后一个参数为StreamWriter<T>，通过它逐个写出T类型的结果
+    */
+    template <typename Tuple>
+    struct last_param_is_stream_writer : std::false_type {};
+
+    template <typename... Args>
+        requires (sizeof...(Args) > 0)
+    struct last_param_is_stream_writer<std::tuple<Args...>>
+        : std::bool_constant<structbuf::trait_helper::is_specialization_of_v<std::tuple_element_t<sizeof...(Args) - 1, std::tuple<Args...>>, StreamWriter>> {};
+
+    template <typename F>
+    concept is_stream_function = is_asio_coroutine<F> && last_param_is_stream_writer<typename function_traits<F>::decayed_arguments_tuple>::value;
+
+    template <typename Tuple, typename Indices>
+    struct tuple_prefix;
+
+    template <typename Tuple, size_t... Indices>
+    struct tuple_prefix<Tuple, std::index_sequence<Indices...>> {
+        using type = std::tuple<std::tuple_element_t<Indices, Tuple>...>;
+    };
+
+    /**
+     * @brief: 流式RPC函数的特征：stream_params_tuple为去掉末尾StreamWriter后的参数tuple，item_type为流中元素的类型
+    */
+    template <typename F>
+        requires is_stream_function<F>
+    struct stream_function_traits {
+        using decayed_arguments_tuple = typename function_traits<F>::decayed_arguments_tuple;
+        static constexpr size_t param_count = std::tuple_size_v<decayed_arguments_tuple> - 1;
+        using stream_params_tuple = typename tuple_prefix<decayed_arguments_tuple, std::make_index_sequence<param_count>>::type;
+        using item_type = typename std::tuple_element_t<param_count, decayed_arguments_tuple>::item_type;
+    };
+}
 }
-}
\ No newline at end of file